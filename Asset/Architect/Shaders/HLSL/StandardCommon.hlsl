@@ -16,6 +16,12 @@
     #endif
 #endif
 
+#ifdef GRASSBLADE
+    #ifndef D3D11
+        #error GRASSBLADE requires D3D11
+    #endif
+#endif
+
 /// Compute fade
 #ifdef OBJECTPROXY
     float ComputeProxyFade(float3 iNormal, float3 iEye, float3 iModelUp, float4 iProxyParam)
@@ -24,6 +30,26 @@
     }
 #endif
 
+/// Expand grass blade corner from compact blade data. Blade corner is selected by vertex index.
+#ifdef GRASSBLADE
+    float4 ExpandGrassBlade(float4 iPos, float4 iBlade, uint iVertexId, out float3 oNormal, out float2 oTexCoord)
+    {
+        const float2 corners[4] = { float2(0.0, 1.0), float2(1.0, 1.0), float2(1.0, 0.0), float2(0.0, 0.0) };
+        const float2 uv = corners[iVertexId % 4];
+
+        // Unpack normal, yaw and scale
+        const float2 normalXZ = iBlade.xy * 2.0 - 1.0;
+        const float3 normal = float3(normalXZ.x, sqrt(saturate(1.0 - dot(normalXZ, normalXZ))), normalXZ.y);
+        const float yaw = iBlade.z * 2.0 * M_PI;
+        const float scale = iBlade.w * 4.0;
+        const float3 tangent = ProjectVectorOnPlane(float3(cos(yaw), 0.0, -sin(yaw)), normal);
+
+        oNormal = normal;
+        oTexCoord = uv;
+        return float4(iPos.xyz + (tangent * (uv.x - 0.5) + normal * (1.0 - uv.y)) * scale, 1.0);
+    }
+#endif
+
 /// Discard by fade.
 #ifdef COMPILEPS
     void DiscardByFade(float4 iFade, float2 iFragPos)
@@ -11,12 +11,16 @@
 #endif
 
 void VS(float4 iPos : POSITION,
-    #if !defined(BILLBOARD) && !defined(TRAILFACECAM)
+    #if !defined(BILLBOARD) && !defined(TRAILFACECAM) && !defined(GRASSBLADE)
         float3 iNormal : NORMAL,
     #endif
-    #ifndef NOUV
+    #if !defined(NOUV) && !defined(GRASSBLADE)
         float2 iTexCoord : TEXCOORD0,
     #endif
+    #ifdef GRASSBLADE
+        float4 iBlade : COLOR0,
+        uint iVertexId : SV_VERTEXID,
+    #endif
     #ifdef VERTEXCOLOR
         float4 iColor : COLOR0,
     #endif
@@ -99,10 +103,17 @@ void VS(float4 iPos : POSITION,
     #endif
 
     // Define a 0,0 UV coord if not expected from the vertex data
-    #ifdef NOUV
+    #if defined(NOUV) && !defined(GRASSBLADE)
         float2 iTexCoord = float2(0.0, 0.0);
     #endif
 
+    // Expand grass blade
+    #ifdef GRASSBLADE
+        float3 iNormal;
+        float2 iTexCoord;
+        iPos = ExpandGrassBlade(iPos, iBlade, iVertexId, iNormal, iTexCoord);
+    #endif
+
     // Get matrix and vectors
     float4x3 modelMatrix = iModelMatrix;
     float3 modelPosition = iModelMatrix._m30_m31_m32;
@@ -4,7 +4,7 @@
 #include <FlexEngine/Factory/ModelFactory.h>
 #include <FlexEngine/Factory/ScriptedResource.h>
 #include <FlexEngine/Factory/TextureFactory.h>
-#include <FlexEngine/Math/PoissonRandom.h>
+#include <FlexEngine/Math/BlueNoiseTileSet.h>
 #include <FlexEngine/Math/WeightBlender.h>
 #include <FlexEngine/Resource/ResourceCacheHelpers.h>
 
@@ -207,19 +207,12 @@ Animation* BlendAnimations_wrapper(Model* model, CharacterSkeleton* skeleton, CS
         ArrayToPODVector<float>(weights), ArrayToPODVector<float>(offsets), ArrayToPODVector<float>(timestamps)).Detach();
 }
 
-static const float TODO_poissonStep = 0.05f;
-const PointCloud2DNorm& TODO_GetDefaultCloud()
-{
-    static PoissonRandom TODO_random(0);
-    static const PointCloud2DNorm TODO_cloud = TODO_random.generate(TODO_poissonStep, 30, 10000);
-    return TODO_cloud;
-}
-
 void TODO_CoverTerrainWithObjects(Node* terrainNode, Node* destNode, XMLFile* prefab,
     float minDistance, float objectRadius, const Vector2& begin, const Vector2& end)
 {
-    const float scale = minDistance / TODO_poissonStep;
-    PointCloud2D points = samplePointCloud(TODO_GetDefaultCloud(), begin, end, scale);
+    const SharedPtr<BlueNoiseTileSet> tiles = BlueNoiseTileSet::GetDefault(terrainNode->GetContext());
+    const float scale = minDistance / tiles->GetMinDistance();
+    PointCloud2D points = tiles->Sample(begin, end, scale);
 
     Scene* scene = terrainNode->GetScene();
     Octree* octree = scene->GetComponent<Octree>();
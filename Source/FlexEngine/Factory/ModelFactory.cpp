@@ -129,10 +129,10 @@ void ModelFactory::SetLevel(unsigned level)
     currentLevel_ = level;
 }
 
-void ModelFactory::AddGeometry(SharedPtr<Material> material, bool allowReuse /*= true*/)
+void ModelFactory::AddGeometry(Material* material, bool allowReuse /*= true*/)
 {
     // Find existing
-    const Vector<SharedPtr<Material>>::Iterator it = materials_.Find(material);
+    const PODVector<Material*>::Iterator it = materials_.Find(material);
 
     // Add new
     if (it == materials_.End() || !allowReuse)
@@ -222,7 +222,7 @@ const void* ModelFactory::GetIndices(unsigned geometry, unsigned level) const
     return level < GetNumGeometryLevels(geometry) ? geometry_[geometry][level].indexData.Buffer() : nullptr;
 }
 
-const Vector<SharedPtr<Material>>& ModelFactory::GetMaterials() const
+const PODVector<Material*>& ModelFactory::GetMaterials() const
 {
     return materials_;
 }
@@ -103,8 +103,8 @@ public:
     /// Initialize model factory. Vertex and index format must be the same for whole model.
     void Initialize(const PODVector<VertexElement>& vertexElements, bool largeIndices);
 
-    /// Add new geometry and set current material for further data write operations.
-    void AddGeometry(SharedPtr<Material> material, bool allowReuse = true);
+    /// Add new geometry and set current material for further data write operations. Material is not referenced and shall be kept alive by caller.
+    void AddGeometry(Material* material, bool allowReuse = true);
     /// Set current level for further data write operations.
     void SetLevel(unsigned level);
     /// Add nothing. This call just creates empty geometry level.
@@ -194,7 +194,7 @@ public:
     /// Get number of vertices for current level and material.
     unsigned GetCurrentNumVertices() const;
     /// Get materials.
-    const Vector<SharedPtr<Material>>& GetMaterials() const;
+    const PODVector<Material*>& GetMaterials() const;
 
     /// Build model from stored data.
     SharedPtr<Model> BuildModel() const;
@@ -213,8 +213,8 @@ private:
     unsigned currentLevel_ = 0;
     /// Geometry data grouped by material and levels.
     Vector<Vector<ModelGeometryBuffer>> geometry_;
-    /// Materials of geometries.
-    Vector<SharedPtr<Material>> materials_;
+    /// Materials of geometries. Not referenced, so the factory may be filled on worker thread.
+    PODVector<Material*> materials_;
 };
 
 /// Create model from script.
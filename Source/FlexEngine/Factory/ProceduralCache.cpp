@@ -0,0 +1,333 @@
+#include <FlexEngine/Factory/ProceduralCache.h>
+
+#include <FlexEngine/Resource/ResourceSaveQueue.h>
+
+#include <Urho3D/Container/HashSet.h>
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Resource/Resource.h>
+
+#include <cctype>
+
+namespace FlexEngine
+{
+
+namespace
+{
+
+/// Version of cache format. Increment to invalidate all entries.
+static const unsigned cacheFormatVersion = 1;
+
+/// Write 64-bit unsigned integer.
+void WriteUInt64(Serializer& dest, unsigned long long value)
+{
+    dest.WriteUInt(static_cast<unsigned>(value & 0xffffffff));
+    dest.WriteUInt(static_cast<unsigned>(value >> 32));
+}
+
+/// Read 64-bit unsigned integer.
+unsigned long long ReadUInt64(Deserializer& source)
+{
+    const unsigned long long low = source.ReadUInt();
+    const unsigned long long high = source.ReadUInt();
+    return low | (high << 32);
+}
+
+/// Return whether the file name looks like entry file or its temporary copy, i.e. starts with 16 hex digits.
+bool IsEntryFileName(const String& fileName)
+{
+    static const unsigned numDigits = 16;
+    if (fileName.Length() <= numDigits || fileName[numDigits] != '.')
+        return false;
+    for (unsigned i = 0; i < numDigits; ++i)
+    {
+        if (!isxdigit(static_cast<unsigned char>(fileName[i])))
+            return false;
+    }
+    return true;
+}
+
+}
+
+ProceduralCache::ProceduralCache(Context* context)
+    : Object(context)
+{
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    SetDirectory(fileSystem->GetAppPreferencesDir("FlexEngine", "ProceduralCache"));
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(ProceduralCache, HandleBeginFrame));
+}
+
+ProceduralCache::~ProceduralCache()
+{
+    SaveIndex();
+}
+
+void ProceduralCache::SetDirectory(const String& directory)
+{
+    // Pending entries and index must be written before unindexed files are removed
+    SaveIndex();
+    if (ResourceSaveQueue* saveQueue = GetSubsystem<ResourceSaveQueue>())
+        saveQueue->Flush();
+    directory_ = AddTrailingSlash(directory);
+    LoadIndex();
+    EvictEntries();
+}
+
+void ProceduralCache::SetMaxSize(unsigned long long maxSize)
+{
+    maxSize_ = maxSize;
+    EvictEntries();
+}
+
+bool ProceduralCache::Load(unsigned long long hash, const Vector<ResourceRef>& resourceRefs, Vector<SharedPtr<Resource>>& resources)
+{
+    resources.Clear();
+    auto iter = entries_.Find(hash);
+    if (iter == entries_.End())
+    {
+        ++numMisses_;
+        return false;
+    }
+
+    // Entry may still be pending in save queue
+    File file(context_, GetEntryFileName(hash), FILE_READ);
+    if (!file.IsOpen())
+    {
+        ++numMisses_;
+        return false;
+    }
+
+    // Entry is broken if anything doesn't match
+    bool valid = file.ReadFileID() == "PCCE" && file.ReadUInt() == cacheFormatVersion
+        && file.ReadVLE() == resourceRefs.Size();
+    PODVector<unsigned char> buffer;
+    for (unsigned i = 0; valid && i < resourceRefs.Size(); ++i)
+    {
+        const StringHash type = file.ReadStringHash();
+        buffer.Resize(file.ReadVLE());
+        if (buffer.Size() == 0)
+        {
+            resources.Push(nullptr);
+            continue;
+        }
+        if (type != resourceRefs[i].type_ || file.Read(buffer.Buffer(), buffer.Size()) != buffer.Size())
+        {
+            valid = false;
+            break;
+        }
+
+        MemoryBuffer memory(buffer);
+        SharedPtr<Resource> resource = DynamicCast<Resource>(context_->CreateObject(type));
+        if (!resource || !resource->Load(memory))
+        {
+            valid = false;
+            break;
+        }
+        resources.Push(resource);
+    }
+
+    if (!valid)
+    {
+        URHO3D_LOGWARNING("Procedural cache entry " + GetEntryFileName(hash) + " is broken and removed");
+        resources.Clear();
+        file.Close();
+        RemoveEntry(hash);
+        indexDirty_ = true;
+        ++numMisses_;
+        return false;
+    }
+
+    iter->second_.lastAccess_ = ++accessCounter_;
+    indexDirty_ = true;
+    ++numHits_;
+    return true;
+}
+
+void ProceduralCache::Store(unsigned long long hash, const Vector<SharedPtr<Resource>>& resources)
+{
+    if (directory_.Empty())
+        return;
+
+    // Serialize resources
+    VectorBuffer data;
+    data.WriteFileID("PCCE");
+    data.WriteUInt(cacheFormatVersion);
+    data.WriteVLE(resources.Size());
+    VectorBuffer resourceData;
+    for (const SharedPtr<Resource>& resource : resources)
+    {
+        resourceData.Clear();
+        if (resource && !resource->Save(resourceData))
+        {
+            URHO3D_LOGWARNING("Cannot store resource " + resource->GetName() + " in procedural cache");
+            return;
+        }
+        data.WriteStringHash(resource ? resource->GetType() : StringHash());
+        data.WriteVLE(resourceData.GetSize());
+        data.Write(resourceData.GetData(), resourceData.GetSize());
+    }
+
+    // Write entry in background if possible
+    const unsigned entrySize = data.GetSize();
+    GetSubsystem<FileSystem>()->CreateDir(directory_);
+    if (ResourceSaveQueue* saveQueue = GetSubsystem<ResourceSaveQueue>())
+        saveQueue->SaveData(GetEntryFileName(hash), data);
+    else
+    {
+        File file(context_, GetEntryFileName(hash), FILE_WRITE);
+        if (!file.IsOpen() || file.Write(data.GetData(), data.GetSize()) != data.GetSize())
+        {
+            URHO3D_LOGWARNING("Cannot write procedural cache entry " + GetEntryFileName(hash));
+            return;
+        }
+    }
+
+    Entry& entry = entries_[hash];
+    totalSize_ -= entry.size_;
+    entry.size_ = entrySize;
+    entry.lastAccess_ = ++accessCounter_;
+    totalSize_ += entry.size_;
+
+    EvictEntries();
+    indexDirty_ = true;
+}
+
+void ProceduralCache::Flush()
+{
+    SaveIndex();
+}
+
+String ProceduralCache::GetEntryFileName(unsigned long long hash) const
+{
+    return directory_ + ToStringHex(static_cast<unsigned>(hash >> 32)) + ToStringHex(static_cast<unsigned>(hash & 0xffffffff)) + ".bin";
+}
+
+String ProceduralCache::GetIndexFileName() const
+{
+    return directory_ + "Index.bin";
+}
+
+void ProceduralCache::HandleBeginFrame(StringHash /*eventType*/, VariantMap& /*eventData*/)
+{
+    SaveIndex();
+}
+
+void ProceduralCache::LoadIndex()
+{
+    indexDirty_ = false;
+    entries_.Clear();
+    totalSize_ = 0;
+    accessCounter_ = 0;
+
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    if (directory_.Empty() || !fileSystem->DirExists(directory_))
+        return;
+
+    if (fileSystem->FileExists(GetIndexFileName()))
+    {
+        File file(context_, GetIndexFileName(), FILE_READ);
+        if (file.IsOpen() && file.ReadFileID() == "PCIX" && file.ReadUInt() == cacheFormatVersion)
+        {
+            accessCounter_ = ReadUInt64(file);
+            const unsigned numEntries = file.ReadVLE();
+            for (unsigned i = 0; i < numEntries && !file.IsEof(); ++i)
+            {
+                const unsigned long long hash = ReadUInt64(file);
+                Entry entry;
+                entry.size_ = ReadUInt64(file);
+                entry.lastAccess_ = ReadUInt64(file);
+                if (fileSystem->FileExists(GetEntryFileName(hash)))
+                {
+                    entries_[hash] = entry;
+                    totalSize_ += entry.size_;
+                }
+            }
+        }
+    }
+
+    RemoveUnindexedFiles();
+}
+
+void ProceduralCache::RemoveUnindexedFiles()
+{
+    // Entries removed while their save was pending and interrupted saves leave files behind
+    HashSet<String> indexedFiles;
+    indexedFiles.Insert(GetFileNameAndExtension(GetIndexFileName()));
+    for (const auto& item : entries_)
+        indexedFiles.Insert(GetFileNameAndExtension(GetEntryFileName(item.first_)));
+
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    Vector<String> files;
+    fileSystem->ScanDir(files, directory_, "*.bin", SCAN_FILES, false);
+    for (const String& fileName : files)
+    {
+        if (IsEntryFileName(fileName) && !indexedFiles.Contains(fileName))
+            fileSystem->Delete(directory_ + fileName);
+    }
+}
+
+void ProceduralCache::SaveIndex()
+{
+    if (!indexDirty_ || directory_.Empty())
+        return;
+    indexDirty_ = false;
+
+    VectorBuffer data;
+    data.WriteFileID("PCIX");
+    data.WriteUInt(cacheFormatVersion);
+    WriteUInt64(data, accessCounter_);
+    data.WriteVLE(entries_.Size());
+    for (const auto& item : entries_)
+    {
+        WriteUInt64(data, item.first_);
+        WriteUInt64(data, item.second_.size_);
+        WriteUInt64(data, item.second_.lastAccess_);
+    }
+
+    // Write index in background if possible
+    if (ResourceSaveQueue* saveQueue = GetSubsystem<ResourceSaveQueue>())
+        saveQueue->SaveData(GetIndexFileName(), data);
+    else
+    {
+        File file(context_, GetIndexFileName(), FILE_WRITE);
+        if (!file.IsOpen() || file.Write(data.GetData(), data.GetSize()) != data.GetSize())
+            URHO3D_LOGWARNING("Cannot write procedural cache index " + GetIndexFileName());
+    }
+}
+
+void ProceduralCache::RemoveEntry(unsigned long long hash)
+{
+    auto iter = entries_.Find(hash);
+    if (iter == entries_.End())
+        return;
+
+    totalSize_ -= iter->second_.size_;
+    entries_.Erase(iter);
+    GetSubsystem<FileSystem>()->Delete(GetEntryFileName(hash));
+}
+
+void ProceduralCache::EvictEntries()
+{
+    bool evicted = false;
+    while (totalSize_ > maxSize_ && !entries_.Empty())
+    {
+        auto oldest = entries_.Begin();
+        for (auto iter = entries_.Begin(); iter != entries_.End(); ++iter)
+        {
+            if (iter->second_.lastAccess_ < oldest->second_.lastAccess_)
+                oldest = iter;
+        }
+        RemoveEntry(oldest->first_);
+        evicted = true;
+    }
+
+    if (evicted)
+        indexDirty_ = true;
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Core/Object.h>
+
+namespace Urho3D
+{
+
+class Resource;
+
+}
+
+namespace FlexEngine
+{
+
+/// On-disk content-addressed cache of procedurally generated resources. Entries are keyed by 64-bit hash of generator inputs
+/// and evicted in least recently used order when cache exceeds size limit.
+class ProceduralCache : public Object
+{
+    URHO3D_OBJECT(ProceduralCache, Object);
+
+public:
+    /// Construct.
+    ProceduralCache(Context* context);
+    /// Destruct.
+    virtual ~ProceduralCache();
+
+    /// Set cache directory. Index of entries is loaded from it.
+    void SetDirectory(const String& directory);
+    /// Return cache directory.
+    const String& GetDirectory() const { return directory_; }
+    /// Set max total size of entries, in bytes.
+    void SetMaxSize(unsigned long long maxSize);
+    /// Return max total size of entries, in bytes.
+    unsigned long long GetMaxSize() const { return maxSize_; }
+    /// Return total size of entries, in bytes.
+    unsigned long long GetSize() const { return totalSize_; }
+    /// Return number of entries.
+    unsigned GetNumEntries() const { return entries_.Size(); }
+    /// Return number of successful loads.
+    unsigned GetNumHits() const { return numHits_; }
+    /// Return number of failed loads.
+    unsigned GetNumMisses() const { return numMisses_; }
+
+    /// Load resources of entry. Resource types must match specified references. Return true if successful.
+    bool Load(unsigned long long hash, const Vector<ResourceRef>& resourceRefs, Vector<SharedPtr<Resource>>& resources);
+    /// Store resources as entry.
+    void Store(unsigned long long hash, const Vector<SharedPtr<Resource>>& resources);
+    /// Save index of entries now if it's dirty. Index is written by save queue if possible, so the queue shall be flushed after.
+    void Flush();
+
+private:
+    /// Cache entry.
+    struct Entry
+    {
+        /// Size of entry file, in bytes.
+        unsigned long long size_ = 0;
+        /// Access counter value of the last access.
+        unsigned long long lastAccess_ = 0;
+    };
+    /// Return file name of entry.
+    String GetEntryFileName(unsigned long long hash) const;
+    /// Return file name of index.
+    String GetIndexFileName() const;
+    /// Handle begin frame event.
+    void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
+    /// Load index of entries. Files of entries missing in index are removed.
+    void LoadIndex();
+    /// Remove files in cache directory that don't belong to any indexed entry.
+    void RemoveUnindexedFiles();
+    /// Save index of entries if it's dirty. Index is written by save queue if possible.
+    void SaveIndex();
+    /// Remove entry and its file.
+    void RemoveEntry(unsigned long long hash);
+    /// Remove least recently used entries until cache fits size limit.
+    void EvictEntries();
+
+    /// Cache directory.
+    String directory_;
+    /// Max total size of entries, in bytes.
+    unsigned long long maxSize_ = 1024ull * 1024 * 1024;
+    /// Total size of entries, in bytes.
+    unsigned long long totalSize_ = 0;
+    /// Access counter.
+    unsigned long long accessCounter_ = 0;
+    /// Entries.
+    HashMap<unsigned long long, Entry> entries_;
+    /// Whether the index is changed since last save. Changes are batched and saved once per frame.
+    bool indexDirty_ = false;
+    /// Number of successful loads.
+    unsigned numHits_ = 0;
+    /// Number of failed loads.
+    unsigned numMisses_ = 0;
+};
+
+}
@@ -1,13 +1,28 @@
 #include <FlexEngine/Factory/ProceduralComponent.h>
 
+#include <FlexEngine/Core/Attribute.h>
+#include <FlexEngine/Factory/ProceduralCache.h>
 #include <FlexEngine/Math/Hash.h>
 #include <FlexEngine/Resource/ResourceCacheHelpers.h>
 #include <FlexEngine/Resource/ResourceHash.h>
+#include <FlexEngine/Resource/ResourceSaveQueue.h>
 
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Drawable.h>
+#include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/Graphics/Viewport.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/VectorBuffer.h>
+#include <Urho3D/Resource/Image.h>
+#include <Urho3D/Resource/JSONFile.h>
 #include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/ResourceEvents.h>
 #include <Urho3D/Scene/Node.h>
 #include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Scene/SceneEvents.h>
@@ -18,6 +33,12 @@ namespace FlexEngine
 namespace
 {
 
+/// Return elapsed time of timer in milliseconds and reset timer.
+float GetElapsedMilliseconds(HiresTimer& timer)
+{
+    return timer.GetUSec(true) / 1000.0f;
+}
+
 /// Convert variant hash to uint32
 unsigned GetOptionalHash(const Variant& hash)
 {
@@ -30,50 +51,259 @@ unsigned GetOptionalHash(const Hash& hash)
     return hash.GetHash();
 }
 
-/// Check that specified resource exists. If resource doesn't exist, create stub resource and save it on drive.
-/// Returns true if matching resource is found.
-bool CheckResource(Context* context, const ResourceRef& resourceRef, bool checkHash, unsigned hash)
+/// Combined hash of node without agents in the whole subtree. Such nodes are ignored.
+static const unsigned long long emptyNodeHash = 1;
+
+/// Compute combined hash of node agents and children nodes in order. Cached hashes of children agents are used.
+/// Children nodes with own procedural component and nodes being removed are skipped. Return 0 if some agent cannot be hashed.
+unsigned long long ComputeNodeHash(Node& node)
 {
-    // Try to find file
-    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
-    if (cache->Exists(resourceRef.name_))
+    Hash hash;
+    PODVector<ProceduralComponentAgent*> agents;
+    node.GetDerivedComponents(agents);
+    hash.HashUInt(agents.Size());
+    for (ProceduralComponentAgent* agent : agents)
+    {
+        const unsigned long long agentHash = agent->ToHash64();
+        if (!agentHash)
+            return 0;
+        hash.HashUInt64(agentHash);
+    }
+
+    bool isEmpty = agents.Empty();
+    for (const SharedPtr<Node>& child : node.GetChildren())
+    {
+        if (child->GetParent() != &node || child->GetDerivedComponent<ProceduralComponent>())
+            continue;
+
+        // Nodes without agents aren't cached
+        ProceduralComponentAgent* childAgent = child->GetDerivedComponent<ProceduralComponentAgent>();
+        const unsigned long long childHash = childAgent ? childAgent->GetNodeHash() : ComputeNodeHash(*child);
+        if (!childHash)
+            return 0;
+        if (childHash == emptyNodeHash)
+            continue;
+
+        hash.HashUInt64(childHash);
+        isEmpty = false;
+    }
+
+    return isEmpty ? emptyNodeHash : Max(emptyNodeHash + 1, hash.GetHash64());
+}
+
+/// Recompute cached combined hashes of children nodes bottom-up.
+void UpdateChildrenNodeHashes(Node& node)
+{
+    for (const SharedPtr<Node>& child : node.GetChildren())
+    {
+        if (child->GetDerivedComponent<ProceduralComponent>())
+            continue;
+
+        UpdateChildrenNodeHashes(*child);
+        if (ProceduralComponentAgent* childAgent = child->GetDerivedComponent<ProceduralComponentAgent>())
+            childAgent->UpdateNodeHash();
+    }
+}
+
+/// Recompute cached combined hashes of node and its ancestors up to procedural component.
+void UpdateAncestorNodeHashes(Node* node)
+{
+    for (; node; node = node->GetParent())
     {
-        // Try to load resource
-        if (Resource* resource = cache->GetResource(resourceRef.type_, resourceRef.name_))
+        if (ProceduralComponent* component = node->GetDerivedComponent<ProceduralComponent>())
         {
-            // Check resource hash
-            if (!checkHash || (hash && GetOptionalHash(HashResource(resource)) == hash))
-            {
-                return true;
-            }
+            component->UpdateAgentsHash();
+            return;
         }
+        if (ProceduralComponentAgent* agent = node->GetDerivedComponent<ProceduralComponentAgent>())
+            agent->UpdateNodeHash();
     }
+}
+
+/// Version of resource manifest format.
+static const unsigned manifestVersion = 1;
+
+/// Return file name of resource manifest.
+String GetManifestFileName(const String& resourceFileName)
+{
+    return resourceFileName + ".manifest";
+}
+
+/// Write manifest of generated resource file. Manifest is used to validate the file without loading.
+void WriteResourceManifest(Context* context, const String& resourceFileName, unsigned hash)
+{
+    File resourceFile(context, resourceFileName, FILE_READ);
+    if (!resourceFile.IsOpen())
+        return;
+
+    File file(context, GetManifestFileName(resourceFileName), FILE_WRITE);
+    if (!file.IsOpen())
+        return;
+
+    file.WriteFileID("PCMF");
+    file.WriteUInt(manifestVersion);
+    file.WriteUInt(resourceFile.GetSize());
+    file.WriteUInt(context->GetSubsystem<FileSystem>()->GetLastModifiedTime(resourceFileName));
+    file.WriteUInt(hash);
+}
 
-    // Create new resource
-    if (SharedPtr<Resource> resource = DynamicCast<Resource>(context->CreateObject(resourceRef.type_)))
+/// Check resource file against its manifest and return hash of generated resource.
+/// Return false if there is no manifest or file is changed since generation.
+bool CheckResourceManifest(Context* context, const String& resourceFileName, unsigned& hash)
+{
+    FileSystem* fileSystem = context->GetSubsystem<FileSystem>();
+    const String manifestFileName = GetManifestFileName(resourceFileName);
+    if (!fileSystem->FileExists(manifestFileName))
+        return false;
+
+    File file(context, manifestFileName, FILE_READ);
+    if (!file.IsOpen() || file.ReadFileID() != "PCMF" || file.ReadUInt() != manifestVersion)
+        return false;
+
+    const unsigned size = file.ReadUInt();
+    const unsigned modifiedTime = file.ReadUInt();
+    hash = file.ReadUInt();
+    if (fileSystem->GetLastModifiedTime(resourceFileName) != modifiedTime)
+        return false;
+
+    File resourceFile(context, resourceFileName, FILE_READ);
+    return resourceFile.IsOpen() && resourceFile.GetSize() == size;
+}
+
+/// Number of resources checked by one work item.
+static const unsigned resourceCheckBatchSize = 16;
+
+/// Work queue priority of the most important generation task. Resource checks go before generation.
+static const unsigned maxGenerationPriority = M_MAX_UNSIGNED - 1;
+
+/// Generation priority of component.
+struct GenerationPriority
+{
+    /// Construct.
+    GenerationPriority(ProceduralComponent* component, Camera* camera)
     {
-        resource->SetName(resourceRef.name_);
-        InitializeStubResource(resource);
-        SaveResource(*resource);
+        Node* node = component->GetNode();
+        if (!node || !camera)
+            return;
+
+        const Drawable* drawable = node->GetDerivedComponent<Drawable>();
+        visible_ = drawable && drawable->IsInView();
+        distance_ = (node->GetWorldPosition() - camera->GetNode()->GetWorldPosition()).Length();
     }
-    else
+    /// Return whether this priority is higher than other one. Visible components go first, then closer ones.
+    bool IsHigherThan(const GenerationPriority& other) const
     {
-        URHO3D_LOGERROR("Cannot create resource of specified type");
+        if (visible_ != other.visible_)
+            return visible_;
+        return distance_ < other.distance_;
     }
 
-    return false;
+    /// Whether the component was visible last frame.
+    bool visible_ = false;
+    /// Distance to camera.
+    float distance_ = M_LARGE_VALUE;
+};
+
+/// Comparator of components by generation priority.
+struct GenerationPriorityCompare
+{
+    /// Construct.
+    explicit GenerationPriorityCompare(Camera* camera) : camera_(camera) { }
+    /// Compare components.
+    bool operator()(ProceduralComponent* lhs, ProceduralComponent* rhs) const
+    {
+        return GenerationPriority(lhs, camera_).IsHigherThan(GenerationPriority(rhs, camera_));
+    }
+
+    /// Camera.
+    Camera* camera_ = nullptr;
+};
+
+}
+
+void ProceduralGenerationStats::Add(const ProceduralGenerationStats& other)
+{
+    hashTime_ += other.hashTime_;
+    beginTime_ += other.beginTime_;
+    prepareTime_ += other.prepareTime_;
+    generateTime_ += other.generateTime_;
+    saveTime_ += other.saveTime_;
+    reloadTime_ += other.reloadTime_;
+    outputSize_ += other.outputSize_;
+    memoryUse_ += other.memoryUse_;
+    numCacheHits_ += other.numCacheHits_;
+    numSkippedOutputs_ += other.numSkippedOutputs_;
+    numFailures_ += other.numFailures_;
+}
+
+void ProceduralGenerationStats::Maximize(const ProceduralGenerationStats& other)
+{
+    hashTime_ = Max(hashTime_, other.hashTime_);
+    beginTime_ = Max(beginTime_, other.beginTime_);
+    prepareTime_ = Max(prepareTime_, other.prepareTime_);
+    generateTime_ = Max(generateTime_, other.generateTime_);
+    saveTime_ = Max(saveTime_, other.saveTime_);
+    reloadTime_ = Max(reloadTime_, other.reloadTime_);
+    outputSize_ = Max(outputSize_, other.outputSize_);
+    memoryUse_ = Max(memoryUse_, other.memoryUse_);
+    numCacheHits_ = Max(numCacheHits_, other.numCacheHits_);
+    numSkippedOutputs_ = Max(numSkippedOutputs_, other.numSkippedOutputs_);
+    numFailures_ = Max(numFailures_, other.numFailures_);
 }
 
+void ProceduralGenerationStats::ToJSON(JSONValue& dest) const
+{
+    dest.Set("hashTime", hashTime_);
+    dest.Set("beginTime", beginTime_);
+    dest.Set("prepareTime", prepareTime_);
+    dest.Set("generateTime", generateTime_);
+    dest.Set("saveTime", saveTime_);
+    dest.Set("reloadTime", reloadTime_);
+    dest.Set("totalTime", GetTotalTime());
+    dest.Set("outputSize", outputSize_);
+    dest.Set("memoryUse", memoryUse_);
+    dest.Set("cacheHits", numCacheHits_);
+    dest.Set("skippedOutputs", numSkippedOutputs_);
+    dest.Set("failures", numFailures_);
+}
+
+//////////////////////////////////////////////////////////////////////////
+void ProceduralSystem::TypeStats::ToJSON(JSONValue& dest) const
+{
+    JSONValue total;
+    JSONValue max;
+    total_.ToJSON(total);
+    max_.ToJSON(max);
+    dest.Set("generations", numGenerations_);
+    dest.Set("total", total);
+    dest.Set("max", max);
+    dest.Set("slowestNode", slowestNode_);
+    dest.Set("slowestTime", slowestTime_);
 }
 
 ProceduralSystem::ProceduralSystem(Context* context)
     : Component(context)
+    , numFinishedResourceCheckBatches_(0)
 {
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(ProceduralSystem, HandleUpdate));
+    SubscribeToEvent(E_RESOURCEBACKGROUNDLOADED, URHO3D_HANDLER(ProceduralSystem, HandleResourceBackgroundLoaded));
 }
 
 ProceduralSystem::~ProceduralSystem()
 {
+    // Worker threads may still reference the system. Items of prepared components may be recycled already
+    ProcessPreparedComponents();
+    WorkQueue* workQueue = GetSubsystem<WorkQueue>();
+    bool waitForWorkers = false;
+    for (const auto& item : runningTasks_)
+    {
+        if (!workQueue->RemoveWorkItem(item.second_.workItem_))
+            waitForWorkers = true;
+    }
+    if (numFinishedResourceCheckBatches_ != numResourceCheckBatches_)
+        waitForWorkers = true;
+    if (waitForWorkers)
+        workQueue->Complete(0);
 }
 
 void ProceduralSystem::RegisterObject(Context* context)
@@ -85,14 +315,158 @@ void ProceduralSystem::RegisterObject(Context* context)
     URHO3D_ACCESSOR_ATTRIBUTE("Resource List", GetResourceListAttr, SetResourceListAttr, VariantVector, Variant::emptyVariantVector, AM_FILE | AM_NOEDIT);
 
     URHO3D_ACCESSOR_ATTRIBUTE("Update Period", GetUpdatePeriod, SetUpdatePeriod, float, 0.1f, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Use Cache", GetUseCache, SetUseCache, bool, true, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Cache Size Limit MB", GetCacheSizeLimit, SetCacheSizeLimit, unsigned, 1024, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Save Queue Size Limit MB", GetSaveQueueSizeLimit, SetSaveQueueSizeLimit, unsigned, 256, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Use Worker Threads", GetUseWorkerThreads, SetUseWorkerThreads, bool, true, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Finish Time Budget", GetFinishTimeBudget, SetFinishTimeBudget, float, 8.0f, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Slow Generation Threshold", GetSlowGenerationThreshold, SetSlowGenerationThreshold, float, 1000.0f, AM_DEFAULT);
+
+    URHO3D_TRIGGER_ATTRIBUTE("<Reset Stats>", OnResetStatsTrigger);
+    URHO3D_TRIGGER_ATTRIBUTE("<Dump Stats>", OnDumpStatsTrigger);
+    URHO3D_MEMBER_ATTRIBUTE("Num Generations", unsigned, totalStats_.numGenerations_, 0, AM_EDIT);
+    URHO3D_ACCESSOR_ATTRIBUTE_FREE("Total Generation Time", [](const ClassName* classPtr) { return classPtr->GetTotalGenerationTime(); },
+        [](ClassName* /*classPtr*/, float /*value*/) { }, float, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Num Cache Hits", unsigned, totalStats_.total_.numCacheHits_, 0, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Slowest Node", String, totalStats_.slowestNode_, String::EMPTY, AM_EDIT);
 }
 
 void ProceduralSystem::Update()
 {
-    for (ProceduralComponent* component : dirtyComponents_)
-        component->GenerateResources();
-    dirtyComponentsSet_.Clear();
-    dirtyComponents_.Clear();
+    FinishResourceChecks();
+
+    WorkQueue* workQueue = GetSubsystem<WorkQueue>();
+    while (IsBusy())
+    {
+        StartGeneration();
+        if (!runningTasks_.Empty())
+            workQueue->Complete(0);
+        ProcessPreparedComponents();
+        FinishGeneration(0.0f);
+    }
+}
+
+void ProceduralSystem::FinishResourceChecks()
+{
+    WorkQueue* workQueue = GetSubsystem<WorkQueue>();
+    while (!checkedComponents_.Empty() || !resourceCheckTasks_.Empty())
+    {
+        if (numFinishedResourceCheckBatches_ != numResourceCheckBatches_)
+            workQueue->Complete(M_MAX_UNSIGNED);
+        ProcessResourceChecks();
+    }
+
+    // Wait for background loading of validated resources
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    while (!resourceValidations_.Empty())
+    {
+        const ResourceRef resourceRef = resourceValidations_.Front().second_.resourceRef_;
+        Resource* resource = cache->GetResource(resourceRef.type_, resourceRef.name_);
+        FinishResourceValidation(resourceRef.name_, resource);
+    }
+}
+
+bool ProceduralSystem::IsBusy() const
+{
+    return !dirtyComponents_.Empty() || !runningTasks_.Empty() || !finishQueue_.Empty();
+}
+
+void ProceduralSystem::SetCacheSizeLimit(unsigned cacheSizeLimit)
+{
+    cacheSizeLimit_ = cacheSizeLimit;
+    if (ProceduralCache* cache = GetSubsystem<ProceduralCache>())
+        cache->SetMaxSize(cacheSizeLimit_ * 1024ull * 1024ull);
+}
+
+void ProceduralSystem::SetSaveQueueSizeLimit(unsigned saveQueueSizeLimit)
+{
+    saveQueueSizeLimit_ = saveQueueSizeLimit;
+    if (ResourceSaveQueue* saveQueue = GetSubsystem<ResourceSaveQueue>())
+        saveQueue->SetMaxPendingSize(saveQueueSizeLimit_ * 1024ull * 1024ull);
+}
+
+ProceduralCache* ProceduralSystem::GetCache()
+{
+    if (!useCache_)
+        return nullptr;
+
+    // Cache entries are written by save queue
+    GetSaveQueue();
+
+    ProceduralCache* cache = GetSubsystem<ProceduralCache>();
+    if (!cache)
+    {
+        cache = new ProceduralCache(context_);
+        context_->RegisterSubsystem(cache);
+    }
+    cache->SetMaxSize(cacheSizeLimit_ * 1024ull * 1024ull);
+    return cache;
+}
+
+ResourceSaveQueue* ProceduralSystem::GetSaveQueue()
+{
+    ResourceSaveQueue* saveQueue = GetSubsystem<ResourceSaveQueue>();
+    if (!saveQueue)
+    {
+        saveQueue = new ResourceSaveQueue(context_);
+        context_->RegisterSubsystem(saveQueue);
+    }
+    saveQueue->SetMaxPendingSize(saveQueueSizeLimit_ * 1024ull * 1024ull);
+    return saveQueue;
+}
+
+void ProceduralSystem::AddGenerationStats(ProceduralComponent* component, const ProceduralGenerationStats& stats)
+{
+    const String nodeName = component->GetNode() ? component->GetNode()->GetName() : String::EMPTY;
+    const float totalTime = stats.GetTotalTime();
+    TypeStats* updatedStats[] = { &totalStats_, &typeStats_[component->GetTypeName()] };
+    for (TypeStats* typeStats : updatedStats)
+    {
+        if (typeStats->numGenerations_ == 0 || totalTime > typeStats->slowestTime_)
+        {
+            typeStats->slowestNode_ = nodeName;
+            typeStats->slowestTime_ = totalTime;
+        }
+        ++typeStats->numGenerations_;
+        typeStats->total_.Add(stats);
+        typeStats->max_.Maximize(stats);
+    }
+
+    if (slowGenerationThreshold_ > 0.0f && totalTime >= slowGenerationThreshold_)
+    {
+        URHO3D_LOGWARNING(ToString("Slow generation of %s at node '%s': %.1f ms "
+            "(hash %.1f, begin %.1f, prepare %.1f, generate %.1f, save %.1f, reload %.1f), output %u bytes, memory %u bytes",
+            component->GetTypeName().CString(), nodeName.CString(), totalTime,
+            stats.hashTime_, stats.beginTime_, stats.prepareTime_, stats.generateTime_, stats.saveTime_, stats.reloadTime_,
+            stats.outputSize_, stats.memoryUse_));
+    }
+}
+
+void ProceduralSystem::ResetGenerationStats()
+{
+    totalStats_ = TypeStats();
+    typeStats_.Clear();
+}
+
+void ProceduralSystem::GetGenerationStatsJSON(JSONValue& dest) const
+{
+    JSONValue types;
+    for (const auto& item : typeStats_)
+    {
+        JSONValue typeStats;
+        item.second_.ToJSON(typeStats);
+        types.Set(item.first_, typeStats);
+    }
+
+    totalStats_.ToJSON(dest);
+    dest.Set("types", types);
+}
+
+void ProceduralSystem::OnDumpStatsTrigger(bool)
+{
+    JSONFile json(context_);
+    GetGenerationStatsJSON(json.GetRoot());
+    URHO3D_LOGINFO("Procedural generation stats:\n" + json.ToString("  "));
 }
 
 void ProceduralSystem::AddResource(ProceduralComponent* component)
@@ -104,7 +478,11 @@ void ProceduralSystem::AddResource(ProceduralComponent* component)
 void ProceduralSystem::RemoveResource(ProceduralComponent* component)
 {
     if (component)
+    {
         components_.Erase(component);
+        dirtyComponents_.Remove(component);
+        dirtyComponentsSet_.Erase(component);
+    }
 }
 
 void ProceduralSystem::MarkComponentDirty(ProceduralComponent* component)
@@ -139,19 +517,399 @@ void ProceduralSystem::UpdateResourceList() const
 void ProceduralSystem::CheckProceduralResources()
 {
     for (const Variant& resource : resourceList_)
-        CheckResource(context_, resource.GetResourceRef(), false, 0);
+        queuedResourceChecks_.Push(resource.GetResourceRef());
+    StartResourceChecks();
+}
+
+void ProceduralSystem::CheckComponentResources(ProceduralComponent* component)
+{
+    Vector<ResourceRef> resourceRefs;
+    component->EnumerateResources(resourceRefs);
+    for (const ResourceRef& resourceRef : resourceRefs)
+    {
+        if (!resourceRef.name_.Empty())
+            queuedResourceChecks_.Push(resourceRef);
+    }
+    queuedComponentChecks_.Push(WeakPtr<ProceduralComponent>(component));
+    StartResourceChecks();
+}
+
+void ProceduralSystem::CheckResourcesAsync(const WorkItem* workItem, unsigned /*threadIndex*/)
+{
+    ProceduralSystem& self = *reinterpret_cast<ProceduralSystem*>(workItem->aux_);
+    Context* context = self.context_;
+    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+    ResourceCheckTask* begin = reinterpret_cast<ResourceCheckTask*>(workItem->start_);
+    ResourceCheckTask* end = reinterpret_cast<ResourceCheckTask*>(workItem->end_);
+    for (ResourceCheckTask* task = begin; task != end; ++task)
+    {
+        const String& name = task->resourceRef_.name_;
+        if (!cache->Exists(name))
+            task->result_ = ResourceCheckResult::Missing;
+        else
+        {
+            const String resourceFileName = cache->GetResourceFileName(name);
+            const bool unchanged = !resourceFileName.Empty() && CheckResourceManifest(context, resourceFileName, task->hash_);
+            task->result_ = unchanged ? ResourceCheckResult::Unchanged : ResourceCheckResult::Unknown;
+        }
+    }
+
+    // Pooled work item is recycled after completion, so finish is reported by counter
+    ++self.numFinishedResourceCheckBatches_;
+}
+
+void ProceduralSystem::StartResourceChecks()
+{
+    if (!resourceCheckTasks_.Empty() || !checkedComponents_.Empty())
+        return;
+    if (queuedResourceChecks_.Empty() && queuedComponentChecks_.Empty())
+        return;
+
+    resourceCheckTasks_.Resize(queuedResourceChecks_.Size());
+    for (unsigned i = 0; i < queuedResourceChecks_.Size(); ++i)
+        resourceCheckTasks_[i].resourceRef_ = queuedResourceChecks_[i];
+    queuedResourceChecks_.Clear();
+    checkedComponents_.Swap(queuedComponentChecks_);
+
+    // Check files on worker threads, results are processed on update
+    WorkQueue* workQueue = GetSubsystem<WorkQueue>();
+    numResourceCheckBatches_ = (resourceCheckTasks_.Size() + resourceCheckBatchSize - 1) / resourceCheckBatchSize;
+    numFinishedResourceCheckBatches_ = 0;
+    for (unsigned i = 0; i < resourceCheckTasks_.Size(); i += resourceCheckBatchSize)
+    {
+        SharedPtr<WorkItem> item = workQueue->GetFreeItem();
+        item->start_ = &resourceCheckTasks_[i];
+        item->end_ = &resourceCheckTasks_[0] + Min(i + resourceCheckBatchSize, resourceCheckTasks_.Size());
+        item->aux_ = this;
+        item->workFunction_ = &CheckResourcesAsync;
+        item->priority_ = M_MAX_UNSIGNED;
+        workQueue->AddWorkItem(item);
+    }
+}
+
+void ProceduralSystem::ProcessResourceChecks()
+{
+    if (resourceCheckTasks_.Empty() && checkedComponents_.Empty())
+        return;
+    if (numFinishedResourceCheckBatches_ != numResourceCheckBatches_)
+        return;
+
+    // Create missing resources
+    HashMap<String, const ResourceCheckTask*> results;
+    for (const ResourceCheckTask& task : resourceCheckTasks_)
+    {
+        if (results.Contains(task.resourceRef_.name_))
+            continue;
+
+        results[task.resourceRef_.name_] = &task;
+        if (task.result_ == ResourceCheckResult::Missing)
+            SaveStubResource(task.resourceRef_);
+    }
+
+    // Validate outputs of components
+    Vector<WeakPtr<ProceduralComponent>> checkedComponents;
+    checkedComponents.Swap(checkedComponents_);
+    for (ProceduralComponent* component : checkedComponents)
+    {
+        if (component && components_.Contains(component))
+            ApplyResourceChecks(component, results);
+    }
+
+    // Load other changed resources in background
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    for (const ResourceCheckTask& task : resourceCheckTasks_)
+    {
+        if (task.result_ == ResourceCheckResult::Unknown && !resourceValidations_.Contains(task.resourceRef_.name_))
+            cache->BackgroundLoadResource(task.resourceRef_.type_, task.resourceRef_.name_);
+    }
+
+    resourceCheckTasks_.Clear();
+    StartResourceChecks();
+}
+
+void ProceduralSystem::ApplyResourceChecks(ProceduralComponent* component, const HashMap<String, const ResourceCheckTask*>& results)
+{
+    Vector<ResourceRef> resourceRefs;
+    component->EnumerateResources(resourceRefs);
+    const VariantVector& resourcesHashes = component->GetResourcesHashesAttr();
+
+    PODVector<unsigned> unknownResources;
+    for (unsigned i = 0; i < resourceRefs.Size(); ++i)
+    {
+        if (resourceRefs[i].name_.Empty())
+            continue;
+
+        // Unchanged outputs are validated by manifest without loading
+        const unsigned referenceHash = i < resourcesHashes.Size() ? resourcesHashes[i].GetUInt() : 0;
+        auto iter = results.Find(resourceRefs[i].name_);
+        const ResourceCheckTask* task = iter != results.End() ? iter->second_ : nullptr;
+        if (!task || task->result_ == ResourceCheckResult::Missing || !referenceHash
+            || (task->result_ == ResourceCheckResult::Unchanged && task->hash_ != referenceHash))
+        {
+            MarkComponentDirty(component);
+            return;
+        }
+
+        if (task->result_ == ResourceCheckResult::Unknown)
+            unknownResources.Push(i);
+    }
+
+    for (unsigned i : unknownResources)
+        ValidateResource(component, resourceRefs[i], resourcesHashes[i].GetUInt());
+}
+
+void ProceduralSystem::ValidateResource(ProceduralComponent* component, const ResourceRef& resourceRef, unsigned hash)
+{
+    ResourceValidation& validation = resourceValidations_[resourceRef.name_];
+    validation.resourceRef_ = resourceRef;
+    validation.component_ = component;
+    validation.hash_ = hash;
+
+    // Resource may be already loaded or loaded synchronously if background loading is not supported
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    cache->BackgroundLoadResource(resourceRef.type_, resourceRef.name_);
+    if (Resource* resource = cache->GetExistingResource(resourceRef.type_, resourceRef.name_))
+        FinishResourceValidation(resourceRef.name_, resource);
+}
+
+void ProceduralSystem::FinishResourceValidation(const String& name, Resource* resource)
+{
+    auto iter = resourceValidations_.Find(name);
+    if (iter == resourceValidations_.End())
+        return;
+
+    const ResourceValidation validation = iter->second_;
+    resourceValidations_.Erase(iter);
+
+    ProceduralComponent* component = validation.component_;
+    if (!component || !components_.Contains(component))
+        return;
+
+    if (!resource)
+    {
+        SaveStubResource(validation.resourceRef_);
+        MarkComponentDirty(component);
+    }
+    else if (GetOptionalHash(HashResource(resource)) != validation.hash_)
+        MarkComponentDirty(component);
+}
+
+void ProceduralSystem::SaveStubResource(const ResourceRef& resourceRef)
+{
+    // Resource in memory may be generated and not written yet
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    if (cache->GetExistingResource(resourceRef.type_, resourceRef.name_))
+        return;
+
+    SharedPtr<Resource> resource = DynamicCast<Resource>(context_->CreateObject(resourceRef.type_));
+    if (!resource)
+    {
+        URHO3D_LOGERROR("Cannot create resource of specified type");
+        return;
+    }
+
+    resource->SetName(resourceRef.name_);
+    InitializeStubResource(resource);
+
+    Image* image = DynamicCast<Image>(resource.Get());
+    VectorBuffer data;
+    if (!image && !SerializeResource(*resource, data))
+    {
+        URHO3D_LOGERROR("Cannot serialize stub resource " + resourceRef.name_);
+        return;
+    }
+
+    // Stub is not generated resource
+    const String fileName = GetOutputResourceCacheDir(*cache) + resourceRef.name_;
+    GetSubsystem<FileSystem>()->Delete(GetManifestFileName(fileName));
+    ReplaceResource(*resource, data);
+    CreateDirectoriesToFile(*cache, fileName);
+
+    ResourceSaveQueue* saveQueue = GetSaveQueue();
+    if (image)
+        saveQueue->SaveImage(fileName, *image, nullptr, 0, resourceRef.name_);
+    else
+        saveQueue->SaveData(fileName, data, nullptr, 0, resourceRef.name_);
 }
 
 void ProceduralSystem::HandleUpdate(StringHash /*eventType*/, VariantMap& eventData)
 {
+    ProcessResourceChecks();
+
     elapsedTime_ += eventData[SceneUpdate::P_TIMESTEP].GetFloat();
     if (elapsedTime_ >= updatePeriod_ && !dirtyComponents_.Empty())
     {
         elapsedTime_ = 0.0f;
-        Update();
+        StartGeneration();
+    }
+
+    ProcessPreparedComponents();
+    if (!finishQueue_.Empty())
+        FinishGeneration(finishTimeBudget_);
+}
+
+void ProceduralSystem::HandleResourceBackgroundLoaded(StringHash /*eventType*/, VariantMap& eventData)
+{
+    using namespace ResourceBackgroundLoaded;
+
+    const String name = eventData[P_RESOURCENAME].GetString();
+    auto iter = resourceValidations_.Find(name);
+    if (iter == resourceValidations_.End())
+        return;
+
+    // Resource of other type may have the same name
+    Resource* resource = static_cast<Resource*>(eventData[P_RESOURCE].GetPtr());
+    if (!resource || resource->GetType() != iter->second_.resourceRef_.type_)
+        return;
+
+    FinishResourceValidation(name, eventData[P_SUCCESS].GetBool() ? resource : nullptr);
+}
+
+void ProceduralSystem::PrepareGenerationAsync(const WorkItem* workItem, unsigned /*threadIndex*/)
+{
+    ProceduralSystem& self = *reinterpret_cast<ProceduralSystem*>(workItem->aux_);
+    ProceduralComponent& component = *reinterpret_cast<ProceduralComponent*>(workItem->start_);
+    component.PrepareGeneration();
+
+    MutexLock lock(self.preparedComponentsMutex_);
+    self.preparedComponents_.Push(&component);
+}
+
+void ProceduralSystem::StartGeneration()
+{
+    // Find producers of resources
+    HashMap<String, ProceduralComponent*> producers;
+    Vector<ResourceRef> resourceRefs;
+    for (ProceduralComponent* component : components_)
+    {
+        resourceRefs.Clear();
+        component->EnumerateResources(resourceRefs);
+        for (const ResourceRef& resourceRef : resourceRefs)
+        {
+            if (!resourceRef.name_.Empty())
+                producers[resourceRef.name_] = component;
+        }
+    }
+
+    // Start components whose dependencies are neither dirty nor in progress
+    PODVector<ProceduralComponent*> readyComponents;
+    PODVector<ProceduralComponent*> blockedComponents;
+    for (ProceduralComponent* component : dirtyComponents_)
+    {
+        bool blocked = IsInProgress(component);
+        resourceRefs.Clear();
+        component->EnumerateDependencies(resourceRefs);
+        for (unsigned i = 0; i < resourceRefs.Size() && !blocked; ++i)
+        {
+            auto iter = producers.Find(resourceRefs[i].name_);
+            ProceduralComponent* producer = iter != producers.End() ? iter->second_ : nullptr;
+            blocked = producer && producer != component && (dirtyComponentsSet_.Contains(producer) || IsInProgress(producer));
+        }
+
+        if (blocked)
+            blockedComponents.Push(component);
+        else
+            readyComponents.Push(component);
+    }
+
+    // Break dependency cycles
+    const bool hasProgress = !runningTasks_.Empty() || !finishQueue_.Empty();
+    if (readyComponents.Empty() && !blockedComponents.Empty() && !hasProgress)
+    {
+        URHO3D_LOGWARNING("Procedural components have cyclic dependencies");
+        readyComponents.Push(blockedComponents.Front());
+        blockedComponents.Erase(0);
+    }
+
+    dirtyComponents_ = blockedComponents;
+    for (ProceduralComponent* component : readyComponents)
+        dirtyComponentsSet_.Erase(component);
+
+    Sort(readyComponents.Begin(), readyComponents.End(), GenerationPriorityCompare(GetPriorityCamera()));
+    WorkQueue* workQueue = GetSubsystem<WorkQueue>();
+    for (unsigned i = 0; i < readyComponents.Size(); ++i)
+    {
+        ProceduralComponent* component = readyComponents[i];
+        if (!component->BeginGeneration())
+            continue;
+
+        if (!useWorkerThreads_)
+        {
+            component->PrepareGeneration();
+            finishQueue_.Push(SharedPtr<ProceduralComponent>(component));
+            continue;
+        }
+
+        GenerationTask& task = runningTasks_[component];
+        task.component_ = component;
+        task.workItem_ = workQueue->GetFreeItem();
+        task.workItem_->start_ = component;
+        task.workItem_->aux_ = this;
+        task.workItem_->workFunction_ = &PrepareGenerationAsync;
+        task.workItem_->priority_ = maxGenerationPriority - i;
+        workQueue->AddWorkItem(task.workItem_);
     }
 }
 
+void ProceduralSystem::ProcessPreparedComponents()
+{
+    PODVector<ProceduralComponent*> preparedComponents;
+    {
+        MutexLock lock(preparedComponentsMutex_);
+        preparedComponents.Swap(preparedComponents_);
+    }
+
+    for (ProceduralComponent* component : preparedComponents)
+    {
+        auto iter = runningTasks_.Find(component);
+        if (iter == runningTasks_.End())
+            continue;
+
+        finishQueue_.Push(iter->second_.component_);
+        runningTasks_.Erase(iter);
+    }
+}
+
+void ProceduralSystem::FinishGeneration(float timeBudget)
+{
+    Sort(finishQueue_.Begin(), finishQueue_.End(), GenerationPriorityCompare(GetPriorityCamera()));
+
+    HiresTimer timer;
+    const long long maxTime = static_cast<long long>(timeBudget * 1000);
+    while (!finishQueue_.Empty())
+    {
+        // Component may be removed from scene while it is generated
+        SharedPtr<ProceduralComponent> component = finishQueue_.Front();
+        finishQueue_.Erase(0);
+        if (components_.Contains(component))
+            component->FinishGeneration();
+
+        if (maxTime > 0 && timer.GetUSec(false) >= maxTime)
+            break;
+    }
+}
+
+bool ProceduralSystem::IsInProgress(ProceduralComponent* component) const
+{
+    if (runningTasks_.Contains(component))
+        return true;
+
+    for (const SharedPtr<ProceduralComponent>& queuedComponent : finishQueue_)
+    {
+        if (queuedComponent.Get() == component)
+            return true;
+    }
+    return false;
+}
+
+Camera* ProceduralSystem::GetPriorityCamera() const
+{
+    Renderer* renderer = GetSubsystem<Renderer>();
+    Viewport* viewport = renderer ? renderer->GetViewport(0) : nullptr;
+    Camera* camera = viewport ? viewport->GetCamera() : nullptr;
+    return camera && camera->GetNode() && viewport->GetScene() == GetScene() ? camera : nullptr;
+}
+
 const VariantVector& ProceduralSystem::GetResourceListAttr() const
 {
     UpdateResourceList();
@@ -189,6 +947,18 @@ void ProceduralComponent::RegisterObject(Context* context)
 
     URHO3D_TRIGGER_ATTRIBUTE("<Update>", OnUpdateTrigger);
     URHO3D_ACCESSOR_ATTRIBUTE("Seed", GetSeedAttr, SetSeedAttr, unsigned, 0, AM_DEFAULT);
+
+    URHO3D_MEMBER_ATTRIBUTE("Last Hash Time", float, generationStats_.hashTime_, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Begin Time", float, generationStats_.beginTime_, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Prepare Time", float, generationStats_.prepareTime_, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Generate Time", float, generationStats_.generateTime_, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Save Time", float, generationStats_.saveTime_, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Reload Time", float, generationStats_.reloadTime_, 0.0f, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Output Size", unsigned, generationStats_.outputSize_, 0, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Memory Use", unsigned, generationStats_.memoryUse_, 0, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Cache Hits", unsigned, generationStats_.numCacheHits_, 0, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Skipped Outputs", unsigned, generationStats_.numSkippedOutputs_, 0, AM_EDIT);
+    URHO3D_MEMBER_ATTRIBUTE("Last Failures", unsigned, generationStats_.numFailures_, 0, AM_EDIT);
 }
 
 void ProceduralComponent::ApplyAttributes()
@@ -203,35 +973,71 @@ void ProceduralComponent::ApplyAttributes()
 
 void ProceduralComponent::CheckResources()
 {
-    Vector<ResourceRef> resourceRefs;
-    EnumerateResources(resourceRefs);
+    if (proceduralSystem_)
+        proceduralSystem_->CheckComponentResources(this);
+}
 
-    bool dirty = false;
-    for (unsigned i = 0; i < resourceRefs.Size(); ++i)
+void ProceduralComponent::EnumerateResources(Vector<ResourceRef>& /*resources*/)
+{
+}
+
+void ProceduralComponent::EnumerateDependencies(Vector<ResourceRef>& /*dependencies*/)
+{
+}
+
+void ProceduralComponent::GenerateResources()
+{
+    if (BeginGeneration())
     {
-        const unsigned referenceHash = i < resourcesHashes_.Size() ? resourcesHashes_[i].GetUInt() : 0;
-        if (!CheckResource(context_, resourceRefs[i], true, referenceHash))
-        {
-            dirty = true;
-            break;
-        }
+        PrepareGeneration();
+        FinishGeneration();
     }
+}
 
-    if (dirty && proceduralSystem_)
+bool ProceduralComponent::BeginGeneration()
+{
+    generationStats_ = ProceduralGenerationStats();
+    HiresTimer timer;
+
+    // Take resources from cache if possible
+    ProceduralCache* cache = proceduralSystem_ ? proceduralSystem_->GetCache() : nullptr;
+    generationHash_ = cache ? ToHash64() : 0;
+    if (generationHash_)
     {
-        proceduralSystem_->MarkComponentDirty(this);
+        Vector<SharedPtr<Resource>> resources;
+        Vector<ResourceRef> resourceRefs;
+        EnumerateResources(resourceRefs);
+        if (cache->Load(generationHash_, resourceRefs, resources))
+        {
+            generationStats_.hashTime_ = GetElapsedMilliseconds(timer);
+            generationStats_.numCacheHits_ = 1;
+            SaveGeneratedResources(resources, resourceRefs);
+            DoApplyCachedResources(resources);
+            ReportGenerationStats();
+            return false;
+        }
     }
+    generationStats_.hashTime_ = GetElapsedMilliseconds(timer);
+
+    DoBeginGeneration();
+    generationStats_.beginTime_ = GetElapsedMilliseconds(timer);
+    return true;
 }
 
-void ProceduralComponent::EnumerateResources(Vector<ResourceRef>& /*resources*/)
+void ProceduralComponent::PrepareGeneration()
 {
+    HiresTimer timer;
+    DoPrepareResources();
+    generationStats_.prepareTime_ = GetElapsedMilliseconds(timer);
 }
 
-void ProceduralComponent::GenerateResources()
+void ProceduralComponent::FinishGeneration()
 {
     // Generate resources
+    HiresTimer timer;
     Vector<SharedPtr<Resource>> resources;
     DoGenerateResources(resources);
+    generationStats_.generateTime_ = GetElapsedMilliseconds(timer);
 
     // Enumerate resources
     Vector<ResourceRef> resourceRefs;
@@ -239,22 +1045,79 @@ void ProceduralComponent::GenerateResources()
     if (resources.Size() != resourceRefs.Size())
     {
         URHO3D_LOGERROR("Mismatch of enumerated and generated resources");
+        generationStats_.numFailures_ = 1;
+        ReportGenerationStats();
         return;
     }
 
-    // Save
+    // Incomplete results are not cached
+    ProceduralCache* cache = proceduralSystem_ ? proceduralSystem_->GetCache() : nullptr;
+    if (cache && generationHash_ && !resources.Contains(SharedPtr<Resource>()))
+        cache->Store(generationHash_, resources);
+    generationStats_.saveTime_ = GetElapsedMilliseconds(timer);
+
+    SaveGeneratedResources(resources, resourceRefs);
+    ReportGenerationStats();
+}
+
+void ProceduralComponent::SaveGeneratedResources(const Vector<SharedPtr<Resource>>& resources, const Vector<ResourceRef>& resourceRefs)
+{
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    ResourceSaveQueue* saveQueue = proceduralSystem_ ? proceduralSystem_->GetSaveQueue() : nullptr;
     resourcesHashes_.Resize(resources.Size(), 0u);
+    HiresTimer timer;
     for (unsigned i = 0; i < resources.Size(); ++i)
     {
-        if (resources[i] && !resourceRefs[i].name_.Empty())
+        if (resourceRefs[i].name_.Empty())
+            continue;
+
+        // Old file of skipped output is kept, but it must not pass validation
+        if (!resources[i])
         {
-            resourcesHashes_[i] = Max(1u, HashResource(resources[i]).GetHash());
-            resources[i]->SetName(resourceRefs[i].name_);
-            SaveResource(*resources[i]);
+            resourcesHashes_[i] = 0;
+            ++generationStats_.numSkippedOutputs_;
+            const String fileName = GetOutputResourceCacheDir(*cache) + resourceRefs[i].name_;
+            GetSubsystem<FileSystem>()->Delete(GetManifestFileName(fileName));
+            continue;
         }
+
+        Resource& resource = *resources[i];
+        const unsigned hash = Max(1u, HashResource(&resource).GetHash());
+        const String fileName = GetOutputResourceCacheDir(*cache) + resourceRefs[i].name_;
+        resourcesHashes_[i] = hash;
+        resource.SetName(resourceRefs[i].name_);
+        generationStats_.memoryUse_ += resource.GetMemoryUse();
+
+        // Replace resource in memory and save file in background. Images are encoded on worker thread
+        Image* image = DynamicCast<Image>(&resource);
+        VectorBuffer data;
+        const bool isRawImage = image && !image->IsCompressed();
+        if (saveQueue && (isRawImage || SerializeResource(resource, data)))
+        {
+            generationStats_.outputSize_ += isRawImage
+                ? image->GetWidth() * image->GetHeight() * image->GetDepth() * image->GetComponents() : data.GetSize();
+            generationStats_.saveTime_ += GetElapsedMilliseconds(timer);
+            ReplaceResource(resource, data);
+            generationStats_.reloadTime_ += GetElapsedMilliseconds(timer);
+            CreateDirectoriesToFile(*cache, fileName);
+
+            if (isRawImage)
+                saveQueue->SaveImage(fileName, *image, &WriteResourceManifest, hash, resourceRefs[i].name_);
+            else
+                saveQueue->SaveData(fileName, data, &WriteResourceManifest, hash, resourceRefs[i].name_);
+        }
+        else if (SaveResource(resource))
+            WriteResourceManifest(context_, fileName, hash);
+        generationStats_.saveTime_ += GetElapsedMilliseconds(timer);
     }
 }
 
+void ProceduralComponent::ReportGenerationStats()
+{
+    if (proceduralSystem_)
+        proceduralSystem_->AddGenerationStats(this, generationStats_);
+}
+
 void ProceduralComponent::MarkNeedGeneration()
 {
     if (proceduralSystem_)
@@ -283,20 +1146,45 @@ void ProceduralComponent::MarkResourceListDirty()
 Variant ProceduralComponent::ToHash() const
 {
     Hash hash;
-    if (!node_ || !ComputeHash(hash))
+    const unsigned long long agentsHash = node_ ? GetAgentsHash() : 0;
+    if (!agentsHash || !ComputeHash(hash))
         return Variant::EMPTY;
 
-    PODVector<ProceduralComponentAgent*> agents;
-    node_->GetDerivedComponents(agents, true);
-    for (ProceduralComponentAgent* agent : agents)
+    hash.HashUInt64(agentsHash);
+    return hash.GetHash();
+}
+
+unsigned long long ProceduralComponent::ToHash64() const
+{
+    Hash hash;
+    const unsigned long long agentsHash = node_ ? GetAgentsHash() : 0;
+    if (!agentsHash || !ComputeHash(hash))
+        return 0;
+
+    hash.HashUInt(GetType().Value());
+    hash.HashUInt(GetGeneratorVersion());
+    hash.HashUInt64(agentsHash);
+    if (!ComputeDependencyHash(hash))
+        return 0;
+    return Max(1ull, hash.GetHash64());
+}
+
+void ProceduralComponent::UpdateAgentsHash()
+{
+    // Dirty hash is rebuilt on demand anyway
+    if (node_ && !agentsHashDirty_)
+        agentsHash_ = ComputeNodeHash(*node_);
+}
+
+unsigned long long ProceduralComponent::GetAgentsHash() const
+{
+    if (agentsHashDirty_)
     {
-        const Variant agentHash = agent->ToHash();
-        if (agentHash.IsEmpty())
-            return Variant::EMPTY;
-        hash.HashUInt(agentHash.GetUInt());
+        agentsHashDirty_ = false;
+        UpdateChildrenNodeHashes(*node_);
+        agentsHash_ = ComputeNodeHash(*node_);
     }
-
-    return hash.GetHash();
+    return agentsHash_;
 }
 
 bool ProceduralComponent::ComputeHash(Hash& hash) const
@@ -325,10 +1213,56 @@ void ProceduralComponent::OnSceneSet(Scene* scene)
     {
         proceduralSystem_ = scene->GetOrCreateComponent<ProceduralSystem>();
         proceduralSystem_->AddResource(this);
+        SubscribeToEvent(scene, E_NODEADDED, URHO3D_HANDLER(ProceduralComponent, HandleNodeAdded));
+        SubscribeToEvent(scene, E_NODEREMOVED, URHO3D_HANDLER(ProceduralComponent, HandleNodeRemoved));
+
+        // Agents may be created before this component
+        PODVector<ProceduralComponentAgent*> agents;
+        node_->GetDerivedComponents(agents, true);
+        for (ProceduralComponentAgent* agent : agents)
+            agent->UpdateHash();
+        MarkAgentsHashDirty();
     }
-    else if (proceduralSystem_)
+    else
     {
-        proceduralSystem_->RemoveResource(this);
+        UnsubscribeFromEvent(E_NODEADDED);
+        UnsubscribeFromEvent(E_NODEREMOVED);
+        if (proceduralSystem_)
+            proceduralSystem_->RemoveResource(this);
+    }
+}
+
+void ProceduralComponent::HandleNodeAdded(StringHash /*eventType*/, VariantMap& eventData)
+{
+    Node* addedNode = static_cast<Node*>(eventData[NodeAdded::P_NODE].GetPtr());
+    for (Node* parent = addedNode ? addedNode->GetParent() : nullptr; parent; parent = parent->GetParent())
+    {
+        if (parent == node_)
+        {
+            // Agents may be moved from another component
+            PODVector<ProceduralComponentAgent*> agents;
+            addedNode->GetDerivedComponents(agents, true);
+            for (ProceduralComponentAgent* agent : agents)
+                agent->UpdateHash();
+
+            MarkAgentsHashDirty();
+            MarkParametersDirty();
+            return;
+        }
+    }
+}
+
+void ProceduralComponent::HandleNodeRemoved(StringHash /*eventType*/, VariantMap& eventData)
+{
+    // Node is still attached here, so hash is rebuilt later
+    Node* parent = static_cast<Node*>(eventData[NodeRemoved::P_PARENT].GetPtr());
+    for (; parent; parent = parent->GetParent())
+    {
+        if (parent == node_)
+        {
+            MarkAgentsHashDirty();
+            return;
+        }
     }
 }
 
@@ -346,7 +1280,7 @@ ProceduralComponentAgent::ProceduralComponentAgent(Context* context)
 
 ProceduralComponentAgent::~ProceduralComponentAgent()
 {
-
+    SetHashParent(nullptr);
 }
 
 void ProceduralComponentAgent::RegisterObject(Context* context)
@@ -365,7 +1299,7 @@ void ProceduralComponentAgent::ApplyAttributes()
             parent->MarkResourceListDirty();
     }
 
-    const unsigned hash = GetOptionalHash(ToHash());
+    const unsigned hash = UpdateHash();
     if (!hash || hash != cachedHash_)
     {
         cachedHash_ = hash;
@@ -399,9 +1333,55 @@ Variant ProceduralComponentAgent::ToHash() const
     return Variant::EMPTY;
 }
 
+unsigned ProceduralComponentAgent::UpdateHash()
+{
+    Hash hash;
+    unsigned hash32 = 0;
+    cachedHash64_ = 0;
+    if (ComputeHash(hash))
+    {
+        hash32 = hash.GetHash();
+        hash.HashUInt(GetType().Value());
+        cachedHash64_ = Max(1ull, hash.GetHash64());
+    }
+
+    // Parent may change if agent is moved in hierarchy
+    ProceduralComponent* parent = GetScene() ? GetParent() : nullptr;
+    if (parent != hashParent_)
+        SetHashParent(parent);
+    else if (parent)
+        UpdateAncestorNodeHashes(node_);
+    return hash32;
+}
+
+void ProceduralComponentAgent::UpdateNodeHash()
+{
+    nodeHash_ = node_ ? ComputeNodeHash(*node_) : 0;
+}
+
+void ProceduralComponentAgent::SetHashParent(ProceduralComponent* parent)
+{
+    // Hierarchy of both components is changed
+    if (hashParent_)
+        hashParent_->MarkAgentsHashDirty();
+
+    hashParent_ = parent;
+
+    if (hashParent_)
+        hashParent_->MarkAgentsHashDirty();
+}
+
 bool ProceduralComponentAgent::ComputeHash(Hash& /*hash*/) const
 {
     return false;
 }
 
+void ProceduralComponentAgent::OnSceneSet(Scene* scene)
+{
+    if (scene)
+        UpdateHash();
+    else
+        SetHashParent(nullptr);
+}
+
 }
@@ -3,12 +3,18 @@
 #include <FlexEngine/Common.h>
 #include <FlexEngine/Scene/TriggerAttribute.h>
 
+#include <Urho3D/Core/Mutex.h>
 #include <Urho3D/Scene/Component.h>
 
+#include <atomic>
+
 namespace Urho3D
 {
 
+class Camera;
+class JSONValue;
 class Resource;
+struct WorkItem;
 
 }
 
@@ -16,7 +22,45 @@ namespace FlexEngine
 {
 
 class Hash;
+class ProceduralCache;
 class ProceduralComponent;
+class ResourceSaveQueue;
+
+/// Statistics of procedural generation. Times are in milliseconds.
+struct ProceduralGenerationStats
+{
+    /// Return total time of all phases.
+    float GetTotalTime() const { return hashTime_ + beginTime_ + prepareTime_ + generateTime_ + saveTime_ + reloadTime_; }
+    /// Add statistics.
+    void Add(const ProceduralGenerationStats& other);
+    /// Update every value with maximum of own and other value.
+    void Maximize(const ProceduralGenerationStats& other);
+    /// Write statistics to JSON.
+    void ToJSON(JSONValue& dest) const;
+
+    /// Time of hash computation and cache lookup.
+    float hashTime_ = 0.0f;
+    /// Time of generation beginning on main thread.
+    float beginTime_ = 0.0f;
+    /// Time of thread-safe part of generation.
+    float prepareTime_ = 0.0f;
+    /// Time of resource generation on main thread.
+    float generateTime_ = 0.0f;
+    /// Time of resource hashing, serialization and saving.
+    float saveTime_ = 0.0f;
+    /// Time of resource replacement in memory.
+    float reloadTime_ = 0.0f;
+    /// Total size of serialized resources, in bytes.
+    unsigned outputSize_ = 0;
+    /// Total memory use of generated resources, in bytes.
+    unsigned memoryUse_ = 0;
+    /// Number of generations that took resources from cache.
+    unsigned numCacheHits_ = 0;
+    /// Number of outputs that were not generated, e.g. GPU-rendered outputs without renderer.
+    unsigned numSkippedOutputs_ = 0;
+    /// Number of failed generations, e.g. generator returned wrong number of resources.
+    unsigned numFailures_ = 0;
+};
 
 /// Procedural resource generation system.
 class ProceduralSystem : public Component
@@ -31,13 +75,56 @@ public:
     /// Register object factory.
     static void RegisterObject(Context* context);
 
-    /// Update system. Generate all dirty resources.
+    /// Update system. Generate all dirty resources and wait for completion.
     void Update();
+    /// Return whether the system has pending or unfinished generation.
+    bool IsBusy() const;
+    /// Return number of components that wait for generation.
+    unsigned GetNumDirtyComponents() const { return dirtyComponents_.Size(); }
 
     /// Set update period.
     void SetUpdatePeriod(float updatePeriod) { updatePeriod_ = updatePeriod; }
     /// Return update period.
     float GetUpdatePeriod() const { return updatePeriod_; }
+    /// Set whether to use cache of generated resources.
+    void SetUseCache(bool useCache) { useCache_ = useCache; }
+    /// Return whether to use cache of generated resources.
+    bool GetUseCache() const { return useCache_; }
+    /// Set size limit of cache, in megabytes.
+    void SetCacheSizeLimit(unsigned cacheSizeLimit);
+    /// Return size limit of cache, in megabytes.
+    unsigned GetCacheSizeLimit() const { return cacheSizeLimit_; }
+    /// Return cache of generated resources. Cache is shared by all procedural systems. Returns null if cache is not used.
+    ProceduralCache* GetCache();
+    /// Set size limit of pending background saves, in megabytes.
+    void SetSaveQueueSizeLimit(unsigned saveQueueSizeLimit);
+    /// Return size limit of pending background saves, in megabytes.
+    unsigned GetSaveQueueSizeLimit() const { return saveQueueSizeLimit_; }
+    /// Return queue of background saves of generated resources. Queue is shared by all procedural systems.
+    ResourceSaveQueue* GetSaveQueue();
+    /// Set whether to run thread-safe part of generation on worker threads.
+    void SetUseWorkerThreads(bool useWorkerThreads) { useWorkerThreads_ = useWorkerThreads; }
+    /// Return whether to run thread-safe part of generation on worker threads.
+    bool GetUseWorkerThreads() const { return useWorkerThreads_; }
+    /// Set max time spent on finishing generation on main thread per frame, in milliseconds. At least one component is finished per frame. Zero means no limit.
+    void SetFinishTimeBudget(float finishTimeBudget) { finishTimeBudget_ = finishTimeBudget; }
+    /// Return max time spent on finishing generation on main thread per frame, in milliseconds.
+    float GetFinishTimeBudget() const { return finishTimeBudget_; }
+    /// Set min generation time of component that is reported as slow, in milliseconds. Zero disables reporting.
+    void SetSlowGenerationThreshold(float slowGenerationThreshold) { slowGenerationThreshold_ = slowGenerationThreshold; }
+    /// Return min generation time of component that is reported as slow, in milliseconds.
+    float GetSlowGenerationThreshold() const { return slowGenerationThreshold_; }
+
+    /// Add statistics of finished generation of component.
+    void AddGenerationStats(ProceduralComponent* component, const ProceduralGenerationStats& stats);
+    /// Reset generation statistics.
+    void ResetGenerationStats();
+    /// Write generation statistics aggregated per component type to JSON.
+    void GetGenerationStatsJSON(JSONValue& dest) const;
+    /// Return number of finished generations.
+    unsigned GetNumGenerations() const { return totalStats_.numGenerations_; }
+    /// Return total time of finished generations, in milliseconds.
+    float GetTotalGenerationTime() const { return totalStats_.total_.GetTotalTime(); }
 
     /// Add resource.
     void AddResource(ProceduralComponent* component);
@@ -47,10 +134,85 @@ public:
     void MarkComponentDirty(ProceduralComponent* component);
     /// Mark resource list dirty.
     void MarkResourceListDirty();
+    /// Queue check of existing resources of component. Component is marked dirty if some resource is missing or changed.
+    void CheckComponentResources(ProceduralComponent* component);
+    /// Wait for pending resource checks.
+    void FinishResourceChecks();
 
 private:
+    /// Generation of component that runs on worker thread.
+    struct GenerationTask
+    {
+        /// Component. Kept alive until worker thread is done.
+        SharedPtr<ProceduralComponent> component_;
+        /// Work item.
+        SharedPtr<WorkItem> workItem_;
+    };
+    /// State of procedural resource found by asynchronous check.
+    enum class ResourceCheckResult
+    {
+        /// Resource file doesn't exist.
+        Missing,
+        /// Resource file exists and is not changed since generation.
+        Unchanged,
+        /// Resource file exists, but it must be loaded to be validated.
+        Unknown
+    };
+    /// Asynchronous check of procedural resource.
+    struct ResourceCheckTask
+    {
+        /// Resource.
+        ResourceRef resourceRef_;
+        /// Result.
+        ResourceCheckResult result_ = ResourceCheckResult::Missing;
+        /// Hash of generated resource from manifest.
+        unsigned hash_ = 0;
+    };
+    /// Validation of component resource that is loaded in background.
+    struct ResourceValidation
+    {
+        /// Resource.
+        ResourceRef resourceRef_;
+        /// Component.
+        WeakPtr<ProceduralComponent> component_;
+        /// Expected hash of resource.
+        unsigned hash_ = 0;
+    };
+    /// Generation statistics of components of some type.
+    struct TypeStats
+    {
+        /// Write statistics to JSON.
+        void ToJSON(JSONValue& dest) const;
+
+        /// Number of generations.
+        unsigned numGenerations_ = 0;
+        /// Sum of statistics.
+        ProceduralGenerationStats total_;
+        /// Max of statistics.
+        ProceduralGenerationStats max_;
+        /// Name of node of the slowest generation.
+        String slowestNode_;
+        /// Total time of the slowest generation, in milliseconds.
+        float slowestTime_ = 0.0f;
+    };
+
     /// Handle update event and update component if needed.
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
+    /// Handle background loading of resource and finish its validation.
+    void HandleResourceBackgroundLoaded(StringHash eventType, VariantMap& eventData);
+    /// Prepare generation of component on worker thread.
+    static void PrepareGenerationAsync(const WorkItem* workItem, unsigned threadIndex);
+
+    /// Start generation of dirty components whose dependencies are generated.
+    void StartGeneration();
+    /// Move components prepared by worker threads to finish queue.
+    void ProcessPreparedComponents();
+    /// Finish generation on main thread within time budget. Zero budget means no limit.
+    void FinishGeneration(float timeBudget);
+    /// Return whether the component is being generated.
+    bool IsInProgress(ProceduralComponent* component) const;
+    /// Return camera used for prioritization.
+    Camera* GetPriorityCamera() const;
 
     /// Return resource list attribute.
     const VariantVector& GetResourceListAttr() const;
@@ -59,8 +221,29 @@ private:
 
     /// Update resource list.
     void UpdateResourceList() const;
-    /// Check all procedural resources.
+    /// Queue check of all procedural resources.
     void CheckProceduralResources();
+    /// Check resource files on worker thread.
+    static void CheckResourcesAsync(const WorkItem* workItem, unsigned threadIndex);
+    /// Start check of queued resources unless previous check is running.
+    void StartResourceChecks();
+    /// Process results of resource checks if worker threads are done.
+    void ProcessResourceChecks();
+    /// Mark component dirty if its resources are invalid. Resources that cannot be validated without loading are loaded in background.
+    void ApplyResourceChecks(ProceduralComponent* component, const HashMap<String, const ResourceCheckTask*>& results);
+    /// Load resource in background and validate it against expected hash.
+    void ValidateResource(ProceduralComponent* component, const ResourceRef& resourceRef, unsigned hash);
+    /// Finish validation of loaded resource. Null resource means that resource cannot be loaded.
+    void FinishResourceValidation(const String& name, Resource* resource);
+    /// Place stub resource into cache and queue its save.
+    void SaveStubResource(const ResourceRef& resourceRef);
+
+    /// Always returns false.
+    bool GetFalse() const { return false; }
+    /// Handle reset statistics action.
+    void OnResetStatsTrigger(bool) { ResetGenerationStats(); }
+    /// Handle dump statistics action.
+    void OnDumpStatsTrigger(bool);
 
 private:
     /// Procedural components.
@@ -69,9 +252,33 @@ private:
     HashSet<ProceduralComponent*> dirtyComponentsSet_;
     /// Vector of dirty components in right order.
     PODVector<ProceduralComponent*> dirtyComponents_;
+    /// Components prepared on worker threads.
+    HashMap<ProceduralComponent*, GenerationTask> runningTasks_;
+    /// Components prepared by worker threads and waiting for processing on main thread.
+    PODVector<ProceduralComponent*> preparedComponents_;
+    /// Prepared components mutex.
+    Mutex preparedComponentsMutex_;
+    /// Components waiting for finish on main thread.
+    Vector<SharedPtr<ProceduralComponent>> finishQueue_;
 
     /// Update period.
     float updatePeriod_ = 0.1f;
+    /// Whether to use cache of generated resources.
+    bool useCache_ = true;
+    /// Size limit of cache, in megabytes.
+    unsigned cacheSizeLimit_ = 1024;
+    /// Size limit of pending background saves, in megabytes.
+    unsigned saveQueueSizeLimit_ = 256;
+    /// Whether to run thread-safe part of generation on worker threads.
+    bool useWorkerThreads_ = true;
+    /// Max time spent on finishing generation on main thread per frame, in milliseconds.
+    float finishTimeBudget_ = 8.0f;
+    /// Min generation time of component that is reported as slow, in milliseconds.
+    float slowGenerationThreshold_ = 1000.0f;
+    /// Generation statistics of all components.
+    TypeStats totalStats_;
+    /// Generation statistics per component type.
+    HashMap<String, TypeStats> typeStats_;
     /// Accumulated time for update.
     float elapsedTime_ = 0.0f;
 
@@ -79,6 +286,21 @@ private:
     mutable bool resourceListDirty_ = false;
     /// Resource list.
     mutable VariantVector resourceList_;
+
+    /// Resources waiting for check.
+    Vector<ResourceRef> queuedResourceChecks_;
+    /// Components waiting for check.
+    Vector<WeakPtr<ProceduralComponent>> queuedComponentChecks_;
+    /// Resources being checked on worker threads.
+    Vector<ResourceCheckTask> resourceCheckTasks_;
+    /// Number of work items of running resource check.
+    unsigned numResourceCheckBatches_ = 0;
+    /// Number of finished work items of running resource check. Incremented by worker threads.
+    std::atomic<unsigned> numFinishedResourceCheckBatches_;
+    /// Components whose resources are being checked.
+    Vector<WeakPtr<ProceduralComponent>> checkedComponents_;
+    /// Resources being loaded for validation.
+    HashMap<String, ResourceValidation> resourceValidations_;
 };
 
 /// Base class of host component of procedurally generated resource.
@@ -96,12 +318,22 @@ public:
     /// Apply attribute changes that can not be applied immediately. Called after scene load or a network update.
     virtual void ApplyAttributes();
 
-    /// Check existing resources.
+    /// Queue check of existing resources. Component is marked dirty if some resource is missing or changed.
     void CheckResources();
-    /// Generate resources.
+    /// Generate resources synchronously.
     void GenerateResources();
+    /// Begin generation on main thread. Return false if resources are taken from cache and generation is already done.
+    bool BeginGeneration();
+    /// Run thread-safe part of generation. May be called from worker thread.
+    void PrepareGeneration();
+    /// Finish generation on main thread.
+    void FinishGeneration();
     /// Enumerate resources.
     virtual void EnumerateResources(Vector<ResourceRef>& resources);
+    /// Enumerate resources used by generation. Components that generate these resources are generated first.
+    virtual void EnumerateDependencies(Vector<ResourceRef>& dependencies);
+    /// Return statistics of the last generation.
+    const ProceduralGenerationStats& GetGenerationStats() const { return generationStats_; }
 
     /// Mark procedural resource dirty. This always lead to re-generation.
     void MarkNeedGeneration();
@@ -111,6 +343,12 @@ public:
     void MarkResourceListDirty();
     /// Compute hash of component and all children agents.
     Variant ToHash() const;
+    /// Compute 64-bit hash of component, all children agents, generator version and dependencies content. Return 0 if cannot be computed.
+    unsigned long long ToHash64() const;
+    /// Mark combined hash of agents dirty. It's rebuilt for the whole hierarchy on demand.
+    void MarkAgentsHashDirty() { agentsHashDirty_ = true; }
+    /// Recompute combined hash of agents from cached hashes of own node agents and children nodes.
+    void UpdateAgentsHash();
 
     /// Set seed attribute.
     void SetSeedAttr(unsigned seed);
@@ -120,11 +358,31 @@ public:
 private:
     /// Compute hash.
     virtual bool ComputeHash(Hash& hash) const;
-    /// Generate resources.
+    /// Return version of generator. Increment when output changes for the same input.
+    virtual unsigned GetGeneratorVersion() const { return 0; }
+    /// Compute hash of content of resources that affect output, e.g. textures used in rendering. Return false if cannot be computed.
+    virtual bool ComputeDependencyHash(Hash& /*hash*/) const { return true; }
+    /// Copy inputs of generation on main thread.
+    virtual void DoBeginGeneration() { }
+    /// Run thread-safe part of generation, e.g. topology, tessellation and vertex data. Shall not access GPU, resource cache or scene.
+    virtual void DoPrepareResources() { }
+    /// Generate resources on main thread.
     virtual void DoGenerateResources(Vector<SharedPtr<Resource>>& resources);
+    /// Apply resources taken from cache on main thread. Resources are ordered as enumerated.
+    virtual void DoApplyCachedResources(const Vector<SharedPtr<Resource>>& /*resources*/) { }
+    /// Save generated resources.
+    void SaveGeneratedResources(const Vector<SharedPtr<Resource>>& resources, const Vector<ResourceRef>& resourceRefs);
+    /// Report statistics of finished generation to procedural system.
+    void ReportGenerationStats();
 
     /// Handle scene being assigned. This may happen several times during the component's lifetime. Scene-wide subsystems and events are subscribed to here.
     virtual void OnSceneSet(Scene* scene) override;
+    /// Return combined hash of agents. Rebuild hashes of the hierarchy if dirty.
+    unsigned long long GetAgentsHash() const;
+    /// Handle node added to scene hierarchy.
+    void HandleNodeAdded(StringHash eventType, VariantMap& eventData);
+    /// Handle node removed from scene hierarchy.
+    void HandleNodeRemoved(StringHash eventType, VariantMap& eventData);
 
     /// Always returns false.
     bool GetFalse() const { return false; }
@@ -148,6 +406,14 @@ private:
     VariantVector resourcesHashes_;
     /// Cached hash.
     unsigned cachedHash_ = 0;
+    /// Cache key of generation in progress.
+    unsigned long long generationHash_ = 0;
+    /// Combined hash of agents in hierarchy order. Zero if some agent cannot be hashed.
+    mutable unsigned long long agentsHash_ = 0;
+    /// Is combined hash of agents dirty?
+    mutable bool agentsHashDirty_ = true;
+    /// Statistics of the last generation.
+    ProceduralGenerationStats generationStats_;
 
     /// Are resources checked?
     bool resourcesChecked_ = false;
@@ -180,10 +446,23 @@ public:
 
     /// Compute hash of procedural agent.
     Variant ToHash() const;
+    /// Return cached 64-bit hash of procedural agent. Return 0 if cannot be computed.
+    unsigned long long ToHash64() const { return cachedHash64_; }
+    /// Recompute cached 64-bit hash and combined hashes of ancestor nodes. Return 32-bit hash or 0 if cannot be computed.
+    unsigned UpdateHash();
+    /// Recompute combined hash of own node agents and children nodes. Only the first agent of node keeps this hash.
+    void UpdateNodeHash();
+    /// Return combined hash of own node agents and children nodes.
+    unsigned long long GetNodeHash() const { return nodeHash_; }
 
 private:
     /// Compute hash.
     virtual bool ComputeHash(Hash& hash) const;
+    /// Handle scene being assigned.
+    virtual void OnSceneSet(Scene* scene) override;
+
+    /// Set parent component that combines the hash.
+    void SetHashParent(ProceduralComponent* parent);
 
     /// Set hash attribute.
     void SetHashAttr(unsigned hash) { cachedHash_ = hash; }
@@ -193,6 +472,12 @@ private:
 private:
     /// Cached hash.
     unsigned cachedHash_ = 0;
+    /// Cached 64-bit hash.
+    unsigned long long cachedHash64_ = 0;
+    /// Combined hash of own node agents and children nodes.
+    unsigned long long nodeHash_ = 0;
+    /// Parent component that combines the hash.
+    WeakPtr<ProceduralComponent> hashParent_;
 
     /// Is resource list dirty?
     bool resourceListDirty_ = false;
@@ -4,14 +4,22 @@
 #include <FlexEngine/Factory/TextureFactory.h> // #TODO Remove
 
 #include <Urho3D/Core/Context.h>
-#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
 #include <Urho3D/Resource/Image.h> // #TODO Remove
 #include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/ResourceEvents.h>
 #include <Urho3D/AngelScript/ScriptFile.h>
 
 namespace FlexEngine
 {
 
+namespace
+{
+
+/// Version of scripted generator. Increment when script API changes output of the same script.
+static const unsigned SCRIPTED_RESOURCE_GENERATOR_VERSION = 1;
+
+}
 
 ScriptedResource::ScriptedResource(Context* context)
     : ProceduralComponent(context)
@@ -47,7 +55,16 @@ void ScriptedResource::EnumerateResources(Vector<ResourceRef>& resources)
 void ScriptedResource::SetScriptAttr(const ResourceRef& value)
 {
     ResourceCache* cache = GetSubsystem<ResourceCache>();
-    script_ = cache->GetResource<ScriptFile>(value.name_);
+    SharedPtr<ScriptFile> script(cache->GetResource<ScriptFile>(value.name_));
+    if (script == script_)
+        return;
+
+    if (script_)
+        UnsubscribeFromEvent(script_, E_RELOADFINISHED);
+    script_ = script;
+    if (script_)
+        SubscribeToEvent(script_, E_RELOADFINISHED, URHO3D_HANDLER(ScriptedResource, HandleScriptReloadFinished));
+    UpdateScriptHash();
 }
 
 ResourceRef ScriptedResource::GetScriptAttr() const
@@ -72,14 +89,26 @@ const VariantMap& ScriptedResource::GetParametersAttr() const
     return parametersAttr_;
 }
 
-bool ScriptedResource::ComputeHash(Hash& hash) const
+void ScriptedResource::UpdateScriptHash()
 {
+    scriptHash_ = 0;
     if (script_)
     {
-        PODVector<unsigned char> buffer;
-        script_->SaveByteCode(MemoryBuffer(buffer));
-        hash.HashBuffer(buffer);
+        VectorBuffer buffer;
+        script_->SaveByteCode(buffer);
+        scriptHash_ = HashMemory64(buffer.GetData(), buffer.GetSize());
     }
+}
+
+void ScriptedResource::HandleScriptReloadFinished(StringHash /*eventType*/, VariantMap& /*eventData*/)
+{
+    UpdateScriptHash();
+    MarkParametersDirty();
+}
+
+bool ScriptedResource::ComputeHash(Hash& hash) const
+{
+    hash.HashUInt64(scriptHash_);
     hash.HashString(entryPoint_);
     hash.HashUInt(resources_.type_);
     hash.HashUInt(resources_.names_.Size());
@@ -91,6 +120,17 @@ bool ScriptedResource::ComputeHash(Hash& hash) const
     return true;
 }
 
+unsigned ScriptedResource::GetGeneratorVersion() const
+{
+    return SCRIPTED_RESOURCE_GENERATOR_VERSION;
+}
+
+bool ScriptedResource::ComputeDependencyHash(Hash& /*hash*/) const
+{
+    // Resources loaded by script are not enumerated, so generated resources are never taken from cache
+    return false;
+}
+
 void ScriptedResource::DoGenerateResources(Vector<SharedPtr<Resource>>& resources)
 {
     static const unsigned startParam = 3;
@@ -72,9 +72,18 @@ public:
 private:
     /// Compute hash.
     virtual bool ComputeHash(Hash& hash) const;
+    /// Return version of script API used by generator.
+    virtual unsigned GetGeneratorVersion() const;
+    /// Compute hash of content of resources that affect output. Script may read any resource, so it cannot be computed.
+    virtual bool ComputeDependencyHash(Hash& hash) const;
     /// Generate resources.
     virtual void DoGenerateResources(Vector<SharedPtr<Resource>>& resources);
 
+    /// Update cached hash of script bytecode.
+    void UpdateScriptHash();
+    /// Handle script reload.
+    void HandleScriptReloadFinished(StringHash eventType, VariantMap& eventData);
+
     /// Set resources attribute.
     void SetTypeAttr(const StringHash& type) { type_ = type; }
     /// Return resources attribute.
@@ -83,6 +92,8 @@ private:
 private:
     /// Script.
     SharedPtr<ScriptFile> script_;
+    /// Cached hash of script bytecode.
+    unsigned long long scriptHash_ = 0;
     /// Entry point.
     String entryPoint_;
     /// Actual resource type.
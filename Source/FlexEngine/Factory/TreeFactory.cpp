@@ -771,6 +771,13 @@ void TreeElementInstance::Triangulate(ModelFactory& factory, BranchQualityParame
     }
 }
 
+void TreeElementInstance::CollectMaterials(Vector<SharedPtr<Material>>& materials) const
+{
+    DoCollectMaterials(materials);
+    for (const SharedPtr<TreeElementInstance>& child : children_)
+        child->CollectMaterials(materials);
+}
+
 Vector3 TreeElementInstance::GetFoliageCenter(unsigned depth) const
 {
     return parent_ && depth > 0
@@ -803,6 +810,15 @@ void TreeBranchInstance::DoTriangulate(ModelFactory& factory, BranchQualityParam
     }
 }
 
+void TreeBranchInstance::DoCollectMaterials(Vector<SharedPtr<Material>>& materials) const
+{
+    // Materials are reused the same way as ModelFactory::AddGeometry does
+    if (desc_.generateBranch_ && !materials.Contains(branchMaterial_))
+        materials.Push(branchMaterial_);
+    if (desc_.generateFrond_ && !materials.Contains(frondMaterial_))
+        materials.Push(frondMaterial_);
+}
+
 //////////////////////////////////////////////////////////////////////////
 Vector4 TreeLeafInstance::ComputeFoliageCenter() const
 {
@@ -817,4 +833,10 @@ void TreeLeafInstance::DoTriangulate(ModelFactory& factory, BranchQualityParamet
     GenerateLeafGeometry(factory, desc_.shape_, desc_.location_, GetFoliageCenter(desc_.shape_.normalSmoothing_));
 }
 
+void TreeLeafInstance::DoCollectMaterials(Vector<SharedPtr<Material>>& materials) const
+{
+    if (!materials.Contains(leafMaterial_))
+        materials.Push(leafMaterial_);
+}
+
 }
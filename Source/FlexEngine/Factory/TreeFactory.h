@@ -337,6 +337,8 @@ public:
     void PostGenerate(TreeElementInstance* parent = nullptr);
     /// Triangulate element.
     void Triangulate(ModelFactory& factory, BranchQualityParameters& quality, bool recursive = true);
+    /// Collect materials of element and children in the same order as triangulation adds geometries.
+    void CollectMaterials(Vector<SharedPtr<Material>>& materials) const;
 
     /// Add children.
     void AddChild(SharedPtr<TreeElementInstance> child) { children_.Push(child); }
@@ -352,6 +354,8 @@ private:
     virtual Vector4 ComputeFoliageCenter() const { return Vector4::ZERO; }
     /// Triangulate element implementation.
     virtual void DoTriangulate(ModelFactory& factory, BranchQualityParameters& quality);
+    /// Collect materials of element implementation.
+    virtual void DoCollectMaterials(Vector<SharedPtr<Material>>& /*materials*/) const { }
 
 private:
     /// Parent element.
@@ -377,6 +381,8 @@ public:
 private:
     /// Triangulate element implementation.
     virtual void DoTriangulate(ModelFactory& factory, BranchQualityParameters& quality) override;
+    /// Collect materials of element implementation.
+    virtual void DoCollectMaterials(Vector<SharedPtr<Material>>& materials) const override;
 
 private:
     /// Description of the branch.
@@ -402,6 +408,8 @@ private:
     virtual Vector4 ComputeFoliageCenter() const override;
     /// Triangulate element implementation.
     virtual void DoTriangulate(ModelFactory& factory, BranchQualityParameters& quality) override;
+    /// Collect materials of element implementation.
+    virtual void DoCollectMaterials(Vector<SharedPtr<Material>>& materials) const override;
 
 private:
     /// Description of the leaf.
@@ -7,11 +7,18 @@
 #include <FlexEngine/Graphics/Wind.h>
 #include <FlexEngine/Math/Hash.h>
 #include <FlexEngine/Resource/ResourceCacheHelpers.h>
+#include <FlexEngine/Resource/ResourceHash.h>
 
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/Graphics.h>
 #include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/RenderPath.h>
+#include <Urho3D/Graphics/Shader.h>
+#include <Urho3D/Graphics/ShaderVariation.h>
 #include <Urho3D/Graphics/StaticModel.h>
+#include <Urho3D/Graphics/Technique.h>
+#include <Urho3D/Graphics/Texture.h>
 #include <Urho3D/Graphics/Renderer.h>
 #include <Urho3D/IO/Log.h>
 #include <Urho3D/Resource/Image.h>
@@ -25,6 +32,12 @@ namespace FlexEngine
 namespace
 {
 
+/// Version of tree generator. Increment when generated model changes for the same input.
+static const unsigned TREE_GENERATOR_VERSION = 1;
+
+/// Version of tree proxy generator. Increment when generated proxy changes for the same input.
+static const unsigned TREE_PROXY_GENERATOR_VERSION = 1;
+
 static const char* spawnModeNames[] =
 {
     "Explicit",
@@ -54,6 +67,66 @@ static const char* treeProxyTypeNames[] =
     0
 };
 
+/// Hash source code of shader with included files. Only name is hashed if there is no graphics.
+void HashShaderSource(Hash& hash, Graphics* graphics, ShaderType type, const String& name)
+{
+    hash.HashString(name);
+    ShaderVariation* variation = graphics && !name.Empty() ? graphics->GetShader(type, name) : nullptr;
+    Shader* shader = variation ? variation->GetOwner() : nullptr;
+    hash.HashString(shader ? shader->GetSourceCode(type) : String::EMPTY);
+}
+
+/// Hash file content of material, its textures and techniques, and source code of technique shaders.
+void HashMaterialFiles(Hash& hash, ResourceCache& cache, const Material* material)
+{
+    if (!material)
+    {
+        hash.HashString(String::EMPTY);
+        return;
+    }
+
+    HashResourceFile(hash, cache, material->GetName());
+    for (unsigned i = 0; i < MAX_TEXTURE_UNITS; ++i)
+    {
+        if (Texture* texture = material->GetTexture(static_cast<TextureUnit>(i)))
+            HashResourceFile(hash, cache, texture->GetName());
+    }
+
+    Graphics* graphics = cache.GetSubsystem<Graphics>();
+    hash.HashUInt(material->GetNumTechniques());
+    for (unsigned i = 0; i < material->GetNumTechniques(); ++i)
+    {
+        Technique* technique = material->GetTechnique(i);
+        if (!technique)
+            continue;
+
+        HashResourceFile(hash, cache, technique->GetName());
+        for (const Pass* pass : technique->GetPasses())
+        {
+            HashShaderSource(hash, graphics, VS, pass->GetVertexShader());
+            HashShaderSource(hash, graphics, PS, pass->GetPixelShader());
+        }
+    }
+}
+
+/// Hash file content of render path and source code of its shaders.
+void HashRenderPathFiles(Hash& hash, ResourceCache& cache, const String& name)
+{
+    HashResourceFile(hash, cache, name);
+    XMLFile* xmlFile = cache.GetResource<XMLFile>(name);
+    if (!xmlFile)
+        return;
+
+    RenderPath renderPath;
+    renderPath.Load(xmlFile);
+    Graphics* graphics = cache.GetSubsystem<Graphics>();
+    for (const RenderPathCommand& command : renderPath.commands_)
+    {
+        HashShaderSource(hash, graphics, VS, command.vertexShaderName_);
+        HashShaderSource(hash, graphics, PS, command.pixelShaderName_);
+    }
+}
+
 PODVector<TreeElement*> GatherChildrenElements(Node& node)
 {
     PODVector<TreeElement*> elements;
@@ -100,6 +173,29 @@ void TreeHost::EnumerateResources(Vector<ResourceRef>& resources)
     }
 }
 
+void TreeHost::EnumerateDependencies(Vector<ResourceRef>& dependencies)
+{
+    if (!node_)
+        return;
+
+    // Materials may be generated by other procedural components
+    for (SharedPtr<Node> child : node_->GetChildren())
+    {
+        PODVector<BranchGroup*> branchGroups;
+        child->GetComponents(branchGroups);
+        for (BranchGroup* branchGroup : branchGroups)
+        {
+            dependencies.Push(branchGroup->GetBranchMaterialAttr());
+            dependencies.Push(branchGroup->GetFrondMaterialAttr());
+        }
+
+        PODVector<LeafGroup*> leafGroups;
+        child->GetComponents(leafGroups);
+        for (LeafGroup* leafGroup : leafGroups)
+            dependencies.Push(leafGroup->GetMaterialAttr());
+    }
+}
+
 void TreeHost::OnBranchGenerated(const BranchDescription& /*branch*/, const BranchShapeSettings& /*shape*/)
 {
 
@@ -145,24 +241,77 @@ bool TreeHost::ComputeHash(Hash& hash) const
     return true;
 }
 
-void TreeHost::DoGenerateResources(Vector<SharedPtr<Resource>>& resources)
+unsigned TreeHost::GetGeneratorVersion() const
+{
+    // Proxy is generated by host, so its version is packed into low bits
+    const unsigned proxyVersion = GetComponent<TreeProxy>() ? TREE_PROXY_GENERATOR_VERSION : 0;
+    return TREE_GENERATOR_VERSION << 16 | proxyVersion;
+}
+
+bool TreeHost::ComputeDependencyHash(Hash& hash) const
+{
+    // Only proxy textures depend on content of materials
+    TreeProxy* proxy = GetComponent<TreeProxy>();
+    if (!proxy)
+        return true;
+
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    Vector<SharedPtr<Material>> materials;
+    GenerateTopology()->CollectMaterials(materials);
+    hash.HashUInt(materials.Size());
+    for (const Material* material : materials)
+        HashMaterialFiles(hash, *cache, material);
+
+    HashRenderPathFiles(hash, *cache, proxy->GetDiffuseRenderPathAttr().name_);
+    HashRenderPathFiles(hash, *cache, proxy->GetNormalRenderPathAttr().name_);
+    return true;
+}
+
+SharedPtr<TreeBranchInstance> TreeHost::GenerateTopology() const
 {
     SharedPtr<TreeBranchInstance> root = MakeShared<TreeBranchInstance>(BranchDescription(), nullptr, nullptr);
     for (const TreeElement* element : GatherChildrenElements(*node_))
         element->Generate(*root);
     root->PostGenerate();
+    return root;
+}
+
+void TreeHost::DoBeginGeneration()
+{
+    generationData_ = MakeUnique<GenerationData>();
+    GenerationData& data = *generationData_;
 
-    // Update list of LODs
+    data.root_ = GenerateTopology();
+
+    // Copy parameters that may be changed during generation
     PODVector<TreeLevelOfDetail*> lods;
     GetComponents(lods);
+    for (TreeLevelOfDetail* lod : lods)
+    {
+        data.lodQualities_.Push(lod->GetQualityParameters());
+        data.lodDistances_.Push(lod->GetDistance());
+    }
+
+    data.windMainMagnitude_ = windMainMagnitude_;
+    data.windTurbulenceMagnitude_ = windTurbulenceMagnitude_;
+    data.windOscillationMagnitude_ = windOscillationMagnitude_;
+    data.windTurbulenceFrequency_ = windTurbulenceFrequency_;
+    data.windOscillationFrequency_ = windOscillationFrequency_;
+
+    data.factory_ = MakeShared<ModelFactory>(context_);
+    data.factory_->Initialize(DefaultVertex::GetVertexElements(), true);
+}
+
+void TreeHost::DoPrepareResources()
+{
+    GenerationData& data = *generationData_;
+    ModelFactory& factory = *data.factory_;
 
     // Triangulate tree
-    ModelFactory factory(context_);
-    factory.Initialize(DefaultVertex::GetVertexElements(), true);
-    for (unsigned i = 0; i < lods.Size(); ++i)
+    for (unsigned i = 0; i < data.lodQualities_.Size(); ++i)
     {
         factory.SetLevel(i);
-        root->Triangulate(factory, lods[i]->GetQualityParameters());
+        data.root_->Triangulate(factory, data.lodQualities_[i]);
     }
 
     // Update ground adherence
@@ -175,29 +324,43 @@ void TreeHost::DoGenerateResources(Vector<SharedPtr<Resource>>& resources)
         maxTurbulenceAdherence = Max(maxTurbulenceAdherence, vertex.colors_[1].g_);
     });
     factory.ForEachVertex<DefaultVertex>(
-        [&maxMainAdherence, &maxTurbulenceAdherence, this](unsigned, unsigned, unsigned, DefaultVertex& vertex)
+        [&maxMainAdherence, &maxTurbulenceAdherence, &data](unsigned, unsigned, unsigned, DefaultVertex& vertex)
     {
-        vertex.colors_[1].r_ *= windMainMagnitude_ / maxMainAdherence;
-        vertex.colors_[1].g_ *= windTurbulenceMagnitude_ / maxTurbulenceAdherence;
-        vertex.colors_[1].a_ *= windOscillationMagnitude_;
-        vertex.colors_[2].r_ = windTurbulenceFrequency_;
-        vertex.colors_[2].g_ = windOscillationFrequency_;
+        vertex.colors_[1].r_ *= data.windMainMagnitude_ / maxMainAdherence;
+        vertex.colors_[1].g_ *= data.windTurbulenceMagnitude_ / maxTurbulenceAdherence;
+        vertex.colors_[1].a_ *= data.windOscillationMagnitude_;
+        vertex.colors_[2].r_ = data.windTurbulenceFrequency_;
+        vertex.colors_[2].g_ = data.windOscillationFrequency_;
         vertex.colors_[3].r_ = vertex.geometryNormal_.x_;
         vertex.colors_[3].g_ = vertex.geometryNormal_.y_;
         vertex.colors_[3].b_ = vertex.geometryNormal_.z_;
     });
+}
 
-    // Generate and setup
-    materials_ = factory.GetMaterials();
-    model_ = factory.BuildModel();
+void TreeHost::DoGenerateResources(Vector<SharedPtr<Resource>>& resources)
+{
+    if (!generationData_)
+    {
+        URHO3D_LOGERROR("Tree generation is not started");
+        return;
+    }
+
+    UniquePtr<GenerationData> generationData(generationData_.Detach());
+    GenerationData& data = *generationData;
+
+    // Generate and setup. Materials are referenced again on main thread, topology keeps them alive until now
+    materials_.Clear();
+    for (Material* material : data.factory_->GetMaterials())
+        materials_.Push(SharedPtr<Material>(material));
+    model_ = data.factory_->BuildModel();
     resources.Push(model_);
-    for (unsigned i = 0; i < lods.Size(); ++i)
+    for (unsigned i = 0; i < data.lodDistances_.Size(); ++i)
     {
         for (unsigned j = 0; j < model_->GetNumGeometries(); ++j)
         {
             if (Geometry* geometry = model_->GetGeometry(j, i))
             {
-                geometry->SetLodDistance(lods[i]->GetDistance());
+                geometry->SetLodDistance(data.lodDistances_[i]);
             }
         }
     }
@@ -213,20 +376,30 @@ void TreeHost::DoGenerateResources(Vector<SharedPtr<Resource>>& resources)
             URHO3D_LOGWARNING("Tree must have at most one proxy level");
         }
 
-        // Generate proxy
+        // Proxy is rendered on GPU and cannot be generated without renderer
         Renderer* renderer = GetSubsystem<Renderer>();
         TreeProxy& treeProxy = *proxies[0];
-        const bool hadInstancing = renderer->GetDynamicInstancing();
-        renderer->SetDynamicInstancing(false);
-        TreeProxy::GeneratedData data = treeProxy.Generate(model_, materials_);
-        renderer->SetDynamicInstancing(hadInstancing);
-
-        // Append proxy
-        AppendEmptyLOD(*model_, treeProxy.GetDistance());
-        AppendModelGeometries(*model_, *data.model_);
-        resources.Push(data.diffuseImage_);
-        resources.Push(data.normalImage_);
-        materials_.Push(treeProxy.GetProxyMaterial());
+        if (!renderer)
+        {
+            URHO3D_LOGWARNING("Tree proxy cannot be generated without renderer and is skipped");
+            resources.Push(SharedPtr<Resource>());
+            resources.Push(SharedPtr<Resource>());
+        }
+        else
+        {
+            // Generate proxy
+            const bool hadInstancing = renderer->GetDynamicInstancing();
+            renderer->SetDynamicInstancing(false);
+            TreeProxy::GeneratedData data = treeProxy.Generate(model_, materials_);
+            renderer->SetDynamicInstancing(hadInstancing);
+
+            // Append proxy
+            AppendEmptyLOD(*model_, treeProxy.GetDistance());
+            AppendModelGeometries(*model_, *data.model_);
+            resources.Push(data.diffuseImage_);
+            resources.Push(data.normalImage_);
+            materials_.Push(treeProxy.GetProxyMaterial());
+        }
     }
 
     // Save model
@@ -241,6 +414,22 @@ void TreeHost::DoGenerateResources(Vector<SharedPtr<Resource>>& resources)
     UpdateViews();
 }
 
+void TreeHost::DoApplyCachedResources(const Vector<SharedPtr<Resource>>& resources)
+{
+    model_ = resources.Empty() ? nullptr : DynamicCast<Model>(resources[0]);
+    if (!model_)
+        return;
+
+    // Geometries are ordered by first use of material in topology, proxy geometry goes last
+    materials_.Clear();
+    GenerateTopology()->CollectMaterials(materials_);
+    TreeProxy* proxy = GetComponent<TreeProxy>();
+    if (proxy && model_->GetNumGeometries() > materials_.Size())
+        materials_.Push(proxy->GetProxyMaterial());
+
+    UpdateViews();
+}
+
 //////////////////////////////////////////////////////////////////////////
 TreeElement::TreeElement(Context* context)
     : ProceduralComponentAgent(context)
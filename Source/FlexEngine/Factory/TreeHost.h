@@ -35,6 +35,8 @@ public:
     static void RegisterObject(Context* context);
     /// Enumerate resources.
     virtual void EnumerateResources(Vector<ResourceRef>& resources) override;
+    /// Enumerate resources used by generation.
+    virtual void EnumerateDependencies(Vector<ResourceRef>& dependencies) override;
 
     /// Called during element generation for each generated branch.
     void OnBranchGenerated(const BranchDescription& branch, const BranchShapeSettings& shape);
@@ -53,10 +55,45 @@ public:
     ResourceRef GetDestinationModelAttr() const;
 
 private:
+    /// Inputs and intermediate data of generation.
+    struct GenerationData
+    {
+        /// Tree topology.
+        SharedPtr<TreeBranchInstance> root_;
+        /// Quality parameters of LODs.
+        Vector<BranchQualityParameters> lodQualities_;
+        /// Distances of LODs.
+        PODVector<float> lodDistances_;
+        /// Magnitude of deformations caused by main wind.
+        float windMainMagnitude_ = 0.0f;
+        /// Magnitude of deformations caused by turbulence.
+        float windTurbulenceMagnitude_ = 0.0f;
+        /// Magnitude of foliage oscillation.
+        float windOscillationMagnitude_ = 0.0f;
+        /// Frequency of deformations caused by turbulence.
+        float windTurbulenceFrequency_ = 0.0f;
+        /// Frequency of foliage oscillation.
+        float windOscillationFrequency_ = 0.0f;
+        /// Model factory with triangulated tree.
+        SharedPtr<ModelFactory> factory_;
+    };
+
     /// Compute hash.
     virtual bool ComputeHash(Hash& hash) const override;
+    /// Return version of tree and proxy generators.
+    virtual unsigned GetGeneratorVersion() const override;
+    /// Compute hash of materials and render paths used to render proxy.
+    virtual bool ComputeDependencyHash(Hash& hash) const override;
+    /// Generate topology and copy parameters on main thread.
+    virtual void DoBeginGeneration() override;
+    /// Triangulate tree and compute vertex data. May be called from worker thread.
+    virtual void DoPrepareResources() override;
     /// Generate resources.
     virtual void DoGenerateResources(Vector<SharedPtr<Resource>>& resources) override;
+    /// Apply resources taken from cache.
+    virtual void DoApplyCachedResources(const Vector<SharedPtr<Resource>>& resources) override;
+    /// Generate tree topology from elements.
+    SharedPtr<TreeBranchInstance> GenerateTopology() const;
 
     /// Update views with generated resource.
     void UpdateViews();
@@ -85,6 +122,8 @@ protected:
     /// Center of leaves.
     Vector3 foliageCenter_;
 
+    /// Data of generation in progress.
+    UniquePtr<GenerationData> generationData_;
 };
 
 /// Tree element component.
@@ -1,9 +1,12 @@
 #include <FlexEngine/Graphics/Grass.h>
 
+#include <FlexEngine/Container/Utility.h>
+#include <FlexEngine/Core/Attribute.h>
+#include <FlexEngine/Graphics/TerrainOcclusion.h>
 #include <FlexEngine/Math/MathDefs.h>
-#include <FlexEngine/Math/PoissonRandom.h>
-#include <FlexEngine/Math/StandardRandom.h>
+#include <FlexEngine/Math/BlueNoiseTileSet.h>
 
+#include <Urho3D/Container/Sort.h>
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Core/CoreEvents.h>
 #include <Urho3D/Core/WorkQueue.h>
@@ -14,7 +17,9 @@
 #include <Urho3D/Graphics/Terrain.h>
 #include <Urho3D/Graphics/TerrainPatch.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/IO/Log.h>
 #include <Urho3D/Scene/Node.h>
+#include <Urho3D/Scene/Scene.h>
 #include <Urho3D/Resource/ResourceCache.h>
 
 namespace FlexEngine
@@ -23,32 +28,92 @@ namespace FlexEngine
 namespace
 {
 
-/// Points density in sample.
-static const float samplePointsDensity = 20.0f;
-/// Number of points in sample (upper bound).
-static const unsigned samplePointsLimit = 10000;
-/// Max number of iterations for sample generation.
-static const unsigned samplePointsMaxIterations = 30;
-/// Factor of extra buffer allocation.
-static const float allocationFactor = 1.1f;
+/// Min size of grass patch.
+static const float minPatchSize = 1.0f;
+/// Max number of patch sizes evaluated by cost model.
+static const int maxPatchSizeCandidates = 1024;
+/// Max number of billboards addressable by 16-bit indices.
+static const unsigned maxIndexedBillboards = 65536 / 4;
+
+/// Time of camera velocity smoothing, in seconds.
+static const float cameraVelocitySmoothingTime = 0.25f;
+/// Max time until patch becomes visible that is distinguished by update priority, in seconds.
+static const float maxPrefetchPriorityTime = 1000.0f;
+/// Number of update priority steps per second.
+static const float prefetchPriorityResolution = 1000.0f;
+
+static const char* grassVertexFormatNames[] =
+{
+    "Expanded",
+    "Compact",
+    0
+};
+
+/// Visible range of billboards in arena page.
+struct GrassDrawRange
+{
+    /// Page of arena.
+    unsigned page_;
+    /// First billboard.
+    unsigned begin_;
+    /// End of drawn billboards.
+    unsigned end_;
+    /// Distance to camera.
+    float distance_;
+    /// Whether only shadow is drawn.
+    bool shadowOnly_;
+};
+
+/// Compute distance from point to box.
+float DistanceToBox(const BoundingBox& box, const Vector3& point)
+{
+    const Vector3 nearest = VectorMax(box.min_, VectorMin(box.max_, point));
+    return (point - nearest).Length();
+}
+
+/// Call function for each cell of rectangle that is outside of excluded rectangle. Cells inside excluded rectangle are not visited.
+template <class T>
+void ForEachCellOutside(const IntRect& rect, const IntRect& excluded, T function)
+{
+    IntVector2 index;
+    for (index.x_ = rect.left_; index.x_ < rect.right_; ++index.x_)
+    {
+        if (index.x_ < excluded.left_ || index.x_ >= excluded.right_)
+        {
+            for (index.y_ = rect.top_; index.y_ < rect.bottom_; ++index.y_)
+                function(index);
+        }
+        else
+        {
+            for (index.y_ = rect.top_; index.y_ < Min(rect.bottom_, excluded.top_); ++index.y_)
+                function(index);
+            for (index.y_ = Max(rect.top_, excluded.bottom_); index.y_ < rect.bottom_; ++index.y_)
+                function(index);
+        }
+    }
+}
 
 }
 
 Grass::Grass(Context* context)
     : Drawable(context, DRAWABLE_GEOMETRY)
     , workQueue_(context->GetSubsystem<WorkQueue>())
+    , sharedIndexBuffer_(MakeShared<IndexBuffer>(context))
+    , arena_(context)
     , instanceData_(1, 1, 0, 0)
     // #TODO Unhardcode
     , denisty_(1.5f)
     , drawDistance_(100.0f)
     , updateThreshold_(20.0f)
 {
-    SubscribeToEvent(E_WORKITEMCOMPLETED, URHO3D_HANDLER(Grass, HandleUpdatePatchFinished));
     SubscribeToEvent(E_UPDATE, URHO3D_HANDLER(Grass, HandleUpdate));
 }
 
 Grass::~Grass()
 {
+    RemoveAllPatches();
+    CompleteCancelledPatches();
+    SetMaxPooledPatches(0);
 }
 
 void Grass::RegisterObject(Context* context)
@@ -57,24 +122,111 @@ void Grass::RegisterObject(Context* context)
 
     URHO3D_ACCESSOR_ATTRIBUTE("Is Enabled", IsEnabled, SetEnabled, bool, true, AM_DEFAULT);
     URHO3D_MIXED_ACCESSOR_ATTRIBUTE("Material", GetMaterialAttr, SetMaterialAttr, ResourceRef, ResourceRef(Material::GetTypeStatic()), AM_DEFAULT);
+    URHO3D_MIXED_ACCESSOR_ATTRIBUTE("Pattern", GetPatternAttr, SetPatternAttr, ResourceRef, ResourceRef(BlueNoiseTileSet::GetTypeStatic()), AM_DEFAULT);
 //     URHO3D_ATTRIBUTE("Is Occluder", bool, occluder_, false, AM_DEFAULT);
 //     URHO3D_ACCESSOR_ATTRIBUTE("Can Be Occluded", IsOccludee, SetOccludee, bool, true, AM_DEFAULT);
 //     URHO3D_ATTRIBUTE("Cast Shadows", bool, castShadows_, false, AM_DEFAULT);
 //     URHO3D_ACCESSOR_ATTRIBUTE("Draw Distance", GetDrawDistance, SetDrawDistance, float, 0.0f, AM_DEFAULT);
 //     URHO3D_ACCESSOR_ATTRIBUTE("Shadow Distance", GetShadowDistance, SetShadowDistance, float, 0.0f, AM_DEFAULT);
 //     URHO3D_ACCESSOR_ATTRIBUTE("LOD Bias", GetLodBias, SetLodBias, float, 1.0f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Max Uploads Per Frame", unsigned, maxUploadPatches_, 4, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Max Upload KB Per Frame", unsigned, maxUploadKilobytes_, 1024, AM_DEFAULT);
+    URHO3D_MEMBER_ENUM_ATTRIBUTE("Vertex Format", GrassVertexFormat, vertexFormat_, grassVertexFormatNames, 0, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Blade Scale", Vector2, bladeScale_, Vector2::ONE, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Max Pooled Patches", GetMaxPooledPatches, SetMaxPooledPatches, unsigned, 64, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("LOD Start Distance", float, lodStartDistance_, 20.0f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("LOD Min Density", float, lodMinDensity_, 0.25f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Prefetch Time", float, prefetchTime_, 1.0f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Arena Page Billboards", unsigned, arenaPageSize_, 65536, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Patch Cost Draw Call", float, patchCostDrawCall_, 20.0f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Patch Cost Culled Blade", float, patchCostCulledBlade_, 0.01f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Patch Cost Generated Blade", float, patchCostGeneratedBlade_, 0.002f, AM_DEFAULT);
+    URHO3D_MEMBER_ATTRIBUTE("Can Be Occluded By Terrain", bool, terrainOccludee_, true, AM_DEFAULT);
     URHO3D_COPY_BASE_ATTRIBUTES(Drawable);
 
 }
 
 void Grass::ApplyAttributes()
 {
+    RemoveAllPatches();
     UpdateBuffersData();
 }
 
 void Grass::UpdateBatches(const FrameInfo& frame)
 {
-    UpdatePatchesThreshold(frame.camera_->GetNode()->GetPosition());
+    cameraPosition_ = frame.camera_->GetNode()->GetWorldPosition();
+    hasCameraPosition_ = true;
+
+    // Geometries may be still referenced by batches of other views in this frame
+    if (frame.frameNumber_ != geometriesFrameNumber_)
+    {
+        geometriesFrameNumber_ = frame.frameNumber_;
+        numUsedGeometries_ = 0;
+    }
+
+    // Cull patches and compute visible prefixes of their blocks
+    const Frustum& frustum = frame.camera_->GetFrustum();
+    TerrainOcclusion* terrainOcclusion = terrainOccludee_ ? terrainOcclusion_.Get() : nullptr;
+    Material* shadowOnlyMaterial = castShadows_ ? shadowOnlyMaterial_.Get() : nullptr;
+    PODVector<GrassDrawRange> drawRanges;
+    for (const SharedPtr<GrassPatch>& patch : patches_)
+    {
+        if (!patch || !patch->IsUploaded())
+            continue;
+
+        const BoundingBox& boundingBox = patch->GetWorldBoundingBox();
+        const float distance = DistanceToBox(boundingBox, cameraPosition_);
+        if (distance > drawDistance_ || frustum.IsInsideFast(boundingBox) == OUTSIDE)
+            continue;
+
+        // Shadow of hidden patch may be visible, so only camera passes are skipped
+        const bool occluded = terrainOcclusion && terrainOcclusion->IsOccluded(frame, boundingBox);
+        if (occluded && !shadowOnlyMaterial)
+            continue;
+
+        const GrassArenaBlock& block = patch->GetUploadedBlock();
+        const unsigned numBillboards = ComputeLodBillboards(patch->GetNumBillboards(), distance);
+        if (numBillboards > 0)
+            drawRanges.Push(GrassDrawRange{ block.page_, block.begin_, block.begin_ + numBillboards, distance, occluded });
+    }
+
+    // Merge adjacent ranges. Range of partially drawn patch never touches the next block
+    Sort(drawRanges.Begin(), drawRanges.End(), [](const GrassDrawRange& lhs, const GrassDrawRange& rhs)
+    {
+        return lhs.page_ != rhs.page_ ? lhs.page_ < rhs.page_ : lhs.begin_ < rhs.begin_;
+    });
+    unsigned numRanges = 0;
+    for (const GrassDrawRange& range : drawRanges)
+    {
+        GrassDrawRange* lastRange = numRanges > 0 ? &drawRanges[numRanges - 1] : nullptr;
+        if (lastRange && lastRange->page_ == range.page_ && lastRange->end_ == range.begin_ && lastRange->shadowOnly_ == range.shadowOnly_)
+        {
+            lastRange->end_ = range.end_;
+            lastRange->distance_ = Min(lastRange->distance_, range.distance_);
+        }
+        else
+            drawRanges[numRanges++] = range;
+    }
+
+    // Setup batches
+    batches_.Resize(numRanges);
+    for (unsigned i = 0; i < numRanges; ++i)
+    {
+        const GrassDrawRange& range = drawRanges[i];
+        Geometry* geometry = AcquireGeometry();
+        geometry->SetVertexBuffer(0, arena_.GetVertexBuffer(range.page_));
+        geometry->SetIndexBuffer(sharedIndexBuffer_);
+        geometry->SetDrawRange(TRIANGLE_LIST, range.begin_ * 6, (range.end_ - range.begin_) * 6, false);
+
+        Batch& batch = batches_[i];
+        batch.distance_ = range.distance_;
+        batch.geometry_ = geometry;
+        batch.geometryType_ = GEOM_STATIC;
+        batch.material_ = range.shadowOnly_ ? shadowOnlyMaterial : material_.Get();
+        batch.worldTransform_ = &node_->GetWorldTransform();
+        batch.numWorldTransforms_ = 1;
+        batch.instancingData_ = &instanceData_;
+    }
 }
 
 void Grass::UpdateGeometry(const FrameInfo& frame)
@@ -93,6 +245,56 @@ ResourceRef Grass::GetMaterialAttr() const
     return GetResourceRef(material_, Material::GetTypeStatic());
 }
 
+void Grass::SetPatternAttr(const ResourceRef& value)
+{
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    patternTiles_ = value.name_.Empty() ? nullptr : cache->GetResource<BlueNoiseTileSet>(value.name_);
+    if (terrain_)
+        UpdatePattern();
+}
+
+ResourceRef Grass::GetPatternAttr() const
+{
+    return GetResourceRef(patternTiles_, BlueNoiseTileSet::GetTypeStatic());
+}
+
+void Grass::SetMaxPooledPatches(unsigned maxPooledPatches)
+{
+    maxPooledPatches_ = maxPooledPatches;
+    if (patchesPool_.Size() > maxPooledPatches_)
+        patchesPool_.Resize(maxPooledPatches_);
+}
+
+GrassPatchPoolStats Grass::GetPoolStats() const
+{
+    GrassPatchPoolStats stats;
+    stats.hits_ = numPoolHits_;
+    stats.misses_ = numPoolMisses_;
+    stats.numPatches_ = patchesPool_.Size();
+    for (const SharedPtr<GrassPatch>& patch : patchesPool_)
+        stats.memoryUse_ += patch->GetMemoryUse();
+    return stats;
+}
+
+GrassGenerationStats Grass::GetGenerationStats() const
+{
+    GrassGenerationStats stats;
+    stats.numUploadedPatches_ = numUploadedPatches_;
+    stats.numUploadedBillboards_ = numUploadedBillboards_;
+    stats.numPendingPatches_ = uploadQueue_.Size();
+    for (const SharedPtr<GrassPatch>& patch : patches_)
+    {
+        if (!patch)
+            continue;
+        ++stats.numPatches_;
+        stats.patchesMemoryUse_ += patch->GetMemoryUse();
+        if (patch->GetWorkItem())
+            ++stats.numPendingPatches_;
+    }
+    stats.arenaMemoryUse_ = arena_.GetMemoryUse();
+    return stats;
+}
+
 void Grass::OnWorldBoundingBoxUpdate()
 {
     worldBoundingBox_ = boundingBox_.Transformed(node_->GetWorldTransform());
@@ -100,28 +302,60 @@ void Grass::OnWorldBoundingBoxUpdate()
 
 void Grass::HandleUpdate(StringHash eventType, VariantMap& eventData)
 {
+    // Patches finished by workers must be processed before any of them is removed
+    ProcessUpdatedPatches();
+
+    UpdateCameraVelocity(eventData[Update::P_TIMESTEP].GetFloat());
+    shadowOnlyMaterial_ = castShadows_ && terrainOcclusion_ ? terrainOcclusion_->GetShadowOnlyMaterial(material_) : nullptr;
+    if (hasCameraPosition_)
+    {
+        // Move origin ahead of camera, but keep current view inside updated region
+        Vector3 prefetchOffset = cameraVelocity_ * prefetchTime_ * Vector3(1, 0, 1);
+        if (prefetchOffset.Length() > updateThreshold_)
+            prefetchOffset = prefetchOffset.Normalized() * updateThreshold_;
+        UpdatePatchesThreshold(cameraPosition_ + prefetchOffset);
+    }
+
     if (patchesDirty_)
     {
         UpdatePatches(origin_);
     }
+    UploadPatches();
 }
 
-String Grass::MakeChildName(const IntVector2& index)
+float Grass::ComputePatchCost(float patchSize) const
 {
-    return "Grass_" + String(index.x_) + "_" + String(index.y_);
+    const float bladesPerArea = denisty_ * denisty_;
+    const float visibleArea = M_PI * drawDistance_ * drawDistance_;
+
+    // Each visible patch may be a separate draw call
+    const float drawCallsCost = patchCostDrawCall_ * visibleArea / (patchSize * patchSize);
+    // Patches on the border of visible area are drawn with blades outside of it
+    const float culledBladesCost = patchCostCulledBlade_ * M_PI * drawDistance_ * patchSize * bladesPerArea;
+    // Larger patches take longer to generate and upload
+    const float generatedBladesCost = patchCostGeneratedBlade_ * patchSize * patchSize * bladesPerArea;
+    return drawCallsCost + culledBladesCost + generatedBladesCost;
 }
 
-unsigned Grass::GetNumBillboardVertices() const
+int Grass::ComputeNumPatches(float terrainSize) const
 {
-    return 4;
-}
-
-int Grass::ComputeNumPatches(float terrainSize, float distance, unsigned numVertices)
-{
-    static const unsigned maxNumVertices = std::numeric_limits<unsigned short>::max() / 4;
-    const unsigned maxNumBillboards = maxNumVertices / numVertices;
-    const float maxPatchSize = Sqrt(static_cast<float>(maxNumBillboards)) * distance;
-    return CeilToInt(terrainSize / maxPatchSize);
+    // Patch must fit arena page
+    const float maxPatchSize = Sqrt(static_cast<float>(Max(1u, arenaPageSize_))) / denisty_;
+    const int minNumPatches = Max(1, CeilToInt(terrainSize / maxPatchSize));
+    const int maxNumPatches = Max(minNumPatches, Min(CeilToInt(terrainSize / minPatchSize), minNumPatches + maxPatchSizeCandidates));
+
+    int bestNumPatches = minNumPatches;
+    float bestCost = M_INFINITY;
+    for (int numPatches = minNumPatches; numPatches <= maxNumPatches; ++numPatches)
+    {
+        const float cost = ComputePatchCost(terrainSize / numPatches);
+        if (cost < bestCost)
+        {
+            bestCost = cost;
+            bestNumPatches = numPatches;
+        }
+    }
+    return bestNumPatches;
 }
 
 Vector2 Grass::ComputeLocalPosition(const BoundingBox& worldBoundingBox, const Vector3& position, int numPatches)
@@ -132,6 +366,16 @@ Vector2 Grass::ComputeLocalPosition(const BoundingBox& worldBoundingBox, const V
     return localPosition;
 }
 
+IntRect Grass::ClampPatchRegion(const IntRect& region, int numPatches)
+{
+    IntRect rect;
+    rect.left_ = Clamp(region.left_, 0, numPatches);
+    rect.top_ = Clamp(region.top_, 0, numPatches);
+    rect.right_ = Clamp(region.right_, rect.left_, numPatches);
+    rect.bottom_ = Clamp(region.bottom_, rect.top_, numPatches);
+    return rect;
+}
+
 IntRect Grass::ComputePatchRegion(const BoundingBox& worldBoundingBox, const Vector3& position, float distance, int numPatches)
 {
     const Vector3 offset = Vector3(distance, 0.0f, distance);
@@ -163,96 +407,236 @@ void Grass::UpdateBoundingBox()
 
 void Grass::UpdatePattern()
 {
-    const Vector3 boundingBoxSize = boundingBox_.Size();
-    const float terrainSize = Min(boundingBoxSize.x_, boundingBoxSize.z_);
-    const int downscalePattern = CeilToInt(terrainSize * denisty_ / samplePointsDensity);
-    const float patternStep = downscalePattern / (terrainSize * denisty_);
-    PoissonRandom poisson(0);
-    pattern_ = poisson.generate(patternStep, samplePointsMaxIterations, samplePointsLimit);
-    patternScale_ = 1 / (denisty_ * patternStep);
+    // Tiles are scaled to density, so changes of density need no generation
+    pattern_ = patternTiles_ ? patternTiles_ : BlueNoiseTileSet::GetDefault(context_);
+    patternScale_ = 1 / (denisty_ * pattern_->GetMinDistance());
 }
 
 void Grass::UpdatePatchAsync(const WorkItem* workItem, unsigned threadIndex)
 {
     Grass& self = *reinterpret_cast<Grass*>(workItem->aux_);
     GrassPatch& patch = *reinterpret_cast<GrassPatch*>(workItem->start_);
-    patch.UpdatePatch(*self.terrain_);
+    if (!patch.IsUpdatePatchCancelled())
+        patch.UpdatePatch();
+    self.OnPatchUpdated(patch);
+}
+
+void Grass::OnPatchUpdated(GrassPatch& patch)
+{
+    MutexLock lock(updatedPatchesMutex_);
+    updatedPatches_.Push(&patch);
 }
 
-void Grass::HandleUpdatePatchFinished(StringHash eventType, VariantMap& eventData)
+void Grass::ProcessUpdatedPatches()
 {
-    if (eventType == E_WORKITEMCOMPLETED)
+    PODVector<GrassPatch*> updatedPatches;
     {
-        if (WorkItem* workItem = dynamic_cast<WorkItem*>(eventData[WorkItemCompleted::P_ITEM].GetPtr()))
+        MutexLock lock(updatedPatchesMutex_);
+        updatedPatches.Swap(updatedPatches_);
+    }
+
+    for (GrassPatch* patch : updatedPatches)
+    {
+        patch->SetWorkItem(nullptr);
+        if (patch->IsUpdatePatchCancelled())
         {
-            GrassPatch& patch = *reinterpret_cast<GrassPatch*>(workItem->start_);
-            patch.SetWorkItem(nullptr);
-            patch.FinishUpdatePatch();
+            SharedPtr<GrassPatch> cancelledPatch(patch);
+            cancelledPatches_.Erase(cancelledPatch);
+            ReleasePatch(*cancelledPatch);
         }
+        else
+            uploadQueue_.Push(patch);
+    }
+}
+
+void Grass::UploadPatches()
+{
+    const unsigned maxUploadSize = maxUploadKilobytes_ * 1024;
+    unsigned numUploaded = 0;
+    unsigned uploadSize = 0;
+    while (numUploaded < uploadQueue_.Size() && numUploaded < Max(1u, maxUploadPatches_))
+    {
+        GrassPatch& patch = *uploadQueue_[numUploaded];
+        const unsigned patchSize = patch.GetUploadDataSize();
+        if (numUploaded > 0 && uploadSize + patchSize > maxUploadSize)
+            break;
+
+        UploadPatch(patch);
+        uploadSize += patchSize;
+        ++numUploaded;
     }
+    uploadQueue_.Erase(0, numUploaded);
 }
 
-void Grass::SchedulePatchUpdate(GrassPatch& patch)
+void Grass::UpdateCameraVelocity(float timeStep)
+{
+    if (!hasCameraPosition_ || timeStep <= 0.0f)
+        return;
+
+    if (hasPreviousCameraPosition_)
+    {
+        const Vector3 velocity = (cameraPosition_ - previousCameraPosition_) / timeStep;
+        cameraVelocity_ = cameraVelocity_.Lerp(velocity, Min(1.0f, timeStep / cameraVelocitySmoothingTime));
+    }
+    previousCameraPosition_ = cameraPosition_;
+    hasPreviousCameraPosition_ = true;
+}
+
+unsigned Grass::ComputePatchPriority(const Vector2& patchCenter, float patchSize) const
+{
+    // Estimate time until patch gets into draw distance if camera keeps moving with current velocity
+    const Vector2 offset = patchCenter - Vector2(cameraPosition_.x_, cameraPosition_.z_);
+    const Vector2 velocity(cameraVelocity_.x_, cameraVelocity_.z_);
+    const float radius = drawDistance_ + Vector2(patchSize, patchSize).Length() * 0.5f;
+    const float distance = offset.Length();
+
+    float time = 0.0f;
+    if (distance > radius)
+    {
+        // Solve |offset - velocity * t| = radius
+        const float a = velocity.DotProduct(velocity);
+        const float b = -2.0f * offset.DotProduct(velocity);
+        const float c = distance * distance - radius * radius;
+        const float discriminant = b * b - 4 * a * c;
+        if (a > M_EPSILON && discriminant >= 0.0f && b < 0.0f)
+            time = (-b - Sqrt(discriminant)) / (2 * a);
+        else
+        {
+            // Patch is not on predicted path, order such patches by distance after all others
+            time = maxPrefetchPriorityTime - 1.0f / (distance - radius + 1.0f);
+        }
+    }
+
+    return static_cast<unsigned>((maxPrefetchPriorityTime - Clamp(time, 0.0f, maxPrefetchPriorityTime)) * prefetchPriorityResolution);
+}
+
+void Grass::SchedulePatchUpdate(GrassPatch& patch, unsigned priority)
 {
     if (patch.GetWorkItem())
         return;
 
-    SharedPtr<WorkItem> item = workQueue_->GetFreeItem();
-    item->sendEvent_ = true;
+    // Pooled items are recycled once completed, so patch owns its item to cancel it safely
+    SharedPtr<WorkItem> item = MakeShared<WorkItem>();
     item->start_ = &patch;
     item->aux_ = this;
     item->workFunction_ = &UpdatePatchAsync;
-    workQueue_->AddWorkItem(item);
+    item->priority_ = priority;
+    patch.BeginUpdatePatch(TerrainSampler(*terrain_), node_->GetWorldPosition());
     patch.SetWorkItem(item);
+    workQueue_->AddWorkItem(item);
+}
+
+bool Grass::CancelPatchUpdate(GrassPatch& patch)
+{
+    uploadQueue_.Remove(&patch);
+
+    SharedPtr<WorkItem> item = patch.GetWorkItem();
+    if (!item)
+        return true;
+
+    if (workQueue_->RemoveWorkItem(item))
+    {
+        patch.SetWorkItem(nullptr);
+        return true;
+    }
+
+    // Item is already taken by worker thread, keep patch alive until it is processed
+    patch.CancelUpdatePatch();
+    cancelledPatches_.Insert(SharedPtr<GrassPatch>(&patch));
+    return false;
+}
+
+void Grass::CompleteCancelledPatches()
+{
+    if (!cancelledPatches_.Empty())
+    {
+        workQueue_->Complete(0);
+        ProcessUpdatedPatches();
+    }
+}
+
+SharedPtr<GrassPatch> Grass::AllocatePatch()
+{
+    if (!patchesPool_.Empty())
+    {
+        ++numPoolHits_;
+        return PopElement(patchesPool_);
+    }
+
+    ++numPoolMisses_;
+    return MakeShared<GrassPatch>();
+}
+
+void Grass::ReleasePatch(GrassPatch& patch)
+{
+    arena_.Free(patch.GetUploadedBlock());
+    patch.ResetUploadedBlock();
+
+    if (patchesPool_.Size() < maxPooledPatches_)
+        patchesPool_.Push(SharedPtr<GrassPatch>(&patch));
 }
 
-void Grass::CancelPatchUpdate(GrassPatch& patch)
+void Grass::UploadPatch(GrassPatch& patch)
 {
-    if (!patch.GetWorkItem())
+    arena_.Free(patch.GetUploadedBlock());
+    patch.ResetUploadedBlock();
+
+    const unsigned numBillboards = patch.GetNumBillboards();
+    if (numBillboards == 0)
         return;
 
-//     workQueue_->DiscardWorkItem(patch.GetWorkItem());
-    patch.SetWorkItem(nullptr);
+    const GrassArenaBlock block = arena_.Allocate(numBillboards);
+    if (!block.IsAllocated())
+    {
+        URHO3D_LOGERRORF("Grass patch of %u billboards doesn't fit arena page of %u billboards", numBillboards, arena_.GetPageSize());
+        return;
+    }
+
+    // Vertex positions are relative to world position of node, so bounding box is only translated
+    const BoundingBox& boundingBox = patch.GetBoundingBox();
+    const Vector3 worldPosition = node_->GetWorldPosition();
+    arena_.SetData(block, patch.GetVertexData(), numBillboards);
+    patch.SetUploadedBlock(block, BoundingBox(boundingBox.min_ + worldPosition, boundingBox.max_ + worldPosition));
+    ++numUploadedPatches_;
+    numUploadedBillboards_ += numBillboards;
+}
+
+Geometry* Grass::AcquireGeometry()
+{
+    if (numUsedGeometries_ == geometries_.Size())
+        geometries_.Push(MakeShared<Geometry>(context_));
+    return geometries_[numUsedGeometries_++];
+}
+
+SharedPtr<GrassPatch>& Grass::GetPatchSlot(const IntVector2& index)
+{
+    return patches_[(index.y_ % patchesGridSize_) * patchesGridSize_ + index.x_ % patchesGridSize_];
 }
 
 GrassPatch* Grass::AddPatch(const IntVector2& index)
 {
-    PatchMap::Iterator patchIter = patches_.Find(index);
-    if (patchIter != patches_.End())
-        return patchIter->second_;
-
-    Node* patchNode = node_->CreateTemporaryChild(MakeChildName(index), LOCAL);
-    GrassPatch* patch = patchNode->CreateComponent<GrassPatch>();
-//     patch->SetPattern(patternScale_, pattern_);
-//     SchedulePatchUpdate(*patch);
-//     patch->UpdatePatch(*terrain_);
-//     patch->FinishUpdatePatch();
-//     SharedPtr<GrassPatch> patch;
-//     if (patchesPool_.Empty())
-//         patch = MakeShared<GrassPatch>(context_);
-//     else
-//     {
-//         patch = patchesPool_.Back();
-//         patchesPool_.Pop();
-//     }
-
-    patches_[index] = patch;
-    return patch;
-}
-
-Grass::PatchMap::Iterator Grass::RemovePatch(const IntVector2& index)
-{
-    PatchMap::Iterator patchIter = patches_.Find(index);
-    if (patchIter != patches_.End())
+    SharedPtr<GrassPatch>& slot = GetPatchSlot(index);
+    if (!slot)
+        slot = AllocatePatch();
+    return slot;
+}
+
+void Grass::RemovePatch(const IntVector2& index)
+{
+    SharedPtr<GrassPatch>& slot = GetPatchSlot(index);
+    if (slot)
     {
-        Node* patchNode = node_->GetChild(MakeChildName(index));
-        GrassPatch* patch = patchNode->GetComponent<GrassPatch>();
-        CancelPatchUpdate(*patch);
-        node_->RemoveChild(patchNode);
-//         patchesPool_.Push(patchIter->second_);
-        patchIter = patches_.Erase(patchIter);
+        // Patch that is still processed by worker thread is released later
+        if (CancelPatchUpdate(*slot))
+            ReleasePatch(*slot);
+        slot.Reset();
     }
-    return patchIter;
+}
+
+void Grass::RemoveAllPatches()
+{
+    ForEachCellOutside(patchesRegion_, IntRect::ZERO, [this](const IntVector2& index) { RemovePatch(index); });
+    patchesRegion_ = IntRect::ZERO;
 }
 
 void Grass::UpdatePatches(const Vector3& origin)
@@ -262,42 +646,76 @@ void Grass::UpdatePatches(const Vector3& origin)
     const Vector3 worldBoundingBoxSize = worldBoundingBox.Size();
 
     const float terrainSize = Min(worldBoundingBoxSize.x_, worldBoundingBoxSize.z_);
-    const int numPatches = ComputeNumPatches(terrainSize, 1 / denisty_, GetNumBillboardVertices());
+    const int numPatches = ComputeNumPatches(terrainSize);
     const float maxDistance = drawDistance_ + updateThreshold_ * 2;
-    const IntRect region = ComputePatchRegion(worldBoundingBox, origin, maxDistance, numPatches);
+    const IntRect region = ClampPatchRegion(ComputePatchRegion(worldBoundingBox, origin, maxDistance, numPatches), numPatches);
     const float patchSize = terrainSize / numPatches;
 
-    // Add new patches
-    IntVector2 index;
-    for (index.x_ = Max(0, region.left_); index.x_ < Min(numPatches, region.right_); ++index.x_)
-        for (index.y_ = Max(0, region.top_); index.y_ < Min(numPatches, region.bottom_); ++index.y_)
-        {
-            if (patches_.Find(index) == patches_.End())
-            {
-                GrassPatch* patch = AddPatch(index);
-                const Vector3 index3 = Vector3(static_cast<float>(index.x_), 0.0f, static_cast<float>(index.y_));
-                patch->GetNode()->SetPosition(index3 * patchSize + (worldBoundingBox.min_ - node_->GetWorldPosition()) * Vector3(1, 0, 1));
-                patch->GetNode()->MarkDirty();
-                patch->SetPattern(patternScale_, pattern_);
-                patch->SetMaterial(material_);
-                patch->SetRange(worldBoundingBox.min_,
-                    Rect(index.x_ * patchSize, index.y_ * patchSize, (index.x_ + 1) * patchSize, (index.y_ + 1) * patchSize));
-                patch->UpdatePatch(*terrain_);
-                patch->FinishUpdatePatch();
-                patches_[index] = patch;
-            }
-        }
+    // Rebuild grid if it can't fit the region
+    const int gridSize = CeilToInt(2 * maxDistance / patchSize) + 2;
+    if (gridSize != patchesGridSize_ || numPatches != numPatches_)
+    {
+        RemoveAllPatches();
+        patches_.Clear();
+        patches_.Resize(static_cast<unsigned>(gridSize * gridSize));
+        patchesGridSize_ = gridSize;
+        numPatches_ = numPatches;
+    }
+
+    // Remove patches scrolled out of the region first so their slots can be reused
+    ForEachCellOutside(patchesRegion_, region, [this](const IntVector2& index) { RemovePatch(index); });
 
-    // Remove old patches
-    for (auto i = patches_.Begin(); i != patches_.End();)
+    // Add patches scrolled into the region
+    ForEachCellOutside(region, patchesRegion_, [&](const IntVector2& index)
     {
-        if (region.IsInside(i->first_) == OUTSIDE)
-            i = RemovePatch(i->first_);
-        else
-            ++i;
+        GrassPatch* patch = AddPatch(index);
+        patch->SetPattern(patternScale_, pattern_);
+        patch->SetVertexFormat(vertexFormat_);
+        patch->SetBladeScale(bladeScale_);
+        patch->SetRange(worldBoundingBox.min_,
+            Rect(index.x_ * patchSize, index.y_ * patchSize, (index.x_ + 1) * patchSize, (index.y_ + 1) * patchSize));
+        const Vector2 patchCenter = Vector2(worldBoundingBox.min_.x_, worldBoundingBox.min_.z_)
+            + (Vector2(static_cast<float>(index.x_), static_cast<float>(index.y_)) + Vector2::ONE * 0.5f) * patchSize;
+        SchedulePatchUpdate(*patch, ComputePatchPriority(patchCenter, patchSize));
+    });
+
+    patchesRegion_ = region;
+}
+
+void Grass::ResetArena()
+{
+    const unsigned pageSize = Max(1u, arenaPageSize_);
+    arena_.Reset(GrassPatch::GetVertexElements(vertexFormat_), pageSize);
+
+    // All billboards of page share the same quad index pattern
+    if (pageSize <= maxIndexedBillboards)
+    {
+        PODVector<unsigned short> indexData(pageSize * 6);
+        GrassPatch::FillBillboardIndices(indexData.Buffer(), 0, pageSize);
+        sharedIndexBuffer_->SetSize(indexData.Size(), false);
+        sharedIndexBuffer_->SetData(indexData.Buffer());
+    }
+    else
+    {
+        PODVector<unsigned> indexData(pageSize * 6);
+        GrassPatch::FillBillboardIndices(indexData.Buffer(), 0, pageSize);
+        sharedIndexBuffer_->SetSize(indexData.Size(), true);
+        sharedIndexBuffer_->SetData(indexData.Buffer());
     }
 }
 
+unsigned Grass::ComputeLodBillboards(unsigned numBillboards, float distance) const
+{
+    // Blades are ordered by importance, so any prefix is uniformly thinned patch
+    float density = 1.0f;
+    if (drawDistance_ > lodStartDistance_)
+    {
+        const float factor = Clamp((distance - lodStartDistance_) / (drawDistance_ - lodStartDistance_), 0.0f, 1.0f);
+        density = Lerp(1.0f, Clamp(lodMinDensity_, 0.0f, 1.0f), factor);
+    }
+    return Min(numBillboards, static_cast<unsigned>(CeilToInt(numBillboards * density)));
+}
+
 void Grass::UpdatePatchesThreshold(const Vector3& origin)
 {
     if ((origin - origin_).Length() > updateThreshold_)
@@ -316,7 +734,15 @@ bool Grass::SetupSource()
         {
             terrain_ = node_->GetComponent<Terrain>();
             UpdateBoundingBox();
-            UpdatePattern();
+        }
+
+        // Terrain of grass is the scene occluder unless another one is set
+        Scene* scene = GetScene();
+        if (terrain_ && scene && !terrainOcclusion_)
+        {
+            terrainOcclusion_ = scene->GetOrCreateComponent<TerrainOcclusion>();
+            if (terrainOcclusion_ && !terrainOcclusion_->GetTerrain())
+                terrainOcclusion_->SetTerrain(terrain_);
         }
     }
     return !!terrain_;
@@ -327,7 +753,9 @@ void Grass::UpdateBuffersData()
     if (!SetupSource())
         return;
 
-    UpdatePatches(Vector3::ZERO);
+    UpdatePattern();
+    ResetArena();
+    UpdatePatches(origin_);
 }
 
 }
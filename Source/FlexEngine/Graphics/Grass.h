@@ -3,11 +3,13 @@
 #include <FlexEngine/Common.h>
 #include <FlexEngine/Graphics/GrassPatch.h>
 
+#include <Urho3D/Core/Mutex.h>
 #include <Urho3D/Graphics/Drawable.h>
 
 namespace Urho3D
 {
 
+class Geometry;
 class IndexBuffer;
 class Terrain;
 class VertexBuffer;
@@ -18,6 +20,38 @@ class WorkQueue;
 namespace FlexEngine
 {
 
+class TerrainOcclusion;
+
+/// Statistics of grass patch pool.
+struct GrassPatchPoolStats
+{
+    /// Number of patches taken from pool.
+    unsigned hits_ = 0;
+    /// Number of patches created because pool was empty.
+    unsigned misses_ = 0;
+    /// Number of patches in pool.
+    unsigned numPatches_ = 0;
+    /// Memory held by pooled patches, in bytes.
+    unsigned memoryUse_ = 0;
+};
+
+/// Statistics of grass patch generation.
+struct GrassGenerationStats
+{
+    /// Number of patches uploaded to GPU.
+    unsigned numUploadedPatches_ = 0;
+    /// Number of billboards uploaded to GPU.
+    unsigned numUploadedBillboards_ = 0;
+    /// Number of patches waiting for generation or upload.
+    unsigned numPendingPatches_ = 0;
+    /// Number of live patches.
+    unsigned numPatches_ = 0;
+    /// Memory held by buffer arena, in bytes.
+    unsigned arenaMemoryUse_ = 0;
+    /// Memory held by CPU data of live patches, in bytes.
+    unsigned patchesMemoryUse_ = 0;
+};
+
 /// Grass billboard set.
 class Grass : public Drawable
 {
@@ -43,23 +77,34 @@ public:
     void SetMaterialAttr(const ResourceRef& value);
     /// Return material attribute.
     ResourceRef GetMaterialAttr() const;
+    /// Set pattern attribute. Default tile set is used if empty.
+    void SetPatternAttr(const ResourceRef& value);
+    /// Return pattern attribute.
+    ResourceRef GetPatternAttr() const;
 
-private:
-    using PatchMap = HashMap<IntVector2, SharedPtr<GrassPatch>>;
+    /// Set max number of pooled patches.
+    void SetMaxPooledPatches(unsigned maxPooledPatches);
+    /// Return max number of pooled patches.
+    unsigned GetMaxPooledPatches() const { return maxPooledPatches_; }
+    /// Return statistics of patch pool.
+    GrassPatchPoolStats GetPoolStats() const;
+    /// Return statistics of patch generation.
+    GrassGenerationStats GetGenerationStats() const;
 
+private:
     /// Recalculate the world-space bounding box.
     virtual void OnWorldBoundingBoxUpdate() override;
     /// Handle update event and update component if needed.
     void HandleUpdate(StringHash eventType, VariantMap& eventData);
 
-    /// Make child node name.
-    static String MakeChildName(const IntVector2& index);
-    /// Get number of vertices in billboard.
-    unsigned GetNumBillboardVertices() const;
-    /// Calculate optimal patch size by average distance between billboards.
-    static int ComputeNumPatches(float terrainSize, float distance, unsigned numVertices);
+    /// Compute estimated per-frame cost of patches of specified size.
+    float ComputePatchCost(float patchSize) const;
+    /// Compute number of patches along terrain side with minimal cost. Patches always fit arena page.
+    int ComputeNumPatches(float terrainSize) const;
     /// Compute local relative position.
     static Vector2 ComputeLocalPosition(const BoundingBox& worldBoundingBox, const Vector3& position, int numPatches);
+    /// Clamp patches region to terrain.
+    static IntRect ClampPatchRegion(const IntRect& region, int numPatches);
     /// Compute patches region.
     static IntRect ComputePatchRegion(const BoundingBox& worldBoundingBox, const Vector3& position, float distance, int numPatches);
     /// Update bounding box.
@@ -69,20 +114,44 @@ private:
 
     /// Update patch.
     static void UpdatePatchAsync(const WorkItem* workItem, unsigned threadIndex);
-    /// Handle update patch.
-    void HandleUpdatePatchFinished(StringHash eventType, VariantMap& eventData);
+    /// Called when patch data is generated. May be called from worker thread(s).
+    void OnPatchUpdated(GrassPatch& patch);
+    /// Move generated patches to upload queue.
+    void ProcessUpdatedPatches();
+    /// Upload patches to GPU within per-frame budget.
+    void UploadPatches();
+    /// Update smoothed camera velocity.
+    void UpdateCameraVelocity(float timeStep);
+    /// Compute update priority of patch by estimated time until it becomes visible.
+    unsigned ComputePatchPriority(const Vector2& patchCenter, float patchSize) const;
     /// Schedule patch update.
-    void SchedulePatchUpdate(GrassPatch& patch);
-    /// Cancel patch update.
-    void CancelPatchUpdate(GrassPatch& patch);
+    void SchedulePatchUpdate(GrassPatch& patch, unsigned priority);
+    /// Cancel patch update. Return false if patch is still processed by worker thread.
+    bool CancelPatchUpdate(GrassPatch& patch);
+    /// Wait for all cancelled patches that are still processed by worker thread(s).
+    void CompleteCancelledPatches();
+    /// Take patch from pool or create new one.
+    SharedPtr<GrassPatch> AllocatePatch();
+    /// Return patch to pool or destroy it if pool is full.
+    void ReleasePatch(GrassPatch& patch);
+    /// Upload patch data to arena.
+    void UploadPatch(GrassPatch& patch);
+    /// Return unused geometry for this frame.
+    Geometry* AcquireGeometry();
+    /// Return slot of patch in toroidal grid.
+    SharedPtr<GrassPatch>& GetPatchSlot(const IntVector2& index);
     /// Add patch.
     GrassPatch* AddPatch(const IntVector2& index);
     /// Remove patch.
-    PatchMap::Iterator RemovePatch(const IntVector2& index);
+    void RemovePatch(const IntVector2& index);
     /// Remove all patches.
     void RemoveAllPatches();
     /// Update patches.
     void UpdatePatches(const Vector3& origin);
+    /// Reset buffer arena and shared index buffer for current vertex format and page size.
+    void ResetArena();
+    /// Compute number of billboards drawn at specified distance.
+    unsigned ComputeLodBillboards(unsigned numBillboards, float distance) const;
     /// Update patches if distance between previous origin and new origin is larger than threshold.
     void UpdatePatchesThreshold(const Vector3& origin);
     /// Setup source drawable. Returns true if ready to use.
@@ -93,31 +162,94 @@ private:
 private:
     /// Terrain.
     SharedPtr<Terrain> terrain_;
+    /// Terrain occlusion.
+    WeakPtr<TerrainOcclusion> terrainOcclusion_;
+    /// Whether patches hidden behind terrain are culled.
+    bool terrainOccludee_ = true;
     /// World-space bounding box.
     BoundingBox worldBoundingBox_;
     /// Local-space bounding box.
     BoundingBox boundingBox_;
-    /// Pattern.
-    PODVector<Vector2> pattern_;
+    /// Pattern tiles set by attribute.
+    SharedPtr<BlueNoiseTileSet> patternTiles_;
+    /// Pattern tiles in use.
+    SharedPtr<BlueNoiseTileSet> pattern_;
     /// Scale of pattern.
     float patternScale_ = 1.0f;
 
     /// Work queue.
     WorkQueue* workQueue_;
+    /// Max number of patches uploaded to GPU per frame.
+    unsigned maxUploadPatches_ = 4;
+    /// Max size of data uploaded to GPU per frame, in kilobytes. At least one patch is uploaded per frame anyway.
+    unsigned maxUploadKilobytes_ = 1024;
+    /// Mutex for updated patches.
+    Mutex updatedPatchesMutex_;
+    /// Patches with generated data reported by worker thread(s).
+    PODVector<GrassPatch*> updatedPatches_;
+    /// Patches waiting for GPU upload.
+    PODVector<GrassPatch*> uploadQueue_;
+    /// Cancelled patches that are still processed by worker thread(s).
+    HashSet<SharedPtr<GrassPatch>> cancelledPatches_;
     /// Whether patches are dirty.
     bool patchesDirty_ = false;
-    /// Patches.
-    PatchMap patches_;
+    /// Patches in toroidal grid indexed by wrapped patch coordinates.
+    Vector<SharedPtr<GrassPatch>> patches_;
+    /// Size of toroidal grid.
+    int patchesGridSize_ = 0;
+    /// Number of patches along terrain side the grid is built for.
+    int numPatches_ = 0;
+    /// Region of patches present in grid.
+    IntRect patchesRegion_;
     /// Current origin.
     Vector3 origin_;
     /// Unused patches.
     Vector<SharedPtr<GrassPatch>> patchesPool_;
+    /// Max number of pooled patches.
+    unsigned maxPooledPatches_ = 64;
+    /// Number of patches taken from pool.
+    unsigned numPoolHits_ = 0;
+    /// Number of patches created because pool was empty.
+    unsigned numPoolMisses_ = 0;
+    /// Number of patches uploaded to GPU.
+    unsigned numUploadedPatches_ = 0;
+    /// Number of billboards uploaded to GPU.
+    unsigned numUploadedBillboards_ = 0;
 
     /// Per-instance data.
     Vector4 instanceData_;
 
+    /// Vertex format of patches.
+    GrassVertexFormat vertexFormat_ = GrassVertexFormat::Expanded;
+    /// Index buffer with quad pattern shared by all arena pages.
+    SharedPtr<IndexBuffer> sharedIndexBuffer_;
+    /// Arena of vertex buffers shared by patches.
+    GrassBufferArena arena_;
+    /// Size of arena page in billboards.
+    unsigned arenaPageSize_ = 65536;
+    /// Cost of draw call, used to choose patch size.
+    float patchCostDrawCall_ = 20.0f;
+    /// Cost of drawn blade outside of visible area, used to choose patch size.
+    float patchCostCulledBlade_ = 0.01f;
+    /// Cost of generated blade due to regeneration latency, used to choose patch size.
+    float patchCostGeneratedBlade_ = 0.002f;
+    /// Geometries of batches.
+    Vector<SharedPtr<Geometry>> geometries_;
+    /// Number of geometries used in current frame.
+    unsigned numUsedGeometries_ = 0;
+    /// Frame number of used geometries.
+    unsigned geometriesFrameNumber_ = 0;
+    /// Range of blade scale.
+    Vector2 bladeScale_ = Vector2::ONE;
+    /// Distance where blade density starts to decrease.
+    float lodStartDistance_ = 20.0f;
+    /// Fraction of blades drawn at draw distance.
+    float lodMinDensity_ = 0.25f;
+
     /// Material.
     SharedPtr<Material> material_;
+    /// Copy of material with shadow pass only. Used for patches hidden behind terrain if grass casts shadows.
+    SharedPtr<Material> shadowOnlyMaterial_;
     /// Density.
     float denisty_;
     /// Draw distance.
@@ -125,6 +257,19 @@ private:
     /// Update patches step.
     float updateThreshold_;
 
+    /// Last known camera position.
+    Vector3 cameraPosition_;
+    /// Whether camera position is known.
+    bool hasCameraPosition_ = false;
+    /// Camera position at previous update.
+    Vector3 previousCameraPosition_;
+    /// Whether previous camera position is known.
+    bool hasPreviousCameraPosition_ = false;
+    /// Smoothed camera velocity.
+    Vector3 cameraVelocity_;
+    /// Time of camera movement predicted by patch prefetch, in seconds.
+    float prefetchTime_ = 1.0f;
+
 };
 
 }
@@ -0,0 +1,121 @@
+#include <FlexEngine/Graphics/GrassBufferArena.h>
+
+#include <Urho3D/Graphics/VertexBuffer.h>
+
+namespace FlexEngine
+{
+
+GrassBufferArena::GrassBufferArena(Context* context)
+    : context_(context)
+{
+}
+
+GrassBufferArena::~GrassBufferArena()
+{
+}
+
+void GrassBufferArena::Reset(const PODVector<VertexElement>& elements, unsigned pageSize)
+{
+    elements_ = elements;
+    pageSize_ = pageSize;
+    pages_.Clear();
+    numAllocated_ = 0;
+}
+
+GrassArenaBlock GrassBufferArena::Allocate(unsigned size)
+{
+    GrassArenaBlock block;
+    if (size == 0 || size > pageSize_)
+        return block;
+
+    // First fit keeps patches packed at the beginning of pages, so neighbour blocks are likely drawn together
+    for (unsigned i = 0; i < pages_.Size(); ++i)
+    {
+        if (AllocateInPage(i, size, block))
+            return block;
+    }
+
+    AddPage();
+    AllocateInPage(pages_.Size() - 1, size, block);
+    return block;
+}
+
+void GrassBufferArena::Free(const GrassArenaBlock& block)
+{
+    if (!block.IsAllocated() || block.page_ >= pages_.Size())
+        return;
+
+    PODVector<FreeRange>& freeRanges = pages_[block.page_].freeRanges_;
+
+    // Find insertion point
+    unsigned index = 0;
+    while (index < freeRanges.Size() && freeRanges[index].begin_ < block.begin_)
+        ++index;
+    freeRanges.Insert(index, FreeRange{ block.begin_, block.size_ });
+    numAllocated_ -= block.size_;
+
+    // Merge with next range
+    if (index + 1 < freeRanges.Size() && freeRanges[index].begin_ + freeRanges[index].size_ == freeRanges[index + 1].begin_)
+    {
+        freeRanges[index].size_ += freeRanges[index + 1].size_;
+        freeRanges.Erase(index + 1);
+    }
+
+    // Merge with previous range
+    if (index > 0 && freeRanges[index - 1].begin_ + freeRanges[index - 1].size_ == freeRanges[index].begin_)
+    {
+        freeRanges[index - 1].size_ += freeRanges[index].size_;
+        freeRanges.Erase(index);
+    }
+}
+
+void GrassBufferArena::SetData(const GrassArenaBlock& block, const void* data, unsigned numBillboards)
+{
+    if (!block.IsAllocated() || numBillboards == 0)
+        return;
+
+    pages_[block.page_].vertexBuffer_->SetDataRange(data, block.begin_ * 4, Min(numBillboards, block.size_) * 4);
+}
+
+unsigned GrassBufferArena::GetMemoryUse() const
+{
+    unsigned memoryUse = 0;
+    for (const Page& page : pages_)
+        memoryUse += page.vertexBuffer_->GetVertexCount() * page.vertexBuffer_->GetVertexSize();
+    return memoryUse;
+}
+
+bool GrassBufferArena::AllocateInPage(unsigned pageIndex, unsigned size, GrassArenaBlock& block)
+{
+    PODVector<FreeRange>& freeRanges = pages_[pageIndex].freeRanges_;
+    for (unsigned i = 0; i < freeRanges.Size(); ++i)
+    {
+        FreeRange& range = freeRanges[i];
+        if (range.size_ < size)
+            continue;
+
+        block.page_ = pageIndex;
+        block.begin_ = range.begin_;
+        block.size_ = size;
+        numAllocated_ += size;
+
+        range.begin_ += size;
+        range.size_ -= size;
+        if (range.size_ == 0)
+            freeRanges.Erase(i);
+        return true;
+    }
+    return false;
+}
+
+void GrassBufferArena::AddPage()
+{
+    // Arena buffers are updated partially, so they are not dynamic
+    Page page;
+    page.vertexBuffer_ = MakeShared<VertexBuffer>(context_);
+    page.vertexBuffer_->SetSize(pageSize_ * 4, elements_, false);
+    page.freeRanges_.Push(FreeRange{ 0, pageSize_ });
+    pages_.Push(page);
+}
+
+}
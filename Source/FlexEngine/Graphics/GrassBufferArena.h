@@ -0,0 +1,98 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Container/Vector.h>
+#include <Urho3D/Graphics/GraphicsDefs.h>
+#include <Urho3D/Math/MathDefs.h>
+
+namespace Urho3D
+{
+
+class Context;
+class VertexBuffer;
+
+}
+
+namespace FlexEngine
+{
+
+/// Block of billboards allocated in grass buffer arena.
+struct GrassArenaBlock
+{
+    /// Return whether the block is allocated.
+    bool IsAllocated() const { return page_ != M_MAX_UNSIGNED; }
+
+    /// Index of page.
+    unsigned page_ = M_MAX_UNSIGNED;
+    /// First billboard in page.
+    unsigned begin_ = 0;
+    /// Number of billboards.
+    unsigned size_ = 0;
+};
+
+/// Arena of large vertex buffers shared by grass patches. Each billboard takes 4 consecutive vertices.
+class GrassBufferArena
+{
+public:
+    /// Construct.
+    GrassBufferArena(Context* context);
+    /// Destruct.
+    ~GrassBufferArena();
+
+    /// Remove all pages and set vertex layout and page size in billboards. All blocks are invalidated.
+    void Reset(const PODVector<VertexElement>& elements, unsigned pageSize);
+    /// Allocate block. Returns unallocated block if size exceeds page size.
+    GrassArenaBlock Allocate(unsigned size);
+    /// Free block.
+    void Free(const GrassArenaBlock& block);
+    /// Upload vertex data to the beginning of block.
+    void SetData(const GrassArenaBlock& block, const void* data, unsigned numBillboards);
+
+    /// Return vertex buffer of page.
+    VertexBuffer* GetVertexBuffer(unsigned page) const { return pages_[page].vertexBuffer_; }
+    /// Return page size in billboards.
+    unsigned GetPageSize() const { return pageSize_; }
+    /// Return number of pages.
+    unsigned GetNumPages() const { return pages_.Size(); }
+    /// Return number of allocated billboards.
+    unsigned GetNumAllocatedBillboards() const { return numAllocated_; }
+    /// Return memory used by vertex buffers, in bytes.
+    unsigned GetMemoryUse() const;
+
+private:
+    /// Range of free billboards.
+    struct FreeRange
+    {
+        /// First billboard.
+        unsigned begin_;
+        /// Number of billboards.
+        unsigned size_;
+    };
+    /// Page of arena.
+    struct Page
+    {
+        /// Vertex buffer.
+        SharedPtr<VertexBuffer> vertexBuffer_;
+        /// Free ranges sorted by first billboard.
+        PODVector<FreeRange> freeRanges_;
+    };
+    /// Try to allocate block in page.
+    bool AllocateInPage(unsigned pageIndex, unsigned size, GrassArenaBlock& block);
+    /// Add new page.
+    void AddPage();
+
+    /// Context.
+    Context* context_;
+    /// Vertex elements.
+    PODVector<VertexElement> elements_;
+    /// Page size in billboards.
+    unsigned pageSize_ = 0;
+    /// Pages.
+    Vector<Page> pages_;
+    /// Number of allocated billboards.
+    unsigned numAllocated_ = 0;
+};
+
+}
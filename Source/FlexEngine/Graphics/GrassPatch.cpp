@@ -1,17 +1,11 @@
 #include <FlexEngine/Graphics/GrassPatch.h>
 
 #include <FlexEngine/Math/MathDefs.h>
-#include <FlexEngine/Math/PoissonRandom.h>
 #include <FlexEngine/Math/StandardRandom.h>
 
-#include <Urho3D/Core/Context.h>
+#include <Urho3D/Container/Sort.h>
 #include <Urho3D/Core/WorkQueue.h>
-#include <Urho3D/Graphics/Geometry.h>
-#include <Urho3D/Graphics/IndexBuffer.h>
-#include <Urho3D/Graphics/Terrain.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
-#include <Urho3D/Graphics/Material.h>
-#include <Urho3D/Scene/Node.h>
 
 namespace FlexEngine
 {
@@ -27,43 +21,48 @@ static const unsigned samplePointsLimit = 10000;
 static const unsigned samplePointsMaxIterations = 30;
 /// Factor of extra buffer allocation.
 static const float allocationFactor = 1.1f;
+/// Max blade scale representable in compact format.
+static const float maxCompactBladeScale = 4.0f;
 
-}
-
-GrassPatch::GrassPatch(Context* context)
-    : Drawable(context, DRAWABLE_GEOMETRY)
-    , geometry_(MakeShared<Geometry>(context_))
-    , vertexBuffer_(MakeShared<VertexBuffer>(context_))
-    , indexBuffer_(MakeShared<IndexBuffer>(context_))
-    , instanceData_(1, 1, 0, 0)
+/// Fill quad indices for billboards in range [begin, end).
+template <class T>
+void FillQuadIndices(T* dest, unsigned begin, unsigned end)
 {
-    geometry_->SetVertexBuffer(0, vertexBuffer_);
-    geometry_->SetIndexBuffer(indexBuffer_);
-
-    batches_.Resize(1);
-    batches_[0].geometry_ = geometry_;
-    batches_[0].geometryType_ = GEOM_STATIC;
-    batches_[0].numWorldTransforms_ = 1;
-    batches_[0].instancingData_ = &instanceData_;
+    T* indexPtr = dest + begin * 6;
+    for (unsigned i = begin; i < end; ++i)
+    {
+        const unsigned vertexIndex = i * 4;
+        indexPtr[0] = static_cast<T>(vertexIndex);
+        indexPtr[1] = static_cast<T>(vertexIndex + 1);
+        indexPtr[2] = static_cast<T>(vertexIndex + 2);
+        indexPtr[3] = static_cast<T>(vertexIndex + 2);
+        indexPtr[4] = static_cast<T>(vertexIndex + 3);
+        indexPtr[5] = static_cast<T>(vertexIndex);
+        indexPtr += 6;
+    }
 }
 
-GrassPatch::~GrassPatch()
+/// Pack float from range [0, 1] to byte.
+unsigned char PackUnitFloat(float value)
 {
+    return static_cast<unsigned char>(Clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+}
 
 }
 
-void GrassPatch::RegisterObject(Context* context)
+GrassPatch::GrassPatch()
+    : updateCancelled_(false)
 {
-    context->RegisterFactory<GrassPatch>(FLEXENGINE_CATEGORY);
 }
 
-void GrassPatch::ApplyAttributes()
+GrassPatch::~GrassPatch()
 {
+
 }
 
-void GrassPatch::SetPattern(float scale, const PODVector<Vector2>& pattern)
+void GrassPatch::SetPattern(float scale, BlueNoiseTileSet* pattern)
 {
-    pattern_ = &pattern;
+    pattern_ = pattern;
     patternScale_ = scale;
 }
 
@@ -73,17 +72,6 @@ void GrassPatch::SetRange(const Vector3& origin, const Rect& localRange)
     origin_ = origin;
 }
 
-void GrassPatch::SetMaterial(Material* material)
-{
-    batches_[0].material_ = material;
-}
-
-void GrassPatch::UpdateBatches(const FrameInfo& frame)
-{
-    batches_[0].distance_ = 0.0f;
-    batches_[0].worldTransform_ = node_ ? &node_->GetWorldTransform() : (const Matrix3x4*)0;
-}
-
 void GrassPatch::SetWorkItem(SharedPtr<WorkItem> item)
 {
     workItem_ = item;
@@ -94,95 +82,149 @@ SharedPtr<WorkItem> GrassPatch::GetWorkItem() const
     return workItem_;
 }
 
-void GrassPatch::UpdatePatch(Terrain& terrain)
+void GrassPatch::BeginUpdatePatch(const TerrainSampler& terrain, const Vector3& offset)
+{
+    updateCancelled_ = false;
+    terrain_ = terrain;
+    offset_ = offset;
+}
+
+void GrassPatch::UpdatePatch()
 {
     // Sample points
     // #TODO Unhardcode
-    PODVector<Vector2> points = samplePointCloud(*pattern_, localRange_.min_, localRange_.max_, patternScale_);
+    PODVector<unsigned> ranks;
+    const PODVector<Vector2> points = pattern_->Sample(localRange_.min_, localRange_.max_, patternScale_, &ranks);
     const unsigned numBillboards = points.Size();
-    PODVector<Vector3> positions(numBillboards);
-    PODVector<Vector3> normals(numBillboards);
-    PODVector<Quaternion> rotations(numBillboards);
-    StandardRandom generator(0);
-    for (unsigned i = 0; i < numBillboards; ++i)
-    {
-        positions[i].x_ = points[i].x_;
-        positions[i].z_ = points[i].y_;
-        positions[i].y_ = terrain.GetHeight(positions[i] + origin_);
-        normals[i] = terrain.GetNormal(positions[i] + origin_);
-        rotations[i] = Quaternion(Vector3::UP, normals[i]) * Quaternion(generator.FloatFrom01() * 360, Vector3::UP);
-        positions[i] = positions[i] + origin_ - node_->GetPosition();
-    }
 
-    // Allocate buffers if needed
-    if (vertexData_.Size() < numBillboards * 4 * 8)
-        vertexData_.Resize(numBillboards * 4 * 8);
+    // Order blades by importance. Pattern is shuffled, so index of source point is random rank
+    PODVector<unsigned> order(numBillboards);
+    for (unsigned i = 0; i < numBillboards; ++i)
+        order[i] = i;
+    Sort(order.Begin(), order.End(), [&ranks](unsigned lhs, unsigned rhs) { return ranks[lhs] < ranks[rhs]; });
 
-    if (indexData_.Size() < numBillboards * 6)
-        indexData_.Resize(numBillboards * 6);
+    const unsigned vertexSize = GetVertexSize(format_);
 
-    // Update index data
-    unsigned short* indexPtr = indexData_.Buffer();
-    unsigned vertexIndex = 0;
+    // Allocate buffers if needed
+    if (vertexData_.Size() < numBillboards * 4 * vertexSize)
+        vertexData_.Resize(numBillboards * 4 * vertexSize);
+
+    // Sample terrain for all blades at once
+    PODVector<float> sampleData(numBillboards * 6);
+    float* sampleX = sampleData.Buffer();
+    float* sampleZ = sampleX + numBillboards;
+    float* heights = sampleZ + numBillboards;
+    float* normalsX = heights + numBillboards;
+    float* normalsY = normalsX + numBillboards;
+    float* normalsZ = normalsY + numBillboards;
     for (unsigned i = 0; i < numBillboards; ++i)
     {
-        indexPtr[0] = (unsigned short)vertexIndex;
-        indexPtr[1] = (unsigned short)(vertexIndex + 1);
-        indexPtr[2] = (unsigned short)(vertexIndex + 2);
-        indexPtr[3] = (unsigned short)(vertexIndex + 2);
-        indexPtr[4] = (unsigned short)(vertexIndex + 3);
-        indexPtr[5] = (unsigned short)vertexIndex;
-
-        indexPtr += 6;
-        vertexIndex += 4;
+        const Vector2& point = points[order[i]];
+        sampleX[i] = point.x_ + origin_.x_;
+        sampleZ[i] = point.y_ + origin_.z_;
     }
+    terrain_.Sample(numBillboards, sampleX, sampleZ, heights, normalsX, normalsY, normalsZ);
 
     // Update vertex data
+    numBillboards_ = numBillboards;
     boundingBox_.Clear();
-    float* vertexPtr = vertexData_.Buffer();
+    StandardRandom generator(0);
+    unsigned char* vertexPtr = vertexData_.Buffer();
     for (unsigned i = 0; i < numBillboards; ++i)
     {
-        const Matrix3 rotationMatrix = rotations[i].RotationMatrix();
-        const Vector3 xAxis = GetBasisX(rotationMatrix);
-        const Vector3 yAxis = GetBasisY(rotationMatrix);
-        static const Vector2 uvs[4] = { Vector2::UP, Vector2::ONE, Vector2::RIGHT, Vector2::ZERO };
-        for (unsigned j = 0; j < 4; ++j)
+        const Vector3 position = Vector3(sampleX[i], heights[i], sampleZ[i]) - offset_;
+        const Vector3 normal(normalsX[i], normalsY[i], normalsZ[i]);
+        const float yaw = generator.FloatFrom01() * 360;
+        const float scale = generator.FloatFromRange(bladeScale_.x_, bladeScale_.y_);
+
+        if (format_ == GrassVertexFormat::Compact)
+        {
+            const unsigned char packed[4] =
+            {
+                PackUnitFloat(normal.x_ * 0.5f + 0.5f),
+                PackUnitFloat(normal.z_ * 0.5f + 0.5f),
+                PackUnitFloat(yaw / 360.0f),
+                PackUnitFloat(scale / maxCompactBladeScale)
+            };
+            for (unsigned j = 0; j < 4; ++j)
+            {
+                memcpy(vertexPtr, &position, sizeof(Vector3));
+                memcpy(vertexPtr + sizeof(Vector3), packed, sizeof(packed));
+                vertexPtr += vertexSize;
+            }
+            boundingBox_.Merge(BoundingBox(position - Vector3(scale, 0.0f, scale), position + Vector3(scale, scale, scale)));
+        }
+        else
         {
-            const Vector3 pos = positions[i] + xAxis * (uvs[j].x_ - 0.5f) + yAxis * (1.0f - uvs[j].y_);
-            boundingBox_.Merge(pos);
-            vertexPtr[0] = pos.x_;
-            vertexPtr[1] = pos.y_;
-            vertexPtr[2] = pos.z_;
-            vertexPtr[3] = normals[i].x_;
-            vertexPtr[4] = normals[i].y_;
-            vertexPtr[5] = normals[i].z_;
-            vertexPtr[6] = uvs[j].x_;
-            vertexPtr[7] = uvs[j].y_;
-            vertexPtr += 8;
+            // Blade is aligned with terrain normal, yaw direction is projected onto terrain plane
+            const Vector3 direction(Cos(yaw), 0.0f, -Sin(yaw));
+            const Vector3 xAxis = (direction - normal * direction.DotProduct(normal)).Normalized() * scale;
+            const Vector3 yAxis = normal * scale;
+            static const Vector2 uvs[4] = { Vector2::UP, Vector2::ONE, Vector2::RIGHT, Vector2::ZERO };
+            for (unsigned j = 0; j < 4; ++j)
+            {
+                const Vector3 pos = position + xAxis * (uvs[j].x_ - 0.5f) + yAxis * (1.0f - uvs[j].y_);
+                boundingBox_.Merge(pos);
+                float* vertex = reinterpret_cast<float*>(vertexPtr);
+                vertex[0] = pos.x_;
+                vertex[1] = pos.y_;
+                vertex[2] = pos.z_;
+                vertex[3] = normal.x_;
+                vertex[4] = normal.y_;
+                vertex[5] = normal.z_;
+                vertex[6] = uvs[j].x_;
+                vertex[7] = uvs[j].y_;
+                vertexPtr += vertexSize;
+            }
         }
     }
-    OnMarkedDirty(node_);
 }
 
-void GrassPatch::FinishUpdatePatch()
+unsigned GrassPatch::GetUploadDataSize() const
+{
+    return numBillboards_ * 4 * GetVertexSize(format_);
+}
+
+unsigned GrassPatch::GetMemoryUse() const
 {
-    if (vertexBuffer_->GetVertexCount() < vertexData_.Size() / 8)
-        vertexBuffer_->SetSize(static_cast<unsigned>(vertexData_.Size() / 8),
-            MASK_POSITION | MASK_NORMAL /*| MASK_COLOR*/ | MASK_TEXCOORD1 /*| MASK_TEXCOORD2*/, true);
+    return vertexData_.Capacity();
+}
 
-    vertexBuffer_->SetData(vertexData_.Buffer());
+void GrassPatch::SetUploadedBlock(const GrassArenaBlock& block, const BoundingBox& worldBoundingBox)
+{
+    block_ = block;
+    worldBoundingBox_ = worldBoundingBox;
+}
 
-    if (indexBuffer_->GetIndexCount() < indexData_.Size())
-        indexBuffer_->SetSize(static_cast<unsigned>(indexData_.Size()), false, true);
+const PODVector<VertexElement>& GrassPatch::GetVertexElements(GrassVertexFormat format)
+{
+    static const PODVector<VertexElement> expandedElements =
+    {
+        VertexElement(TYPE_VECTOR3, SEM_POSITION),
+        VertexElement(TYPE_VECTOR3, SEM_NORMAL),
+        VertexElement(TYPE_VECTOR2, SEM_TEXCOORD)
+    };
+    static const PODVector<VertexElement> compactElements =
+    {
+        VertexElement(TYPE_VECTOR3, SEM_POSITION),
+        VertexElement(TYPE_UBYTE4_NORM, SEM_COLOR)
+    };
+    return format == GrassVertexFormat::Compact ? compactElements : expandedElements;
+}
 
-    indexBuffer_->SetData(indexData_.Buffer());
+unsigned GrassPatch::GetVertexSize(GrassVertexFormat format)
+{
+    return VertexBuffer::GetVertexSize(GetVertexElements(format));
+}
 
-    geometry_->SetDrawRange(TRIANGLE_LIST, 0, indexData_.Size(), false);
+void GrassPatch::FillBillboardIndices(unsigned short* dest, unsigned begin, unsigned end)
+{
+    FillQuadIndices(dest, begin, end);
 }
 
-void GrassPatch::OnWorldBoundingBoxUpdate()
+void GrassPatch::FillBillboardIndices(unsigned* dest, unsigned begin, unsigned end)
 {
-    worldBoundingBox_ = boundingBox_.Transformed(node_->GetWorldTransform());
+    FillQuadIndices(dest, begin, end);
 }
 
 }
@@ -1,86 +1,132 @@
 #pragma once
 
 #include <FlexEngine/Common.h>
+#include <FlexEngine/Graphics/GrassBufferArena.h>
+#include <FlexEngine/Graphics/TerrainSampler.h>
+#include <FlexEngine/Math/BlueNoiseTileSet.h>
 
-#include <Urho3D/Graphics/Drawable.h>
+#include <Urho3D/Container/RefCounted.h>
+#include <Urho3D/Math/BoundingBox.h>
+#include <Urho3D/Math/Rect.h>
+
+#include <atomic>
 
 namespace Urho3D
 {
 
-class IndexBuffer;
-class Terrain;
-class VertexBuffer;
 struct WorkItem;
-class WorkQueue;
 
 }
 
 namespace FlexEngine
 {
 
-/// Grass patch data.
-class GrassPatch : public Drawable
+/// Vertex format of grass patch.
+enum class GrassVertexFormat
 {
-    URHO3D_OBJECT(GrassPatch, Drawable);
+    /// Each blade is expanded on CPU into 4 vertices with position, normal and UV.
+    Expanded,
+    /// Each blade is stored as compact record of position, packed normal, yaw and scale, repeated for 4 corners.
+    /// Blades are expanded by the shader with GRASSBLADE define.
+    Compact
+};
 
+/// Grass patch data. Generated on worker thread and uploaded to buffer arena of host grass component.
+class GrassPatch : public RefCounted
+{
 public:
     /// Construct.
-    GrassPatch(Context* context);
+    GrassPatch();
     /// Destruct.
     virtual ~GrassPatch();
-    /// Register object factory.
-    static void RegisterObject(Context* context);
-    /// Apply attribute changes that can not be applied immediately. Called after scene load or a network update.
-    virtual void ApplyAttributes() override;
 
     /// Set pattern.
-    void SetPattern(float scale, const PODVector<Vector2>& pattern);
+    void SetPattern(float scale, BlueNoiseTileSet* pattern);
     /// Set range.
     void SetRange(const Vector3& origin, const Rect& localRange);
-    /// Set material.
-    void SetMaterial(Material* material);
-
-    /// Calculate distance and prepare batches for rendering. May be called from worker thread(s), possibly re-entrantly.
-    virtual void UpdateBatches(const FrameInfo& frame);
+    /// Set vertex format.
+    void SetVertexFormat(GrassVertexFormat format) { format_ = format; }
+    /// Return vertex format.
+    GrassVertexFormat GetVertexFormat() const { return format_; }
+    /// Set range of blade scale.
+    void SetBladeScale(const Vector2& bladeScale) { bladeScale_ = bladeScale; }
 
     /// Set work item. Must be called from the host grass component only.
     void SetWorkItem(SharedPtr<WorkItem> item);
     /// Return work item. Must be called from the host grass component only.
     SharedPtr<WorkItem> GetWorkItem() const;
+    /// Prepare asynchronous update of patch data. Vertex positions are relative to offset. Must be called from the main thread.
+    void BeginUpdatePatch(const TerrainSampler& terrain, const Vector3& offset);
     /// Asynchronously update patch data. May be called from worker thread(s).
-    void UpdatePatch(Terrain& terrain);
-    /// Finish update patch data.
-    void FinishUpdatePatch();
-
-protected:
-    /// Recalculate the world-space bounding box.
-    virtual void OnWorldBoundingBoxUpdate() override;
+    void UpdatePatch();
+    /// Request cancellation of pending update. Worker thread will skip patch generation if not started yet.
+    void CancelUpdatePatch() { updateCancelled_ = true; }
+    /// Return whether the pending update was cancelled.
+    bool IsUpdatePatchCancelled() const { return updateCancelled_; }
+    /// Return size of data to be uploaded to GPU, in bytes.
+    unsigned GetUploadDataSize() const;
+    /// Return memory held by CPU data, in bytes.
+    unsigned GetMemoryUse() const;
+    /// Return number of billboards in generated data.
+    unsigned GetNumBillboards() const { return numBillboards_; }
+    /// Return generated vertex data.
+    const unsigned char* GetVertexData() const { return vertexData_.Buffer(); }
+    /// Return bounding box of generated data.
+    const BoundingBox& GetBoundingBox() const { return boundingBox_; }
+
+    /// Set arena block and world-space bounding box of uploaded data. Must be called from the host grass component only.
+    void SetUploadedBlock(const GrassArenaBlock& block, const BoundingBox& worldBoundingBox);
+    /// Reset arena block. Must be called from the host grass component only.
+    void ResetUploadedBlock() { block_ = GrassArenaBlock(); }
+    /// Return arena block of uploaded data.
+    const GrassArenaBlock& GetUploadedBlock() const { return block_; }
+    /// Return whether the patch is uploaded to arena.
+    bool IsUploaded() const { return block_.IsAllocated(); }
+    /// Return world-space bounding box of uploaded data.
+    const BoundingBox& GetWorldBoundingBox() const { return worldBoundingBox_; }
+
+    /// Return vertex elements for specified format.
+    static const PODVector<VertexElement>& GetVertexElements(GrassVertexFormat format);
+    /// Return vertex size for specified format.
+    static unsigned GetVertexSize(GrassVertexFormat format);
+    /// Fill quad indices for billboards in range [begin, end).
+    static void FillBillboardIndices(unsigned short* dest, unsigned begin, unsigned end);
+    /// Fill quad indices for billboards in range [begin, end).
+    static void FillBillboardIndices(unsigned* dest, unsigned begin, unsigned end);
 
 private:
     /// Pattern.
-    const PODVector<Vector2>* pattern_ = nullptr;
+    SharedPtr<BlueNoiseTileSet> pattern_;
     /// Scale of pattern.
     float patternScale_ = 1.0f;
     /// Range covered by patch (in local space)
     Rect localRange_;
     /// Origin of local space.
     Vector3 origin_;
+    /// Vertex format.
+    GrassVertexFormat format_ = GrassVertexFormat::Expanded;
+    /// Range of blade scale.
+    Vector2 bladeScale_ = Vector2::ONE;
 
-    /// Geometry.
-    SharedPtr<Geometry> geometry_;
-    /// Vertex buffer.
-    SharedPtr<VertexBuffer> vertexBuffer_;
-    /// Index buffer.
-    SharedPtr<IndexBuffer> indexBuffer_;
-    /// Per-instance data.
-    Vector4 instanceData_;
-
-    /// Work item.
+    /// Work item of pending update. Not pooled, released when the update is processed.
     SharedPtr<WorkItem> workItem_;
+    /// Whether the pending update was cancelled.
+    std::atomic<bool> updateCancelled_;
+    /// Terrain sampler captured before update.
+    TerrainSampler terrain_;
+    /// Offset of vertex positions captured before update.
+    Vector3 offset_;
+    /// Number of billboards in generated data.
+    unsigned numBillboards_ = 0;
+    /// Bounding box of generated data.
+    BoundingBox boundingBox_;
     /// Vertex data.
-    PODVector<float> vertexData_;
-    /// Index data.
-    PODVector<unsigned short> indexData_;
+    PODVector<unsigned char> vertexData_;
+
+    /// Arena block of uploaded data.
+    GrassArenaBlock block_;
+    /// World-space bounding box of uploaded data.
+    BoundingBox worldBoundingBox_;
 };
 
 }
@@ -1,6 +1,7 @@
 #include <FlexEngine/Graphics/StaticModelEx.h>
 
 #include <FlexEngine/Core/Attribute.h>
+#include <FlexEngine/Graphics/TerrainOcclusion.h>
 
 #include <Urho3D/Core/Context.h>
 #include <Urho3D/Graphics/Camera.h>
@@ -36,6 +37,7 @@ void StaticModelEx::RegisterObject(Context* context)
     URHO3D_ACCESSOR_ATTRIBUTE("Unique Materials", AreMaterialsUnique, SetUniqueMaterials, bool, false, AM_DEFAULT);
     URHO3D_ACCESSOR_ATTRIBUTE("LOD Switch Bias", GetLodSwitchBias, SetLodSwitchBias, float, 1.0f, AM_DEFAULT);
     URHO3D_ACCESSOR_ATTRIBUTE("LOD Switch Duration", GetLodSwitchDuration, SetLodSwitchDuration, float, 1.0f, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Can Be Occluded By Terrain", IsTerrainOccludee, SetTerrainOccludee, bool, true, AM_DEFAULT);
 
     URHO3D_ATTRIBUTE("Is Occluder", bool, occluder_, false, AM_DEFAULT);
     URHO3D_ACCESSOR_ATTRIBUTE("Can Be Occluded", IsOccludee, SetOccludee, bool, true, AM_DEFAULT);
@@ -56,6 +58,7 @@ void StaticModelEx::UpdateBatches(const FrameInfo& frame)
 {
     UpdateLodLevels(frame);
     UpdateWind();
+    UpdateTerrainOcclusion(frame);
 }
 
 void StaticModelEx::SetModel(Model* model)
@@ -145,6 +148,9 @@ void StaticModelEx::OnSceneSet(Scene* scene)
     if (scene)
     {
         windSystem_ = scene->GetOrCreateComponent<WindSystem>();
+        terrainOcclusion_ = scene->GetOrCreateComponent<TerrainOcclusion>();
+        for (unsigned i = 0; i < geometryDataEx_.Size(); ++i)
+            UpdateShadowOnlyMaterial(i);
         UpdateReferencedMaterials();
     }
 }
@@ -156,6 +162,8 @@ void StaticModelEx::UpdateReferencedMaterials()
         for (unsigned i = 0; i < geometryDataEx_.Size(); ++i)
         {
             windSystem_->ReferenceMaterial(geometryDataEx_[i].originalMaterial_);
+            if (geometryDataEx_[i].shadowOnlyMaterial_)
+                windSystem_->ReferenceMaterial(geometryDataEx_[i].shadowOnlyMaterial_);
         }
     }
 }
@@ -173,6 +181,7 @@ void StaticModelEx::SetMaterialImpl(unsigned index, Material* material)
     geometryDataEx_[index].clonedMaterial_.Reset();
     if (cloneMaterials_)
         geometryDataEx_[index].clonedMaterial_ = material ? material->Clone() : nullptr;
+    UpdateShadowOnlyMaterial(index);
 }
 
 void StaticModelEx::SetBatchMaterial(unsigned index)
@@ -182,6 +191,28 @@ void StaticModelEx::SetBatchMaterial(unsigned index)
     batches_[index + geometryDataEx_.Size()].material_ = batches_[index].material_;
 }
 
+void StaticModelEx::UpdateShadowOnlyMaterial(unsigned index)
+{
+    assert(index < geometryDataEx_.Size());
+    StaticModelGeometryDataEx& geometryDataEx = geometryDataEx_[index];
+    geometryDataEx.shadowOnlyMaterial_ = terrainOcclusion_ ? terrainOcclusion_->GetShadowOnlyMaterial(geometryDataEx.originalMaterial_) : nullptr;
+    if (windSystem_ && applyWind_ && geometryDataEx.shadowOnlyMaterial_)
+        windSystem_->ReferenceMaterial(geometryDataEx.shadowOnlyMaterial_);
+
+    // Cloned material may have own parameters, so shadow-only techniques are applied to its copy
+    geometryDataEx.clonedShadowOnlyMaterial_.Reset();
+    Material* shadowOnlyMaterial = geometryDataEx.shadowOnlyMaterial_;
+    if (geometryDataEx.clonedMaterial_ && shadowOnlyMaterial)
+    {
+        geometryDataEx.clonedShadowOnlyMaterial_ = geometryDataEx.clonedMaterial_->Clone();
+        for (unsigned i = 0; i < shadowOnlyMaterial->GetNumTechniques(); ++i)
+        {
+            const TechniqueEntry& entry = shadowOnlyMaterial->GetTechniqueEntry(i);
+            geometryDataEx.clonedShadowOnlyMaterial_->SetTechnique(i, entry.technique_, entry.qualityLevel_, entry.lodDistance_);
+        }
+    }
+}
+
 void StaticModelEx::SetCloneRequestSet(unsigned flagSet)
 {
     if (cloneMaterials_)
@@ -356,11 +387,14 @@ void StaticModelEx::UpdateWind()
             const Pair<WindSample, bool> sample = windSystem_->GetWindSample(node_->GetWorldPosition());
             if (sample.second_)
             {
+                // Batches may reference shared shadow-only materials, so only own copies are updated
                 SetCloneRequest(CR_WIND, true);
-                for (unsigned i = 0; i < batches_.Size(); ++i)
+                for (StaticModelGeometryDataEx& geometryDataEx : geometryDataEx_)
                 {
-                    if (batches_[i].material_)
-                        WindSystem::SetMaterialWind(*batches_[i].material_, sample.first_);
+                    if (geometryDataEx.clonedMaterial_)
+                        WindSystem::SetMaterialWind(*geometryDataEx.clonedMaterial_, sample.first_);
+                    if (geometryDataEx.clonedShadowOnlyMaterial_)
+                        WindSystem::SetMaterialWind(*geometryDataEx.clonedShadowOnlyMaterial_, sample.first_);
                 }
             }
             else
@@ -375,4 +409,28 @@ void StaticModelEx::UpdateWind()
     }
 }
 
+void StaticModelEx::UpdateTerrainOcclusion(const FrameInfo& frame)
+{
+    const bool occluded = terrainOccludee_ && terrainOcclusion_ && terrainOcclusion_->IsOccluded(frame, GetWorldBoundingBox());
+    const unsigned numGeometries = geometryDataEx_.Size();
+    for (unsigned i = 0; i < numGeometries; ++i)
+    {
+        // Shadow of hidden model may be visible, so only camera passes are skipped
+        const StaticModelGeometryDataEx& geometryDataEx = geometryDataEx_[i];
+        Material* shadowOnlyMaterial = !castShadows_ ? nullptr
+            : cloneRequests_ ? geometryDataEx.clonedShadowOnlyMaterial_.Get() : geometryDataEx.shadowOnlyMaterial_.Get();
+        if (!occluded)
+            SetBatchMaterial(i);
+        else if (shadowOnlyMaterial)
+        {
+            batches_[i].material_ = shadowOnlyMaterial;
+            batches_[i + numGeometries].material_ = shadowOnlyMaterial;
+        }
+
+        const unsigned numWorldTransforms = !occluded || shadowOnlyMaterial ? 1 : 0;
+        batches_[i].numWorldTransforms_ = numWorldTransforms;
+        batches_[i + numGeometries].numWorldTransforms_ = numWorldTransforms;
+    }
+}
+
 }
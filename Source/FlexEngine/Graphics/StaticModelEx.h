@@ -8,6 +8,8 @@
 namespace FlexEngine
 {
 
+class TerrainOcclusion;
+
 /// Static model per-geometry extra data (extended).
 /// @see Urho3D::StaticModelGeometryData
 struct StaticModelGeometryDataEx
@@ -16,6 +18,10 @@ struct StaticModelGeometryDataEx
     SharedPtr<Material> originalMaterial_;
     /// Unique copy of geometry material.
     SharedPtr<Material> clonedMaterial_;
+    /// Copy of geometry material with shadow pass only. Used if model is hidden behind terrain.
+    SharedPtr<Material> shadowOnlyMaterial_;
+    /// Unique copy of cloned material with shadow pass only. Used instead of shared copy if cloned material is used.
+    SharedPtr<Material> clonedShadowOnlyMaterial_;
 
     /// Primary LOD level.
     unsigned primaryLodLevel_;
@@ -78,6 +84,10 @@ public:
     void SetLodSwitchDuration(float duration) { lodSwitchDuration_ = duration; }
     /// Return LOD switch duration.
     float GetLodSwitchDuration() const { return lodSwitchDuration_; }
+    /// Set whether the model may be hidden behind terrain. Shadows of hidden model are still drawn.
+    void SetTerrainOccludee(bool terrainOccludee) { terrainOccludee_ = terrainOccludee; }
+    /// Return whether the model may be hidden behind terrain.
+    bool IsTerrainOccludee() const { return terrainOccludee_; }
 
     /// Return materials attribute.
     const ResourceRefList& GetMaterialsAttr() const;
@@ -94,6 +104,8 @@ private:
     void SetMaterialImpl(unsigned index, Material* material);
     /// Set original or cloned batch material.
     void SetBatchMaterial(unsigned index);
+    /// Update shadow-only copy of geometry material.
+    void UpdateShadowOnlyMaterial(unsigned index);
     /// Set clone request flag set. This call is ignored if materials are not cloned.
     void SetCloneRequestSet(unsigned flagSet);
     /// Set clone request flag. This call is ignored if materials are not cloned.
@@ -112,6 +124,8 @@ private:
     void UpdateLodLevels(const FrameInfo& frame);
     /// Update wind.
     void UpdateWind();
+    /// Draw only shadow batches if hidden behind terrain.
+    void UpdateTerrainOcclusion(const FrameInfo& frame);
 
 private:
     /// Clone request from user.
@@ -121,6 +135,8 @@ private:
 
     /// Wind system.
     WeakPtr<WindSystem> windSystem_;
+    /// Terrain occlusion.
+    WeakPtr<TerrainOcclusion> terrainOcclusion_;
 
     /// Whether to receive wind updates.
     bool applyWind_ = false;
@@ -132,6 +148,8 @@ private:
     float lodSwitchBias_ = 1.0f;
     /// Duration of LOD switching.
     float lodSwitchDuration_ = 1.0f;
+    /// Whether the model may be hidden behind terrain.
+    bool terrainOccludee_ = true;
 
     /// Extended per-geometry data.
     Vector<StaticModelGeometryDataEx> geometryDataEx_;
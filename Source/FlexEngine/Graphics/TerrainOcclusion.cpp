@@ -0,0 +1,272 @@
+#include <FlexEngine/Graphics/TerrainOcclusion.h>
+
+#include <FlexEngine/Graphics/TerrainSampler.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Drawable.h>
+#include <Urho3D/Graphics/Material.h>
+#include <Urho3D/Graphics/Technique.h>
+#include <Urho3D/Graphics/Terrain.h>
+#include <Urho3D/Scene/Node.h>
+
+namespace FlexEngine
+{
+
+namespace
+{
+
+/// Min number of azimuth sectors.
+static const unsigned minSectors = 8;
+/// Min number of rays per sector.
+static const unsigned minRaysPerSector = 1;
+/// Min number of distance steps.
+static const unsigned minSteps = 2;
+/// Tangent bias that prevents culling of objects that touch horizon.
+static const float horizonBias = 0.001f;
+
+}
+
+TerrainOcclusion::TerrainOcclusion(Context* context)
+    : Component(context)
+{
+}
+
+TerrainOcclusion::~TerrainOcclusion()
+{
+}
+
+void TerrainOcclusion::RegisterObject(Context* context)
+{
+    context->RegisterFactory<TerrainOcclusion>(FLEXENGINE_CATEGORY);
+
+    URHO3D_ACCESSOR_ATTRIBUTE("Is Enabled", IsEnabled, SetEnabled, bool, true, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Num Sectors", GetNumSectors, SetNumSectors, unsigned, 256, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Num Rays Per Sector", GetNumRaysPerSector, SetNumRaysPerSector, unsigned, 4, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Num Steps", GetNumSteps, SetNumSteps, unsigned, 64, AM_DEFAULT);
+    URHO3D_ACCESSOR_ATTRIBUTE("Max Distance", GetMaxDistance, SetMaxDistance, float, 1000.0f, AM_DEFAULT);
+}
+
+void TerrainOcclusion::SetTerrain(Terrain* terrain)
+{
+    terrain_ = terrain;
+    MarkHorizonDirty();
+}
+
+void TerrainOcclusion::SetNumSectors(unsigned numSectors)
+{
+    numSectors_ = Max(minSectors, numSectors);
+    MarkHorizonDirty();
+}
+
+void TerrainOcclusion::SetNumRaysPerSector(unsigned numRaysPerSector)
+{
+    numRaysPerSector_ = Max(minRaysPerSector, numRaysPerSector);
+    MarkHorizonDirty();
+}
+
+void TerrainOcclusion::SetNumSteps(unsigned numSteps)
+{
+    numSteps_ = Max(minSteps, numSteps);
+    MarkHorizonDirty();
+}
+
+void TerrainOcclusion::SetMaxDistance(float maxDistance)
+{
+    maxDistance_ = Max(M_EPSILON, maxDistance);
+    MarkHorizonDirty();
+}
+
+bool TerrainOcclusion::IsOccluded(const FrameInfo& frame, const BoundingBox& worldBoundingBox)
+{
+    if (!frame.camera_ || !IsEnabledEffective())
+        return false;
+
+    {
+        MutexLock lock(horizonMutex_);
+        if (frame.camera_ != horizonCamera_ || frame.frameNumber_ != horizonFrameNumber_)
+        {
+            horizonCamera_ = frame.camera_;
+            horizonFrameNumber_ = frame.frameNumber_;
+            BuildHorizon(frame.camera_->GetNode()->GetWorldPosition());
+        }
+    }
+
+    if (!horizonValid_)
+        return false;
+
+    // Objects around the eye are never hidden
+    const BoundingBox& box = worldBoundingBox;
+    const Vector2 nearOffset(
+        Max(Max(box.min_.x_ - eye_.x_, eye_.x_ - box.max_.x_), 0.0f),
+        Max(Max(box.min_.z_ - eye_.z_, eye_.z_ - box.max_.z_), 0.0f));
+    const Vector2 farOffset(
+        Max(Abs(box.min_.x_ - eye_.x_), Abs(box.max_.x_ - eye_.x_)),
+        Max(Abs(box.min_.z_ - eye_.z_), Abs(box.max_.z_ - eye_.z_)));
+    const float nearDistance = nearOffset.Length();
+    const float farDistance = farOffset.Length();
+    if (nearDistance < M_EPSILON)
+        return false;
+
+    // Highest elevation of the box
+    const float top = box.max_.y_ - eye_.y_;
+    const float boxTangent = top / (top >= 0.0f ? nearDistance : farDistance);
+
+    // Only terrain strictly in front of the box may hide it
+    const float stepPosition = Sqrt(nearDistance / maxDistance_) * numSteps_;
+    const int lastStep = Min(CeilToInt(stepPosition) - 2, static_cast<int>(numSteps_) - 1);
+    if (lastStep < 0)
+        return false;
+
+    // Find azimuth range of the box. Eye is outside of the box, so the range is less than half circle
+    const Vector2 center = Vector2(box.Center().x_ - eye_.x_, box.Center().z_ - eye_.z_);
+    const float centerAngle = Atan2(center.y_, center.x_);
+    float minAngle = 0.0f;
+    float maxAngle = 0.0f;
+    for (unsigned i = 0; i < 4; ++i)
+    {
+        const float x = (i & 1 ? box.max_.x_ : box.min_.x_) - eye_.x_;
+        const float z = (i & 2 ? box.max_.z_ : box.min_.z_) - eye_.z_;
+        float delta = Atan2(z, x) - centerAngle;
+        if (delta > 180.0f)
+            delta -= 360.0f;
+        else if (delta < -180.0f)
+            delta += 360.0f;
+        minAngle = Min(minAngle, delta);
+        maxAngle = Max(maxAngle, delta);
+    }
+
+    // Test all covered sectors
+    const float sectorAngle = 360.0f / numSectors_;
+    const int firstSector = FloorToInt((centerAngle + minAngle) / sectorAngle);
+    const int lastSector = FloorToInt((centerAngle + maxAngle) / sectorAngle);
+    const int numSectors = static_cast<int>(numSectors_);
+    for (int i = firstSector; i <= lastSector; ++i)
+    {
+        const int sector = (i % numSectors + numSectors) % numSectors;
+        if (horizon_[sector * numSteps_ + lastStep] <= boxTangent + horizonBias)
+            return false;
+    }
+    return true;
+}
+
+Material* TerrainOcclusion::GetShadowOnlyMaterial(Material* material)
+{
+    if (!material)
+        return nullptr;
+
+    auto iter = shadowOnlyMaterials_.Find(WeakPtr<Material>(material));
+    if (iter != shadowOnlyMaterials_.End())
+        return iter->second_;
+
+    // Materials are not kept alive by their copies
+    for (auto pruneIter = shadowOnlyMaterials_.Begin(); pruneIter != shadowOnlyMaterials_.End();)
+    {
+        if (pruneIter->first_.Expired())
+            pruneIter = shadowOnlyMaterials_.Erase(pruneIter);
+        else
+            ++pruneIter;
+    }
+
+    SharedPtr<Material> shadowOnlyMaterial = material->Clone();
+    for (unsigned i = 0; i < shadowOnlyMaterial->GetNumTechniques(); ++i)
+    {
+        const TechniqueEntry& entry = shadowOnlyMaterial->GetTechniqueEntry(i);
+        if (!entry.technique_)
+            continue;
+
+        SharedPtr<Technique> technique = entry.technique_->Clone();
+        for (const String& passName : entry.technique_->GetPassNames())
+        {
+            if (passName != "shadow")
+                technique->RemovePass(passName);
+        }
+        shadowOnlyMaterial->SetTechnique(i, technique, entry.qualityLevel_, entry.lodDistance_);
+    }
+    shadowOnlyMaterials_[WeakPtr<Material>(material)] = shadowOnlyMaterial;
+    return shadowOnlyMaterial;
+}
+
+void TerrainOcclusion::MarkHorizonDirty()
+{
+    MutexLock lock(horizonMutex_);
+    horizonCamera_ = nullptr;
+}
+
+void TerrainOcclusion::BuildHorizon(const Vector3& eye)
+{
+    horizonValid_ = false;
+    eye_ = eye;
+    if (!terrain_)
+        return;
+
+    const TerrainSampler sampler(*terrain_);
+
+    // Eye under terrain sees nothing, but it's better to draw everything than nothing
+    float eyeHeight = 0.0f;
+    sampler.SampleHeight(1, &eye.x_, &eye.z_, &eyeHeight);
+    if (eye.y_ < eyeHeight)
+        return;
+
+    // Sample terrain along rays at sector boundaries and inside sectors
+    const unsigned numRays = numSectors_ * numRaysPerSector_;
+    const unsigned numSamples = numRays * numSteps_;
+    PODVector<float> sampleX(numSamples);
+    PODVector<float> sampleZ(numSamples);
+    PODVector<float> sampleHeight(numSamples);
+    PODVector<float> stepDistance(numSteps_);
+    for (unsigned step = 0; step < numSteps_; ++step)
+        stepDistance[step] = GetStepDistance(step);
+
+    const float rayAngle = 360.0f / numRays;
+    for (unsigned ray = 0; ray < numRays; ++ray)
+    {
+        const float cosAngle = Cos(ray * rayAngle);
+        const float sinAngle = Sin(ray * rayAngle);
+        for (unsigned step = 0; step < numSteps_; ++step)
+        {
+            sampleX[ray * numSteps_ + step] = eye.x_ + cosAngle * stepDistance[step];
+            sampleZ[ray * numSteps_ + step] = eye.z_ + sinAngle * stepDistance[step];
+        }
+    }
+    sampler.SampleHeight(numSamples, sampleX.Buffer(), sampleZ.Buffer(), sampleHeight.Buffer());
+
+    // Accumulate max elevation along rays
+    for (unsigned ray = 0; ray < numRays; ++ray)
+    {
+        float maxTangent = -M_INFINITY;
+        for (unsigned step = 0; step < numSteps_; ++step)
+        {
+            float& value = sampleHeight[ray * numSteps_ + step];
+            maxTangent = Max(maxTangent, (value - eye.y_) / stepDistance[step]);
+            value = maxTangent;
+        }
+    }
+
+    // Sector is hidden only if all its rays are hidden, so gaps between boundary rays aren't treated as solid
+    horizon_.Resize(numSectors_ * numSteps_);
+    for (unsigned sector = 0; sector < numSectors_; ++sector)
+    {
+        float* sectorHorizon = &horizon_[sector * numSteps_];
+        for (unsigned step = 0; step < numSteps_; ++step)
+            sectorHorizon[step] = M_INFINITY;
+
+        for (unsigned i = 0; i <= numRaysPerSector_; ++i)
+        {
+            const unsigned ray = (sector * numRaysPerSector_ + i) % numRays;
+            const float* rayHorizon = &sampleHeight[ray * numSteps_];
+            for (unsigned step = 0; step < numSteps_; ++step)
+                sectorHorizon[step] = Min(sectorHorizon[step], rayHorizon[step]);
+        }
+    }
+    horizonValid_ = true;
+}
+
+float TerrainOcclusion::GetStepDistance(unsigned step) const
+{
+    // Steps are denser near the eye where terrain covers larger angles
+    const float factor = static_cast<float>(step + 1) / numSteps_;
+    return maxDistance_ * factor * factor;
+}
+
+}
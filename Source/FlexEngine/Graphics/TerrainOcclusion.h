@@ -0,0 +1,101 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Scene/Component.h>
+
+namespace Urho3D
+{
+
+class Camera;
+class Material;
+class Terrain;
+struct FrameInfo;
+
+}
+
+namespace FlexEngine
+{
+
+/// Horizon-based occlusion by terrain. Scene-wide.
+/// Stores max elevation of terrain per azimuth sector and distance around camera, updated once per camera and frame.
+/// Elevation of sector is the lowest one among several rays sampled inside the sector.
+/// Terrain node is assumed to be unrotated.
+class TerrainOcclusion : public Component
+{
+    URHO3D_OBJECT(TerrainOcclusion, Component);
+
+public:
+    /// Construct.
+    TerrainOcclusion(Context* context);
+    /// Destruct.
+    virtual ~TerrainOcclusion();
+    /// Register object factory.
+    static void RegisterObject(Context* context);
+
+    /// Set terrain used as occluder.
+    void SetTerrain(Terrain* terrain);
+    /// Return terrain used as occluder.
+    Terrain* GetTerrain() const { return terrain_; }
+    /// Set number of azimuth sectors.
+    void SetNumSectors(unsigned numSectors);
+    /// Return number of azimuth sectors.
+    unsigned GetNumSectors() const { return numSectors_; }
+    /// Set number of rays sampled per sector. Gaps in terrain narrower than distance between rays may be missed.
+    void SetNumRaysPerSector(unsigned numRaysPerSector);
+    /// Return number of rays sampled per sector.
+    unsigned GetNumRaysPerSector() const { return numRaysPerSector_; }
+    /// Set number of distance steps per sector.
+    void SetNumSteps(unsigned numSteps);
+    /// Return number of distance steps per sector.
+    unsigned GetNumSteps() const { return numSteps_; }
+    /// Set max distance of terrain occluding objects.
+    void SetMaxDistance(float maxDistance);
+    /// Return max distance of terrain occluding objects.
+    float GetMaxDistance() const { return maxDistance_; }
+
+    /// Return whether the world-space bounding box is hidden behind terrain from camera of the frame. May be called from worker thread(s).
+    /// Horizon is rebuilt when camera or frame changes, so views must not be processed concurrently.
+    bool IsOccluded(const FrameInfo& frame, const BoundingBox& worldBoundingBox);
+    /// Return shared copy of material with shadow pass only. Hidden shadow casters are drawn with it to keep their shadows. Shall be called from main thread.
+    Material* GetShadowOnlyMaterial(Material* material);
+
+private:
+    /// Mark horizon dirty.
+    void MarkHorizonDirty();
+    /// Build horizon around eye position.
+    void BuildHorizon(const Vector3& eye);
+    /// Return distance of step.
+    float GetStepDistance(unsigned step) const;
+
+    /// Terrain.
+    WeakPtr<Terrain> terrain_;
+    /// Number of azimuth sectors.
+    unsigned numSectors_ = 256;
+    /// Number of rays sampled per sector.
+    unsigned numRaysPerSector_ = 4;
+    /// Number of distance steps per sector.
+    unsigned numSteps_ = 64;
+    /// Max distance of terrain occluding objects.
+    float maxDistance_ = 1000.0f;
+
+    /// Mutex for horizon update.
+    Mutex horizonMutex_;
+    /// Camera of horizon.
+    Camera* horizonCamera_ = nullptr;
+    /// Frame number of horizon.
+    unsigned horizonFrameNumber_ = 0;
+    /// Whether the horizon is valid. Invalid horizon occludes nothing.
+    bool horizonValid_ = false;
+    /// Eye position of horizon.
+    Vector3 eye_;
+    /// Max tangent of terrain elevation angle for each sector and step. Tangents are accumulated along steps.
+    PODVector<float> horizon_;
+
+    /// Copies of materials with shadow pass only. Copies of destroyed materials are pruned when new copy is created.
+    HashMap<WeakPtr<Material>, SharedPtr<Material>> shadowOnlyMaterials_;
+};
+
+}
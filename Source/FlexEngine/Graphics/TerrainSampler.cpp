@@ -0,0 +1,282 @@
+#include <FlexEngine/Graphics/TerrainSampler.h>
+
+#include <Urho3D/Graphics/Terrain.h>
+#include <Urho3D/Scene/Node.h>
+
+#ifdef URHO3D_SSE
+#include <emmintrin.h>
+#endif
+
+namespace FlexEngine
+{
+
+struct TerrainSampler::Cache
+{
+    /// First cached texel.
+    IntVector2 begin_;
+    /// Last cached texel.
+    IntVector2 end_;
+    /// Width of cached rectangle.
+    int width_ = 0;
+    /// Heights.
+    PODVector<float> height_;
+    /// Normals, X component.
+    PODVector<float> normalX_;
+    /// Normals, Y component.
+    PODVector<float> normalY_;
+    /// Normals, Z component.
+    PODVector<float> normalZ_;
+};
+
+TerrainSampler::TerrainSampler(const Terrain& terrain)
+    : heightData_(terrain.GetHeightData())
+    , numVertices_(terrain.GetNumVertices())
+    , spacing_(terrain.GetSpacing())
+{
+    if (Node* node = terrain.GetNode())
+    {
+        position_ = node->GetWorldPosition();
+        scale_ = node->GetWorldScale();
+    }
+}
+
+void TerrainSampler::Sample(unsigned count, const float* x, const float* z,
+    float* height, float* normalX, float* normalY, float* normalZ) const
+{
+    if (count == 0)
+        return;
+
+    if (!heightData_ || numVertices_.x_ < 2 || numVertices_.y_ < 2)
+    {
+        for (unsigned i = 0; i < count; ++i)
+        {
+            height[i] = position_.y_;
+            normalX[i] = 0.0f;
+            normalY[i] = 1.0f;
+            normalZ[i] = 0.0f;
+        }
+        return;
+    }
+
+    // Transform from world space to height map space
+    const float scaleX = 1.0f / (spacing_.x_ * scale_.x_);
+    const float scaleZ = 1.0f / (spacing_.z_ * scale_.z_);
+    const float offsetX = position_.x_ - 0.5f * (numVertices_.x_ - 1) * spacing_.x_ * scale_.x_;
+    const float offsetZ = position_.z_ - 0.5f * (numVertices_.y_ - 1) * spacing_.z_ * scale_.z_;
+
+    // Find texels covered by points
+    float minX = x[0];
+    float maxX = x[0];
+    float minZ = z[0];
+    float maxZ = z[0];
+    for (unsigned i = 1; i < count; ++i)
+    {
+        minX = Min(minX, x[i]);
+        maxX = Max(maxX, x[i]);
+        minZ = Min(minZ, z[i]);
+        maxZ = Max(maxZ, z[i]);
+    }
+    const IntVector2 begin(
+        Clamp(FloorToInt((minX - offsetX) * scaleX), 0, numVertices_.x_ - 2),
+        Clamp(FloorToInt((minZ - offsetZ) * scaleZ), 0, numVertices_.y_ - 2));
+    const IntVector2 end(
+        Clamp(FloorToInt((maxX - offsetX) * scaleX) + 1, begin.x_ + 1, numVertices_.x_ - 1),
+        Clamp(FloorToInt((maxZ - offsetZ) * scaleZ) + 1, begin.y_ + 1, numVertices_.y_ - 1));
+
+    Cache cache;
+    FillCache(cache, begin, end);
+
+    const float minPosX = static_cast<float>(begin.x_);
+    const float maxPosX = static_cast<float>(end.x_);
+    const float minPosZ = static_cast<float>(begin.y_);
+    const float maxPosZ = static_cast<float>(end.y_);
+    const int width = cache.width_;
+    const float* heights = cache.height_.Buffer();
+    const float* normalsX = cache.normalX_.Buffer();
+    const float* normalsY = cache.normalY_.Buffer();
+    const float* normalsZ = cache.normalZ_.Buffer();
+
+    unsigned i = 0;
+
+#ifdef URHO3D_SSE
+    // Process four points at once
+    const __m128 vScaleX = _mm_set1_ps(scaleX);
+    const __m128 vScaleZ = _mm_set1_ps(scaleZ);
+    const __m128 vOffsetX = _mm_set1_ps(offsetX);
+    const __m128 vOffsetZ = _mm_set1_ps(offsetZ);
+    const __m128 vMinPosX = _mm_set1_ps(minPosX);
+    const __m128 vMaxPosX = _mm_set1_ps(maxPosX);
+    const __m128 vMinPosZ = _mm_set1_ps(minPosZ);
+    const __m128 vMaxPosZ = _mm_set1_ps(maxPosZ);
+    const __m128 vMaxCellX = _mm_set1_ps(maxPosX - 1.0f);
+    const __m128 vMaxCellZ = _mm_set1_ps(maxPosZ - 1.0f);
+    const __m128 vWidth = _mm_set1_ps(static_cast<float>(width));
+    const __m128 vOne = _mm_set1_ps(1.0f);
+    const __m128 vHeightScale = _mm_set1_ps(scale_.y_);
+    const __m128 vHeightOffset = _mm_set1_ps(position_.y_);
+
+    const auto gather = [](const float* data, const int* index, int offset)
+    {
+        return _mm_setr_ps(data[index[0] + offset], data[index[1] + offset], data[index[2] + offset], data[index[3] + offset]);
+    };
+
+    for (; i + 4 <= count; i += 4)
+    {
+        const __m128 posX = _mm_min_ps(vMaxPosX, _mm_max_ps(vMinPosX, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(x + i), vOffsetX), vScaleX)));
+        const __m128 posZ = _mm_min_ps(vMaxPosZ, _mm_max_ps(vMinPosZ, _mm_mul_ps(_mm_sub_ps(_mm_loadu_ps(z + i), vOffsetZ), vScaleZ)));
+        const __m128 cellX = _mm_min_ps(vMaxCellX, _mm_cvtepi32_ps(_mm_cvttps_epi32(posX)));
+        const __m128 cellZ = _mm_min_ps(vMaxCellZ, _mm_cvtepi32_ps(_mm_cvttps_epi32(posZ)));
+        const __m128 fracX = _mm_sub_ps(posX, cellX);
+        const __m128 fracZ = _mm_sub_ps(posZ, cellZ);
+
+        int index[4];
+        const __m128 cellIndex = _mm_add_ps(_mm_mul_ps(_mm_sub_ps(cellZ, vMinPosZ), vWidth), _mm_sub_ps(cellX, vMinPosX));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(index), _mm_cvttps_epi32(cellIndex));
+
+        // Interpolate over the same triangle as terrain geometry
+        const __m128 fracSum = _mm_add_ps(fracX, fracZ);
+        const __m128 upper = _mm_cmpge_ps(fracSum, vOne);
+        const __m128 w00 = _mm_andnot_ps(upper, _mm_sub_ps(vOne, fracSum));
+        const __m128 w11 = _mm_and_ps(upper, _mm_sub_ps(fracSum, vOne));
+        const __m128 w10 = _mm_or_ps(_mm_and_ps(upper, _mm_sub_ps(vOne, fracZ)), _mm_andnot_ps(upper, fracX));
+        const __m128 w01 = _mm_or_ps(_mm_and_ps(upper, _mm_sub_ps(vOne, fracX)), _mm_andnot_ps(upper, fracZ));
+
+        const auto interpolate = [&](const float* data)
+        {
+            return _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(w00, gather(data, index, 0)), _mm_mul_ps(w10, gather(data, index, 1))),
+                _mm_add_ps(_mm_mul_ps(w01, gather(data, index, width)), _mm_mul_ps(w11, gather(data, index, width + 1))));
+        };
+
+        const __m128 h = interpolate(heights);
+        const __m128 nx = interpolate(normalsX);
+        const __m128 ny = interpolate(normalsY);
+        const __m128 nz = interpolate(normalsZ);
+        const __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), _mm_mul_ps(ny, ny)), _mm_mul_ps(nz, nz)));
+
+        _mm_storeu_ps(height + i, _mm_add_ps(_mm_mul_ps(h, vHeightScale), vHeightOffset));
+        _mm_storeu_ps(normalX + i, _mm_div_ps(nx, length));
+        _mm_storeu_ps(normalY + i, _mm_div_ps(ny, length));
+        _mm_storeu_ps(normalZ + i, _mm_div_ps(nz, length));
+    }
+#endif
+
+    // Process remaining points
+    for (; i < count; ++i)
+    {
+        const float posX = Clamp((x[i] - offsetX) * scaleX, minPosX, maxPosX);
+        const float posZ = Clamp((z[i] - offsetZ) * scaleZ, minPosZ, maxPosZ);
+        const int cellX = Min(static_cast<int>(posX), end.x_ - 1);
+        const int cellZ = Min(static_cast<int>(posZ), end.y_ - 1);
+        const float fracX = posX - cellX;
+        const float fracZ = posZ - cellZ;
+        const int index = (cellZ - begin.y_) * width + (cellX - begin.x_);
+
+        // Interpolate over the same triangle as terrain geometry
+        const bool upper = fracX + fracZ >= 1.0f;
+        const float w00 = upper ? 0.0f : 1.0f - fracX - fracZ;
+        const float w11 = upper ? fracX + fracZ - 1.0f : 0.0f;
+        const float w10 = upper ? 1.0f - fracZ : fracX;
+        const float w01 = upper ? 1.0f - fracX : fracZ;
+
+        const auto interpolate = [=](const float* data)
+        {
+            return w00 * data[index] + w10 * data[index + 1] + w01 * data[index + width] + w11 * data[index + width + 1];
+        };
+
+        const Vector3 normal = Vector3(interpolate(normalsX), interpolate(normalsY), interpolate(normalsZ)).Normalized();
+        height[i] = interpolate(heights) * scale_.y_ + position_.y_;
+        normalX[i] = normal.x_;
+        normalY[i] = normal.y_;
+        normalZ[i] = normal.z_;
+    }
+}
+
+void TerrainSampler::SampleHeight(unsigned count, const float* x, const float* z, float* height) const
+{
+    if (!heightData_ || numVertices_.x_ < 2 || numVertices_.y_ < 2)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            height[i] = position_.y_;
+        return;
+    }
+
+    // Transform from world space to height map space
+    const float scaleX = 1.0f / (spacing_.x_ * scale_.x_);
+    const float scaleZ = 1.0f / (spacing_.z_ * scale_.z_);
+    const float offsetX = position_.x_ - 0.5f * (numVertices_.x_ - 1) * spacing_.x_ * scale_.x_;
+    const float offsetZ = position_.z_ - 0.5f * (numVertices_.y_ - 1) * spacing_.z_ * scale_.z_;
+    const float maxPosX = static_cast<float>(numVertices_.x_ - 1);
+    const float maxPosZ = static_cast<float>(numVertices_.y_ - 1);
+
+    for (unsigned i = 0; i < count; ++i)
+    {
+        const float posX = Clamp((x[i] - offsetX) * scaleX, 0.0f, maxPosX);
+        const float posZ = Clamp((z[i] - offsetZ) * scaleZ, 0.0f, maxPosZ);
+        const int cellX = Min(static_cast<int>(posX), numVertices_.x_ - 2);
+        const int cellZ = Min(static_cast<int>(posZ), numVertices_.y_ - 2);
+        const float fracX = posX - cellX;
+        const float fracZ = posZ - cellZ;
+        const float* data = &heightData_[cellZ * numVertices_.x_ + cellX];
+        const int width = numVertices_.x_;
+
+        // Interpolate over the same triangle as terrain geometry
+        float h;
+        if (fracX + fracZ >= 1.0f)
+            h = (fracX + fracZ - 1.0f) * data[width + 1] + (1.0f - fracZ) * data[1] + (1.0f - fracX) * data[width];
+        else
+            h = (1.0f - fracX - fracZ) * data[0] + fracX * data[1] + fracZ * data[width];
+        height[i] = h * scale_.y_ + position_.y_;
+    }
+}
+
+void TerrainSampler::FillCache(Cache& cache, const IntVector2& begin, const IntVector2& end) const
+{
+    cache.begin_ = begin;
+    cache.end_ = end;
+    cache.width_ = end.x_ - begin.x_ + 1;
+    const unsigned size = static_cast<unsigned>(cache.width_ * (end.y_ - begin.y_ + 1));
+    cache.height_.Resize(size);
+    cache.normalX_.Resize(size);
+    cache.normalY_.Resize(size);
+    cache.normalZ_.Resize(size);
+
+    // Same normals as Terrain::GetNormal, but each texel is computed only once
+    const float up = 0.5f * (spacing_.x_ + spacing_.z_);
+    unsigned index = 0;
+    for (int z = begin.y_; z <= end.y_; ++z)
+    {
+        for (int x = begin.x_; x <= end.x_; ++x)
+        {
+            const float baseHeight = GetRawHeight(x, z);
+            const float nSlope = GetRawHeight(x, z - 1) - baseHeight;
+            const float neSlope = GetRawHeight(x + 1, z - 1) - baseHeight;
+            const float eSlope = GetRawHeight(x + 1, z) - baseHeight;
+            const float seSlope = GetRawHeight(x + 1, z + 1) - baseHeight;
+            const float sSlope = GetRawHeight(x, z + 1) - baseHeight;
+            const float swSlope = GetRawHeight(x - 1, z + 1) - baseHeight;
+            const float wSlope = GetRawHeight(x - 1, z) - baseHeight;
+            const float nwSlope = GetRawHeight(x - 1, z - 1) - baseHeight;
+
+            const Vector3 normal = (Vector3(0.0f, up, nSlope) + Vector3(-neSlope, up, neSlope)
+                + Vector3(-eSlope, up, 0.0f) + Vector3(-seSlope, up, -seSlope)
+                + Vector3(0.0f, up, -sSlope) + Vector3(swSlope, up, -swSlope)
+                + Vector3(wSlope, up, 0.0f) + Vector3(nwSlope, up, nwSlope)).Normalized();
+
+            cache.height_[index] = baseHeight;
+            cache.normalX_[index] = normal.x_;
+            cache.normalY_[index] = normal.y_;
+            cache.normalZ_[index] = normal.z_;
+            ++index;
+        }
+    }
+}
+
+float TerrainSampler::GetRawHeight(int x, int z) const
+{
+    x = Clamp(x, 0, numVertices_.x_ - 1);
+    z = Clamp(z, 0, numVertices_.y_ - 1);
+    return heightData_[z * numVertices_.x_ + x];
+}
+
+}
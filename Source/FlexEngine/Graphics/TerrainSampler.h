@@ -0,0 +1,55 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+
+#include <Urho3D/Container/ArrayPtr.h>
+#include <Urho3D/Math/Vector3.h>
+
+namespace Urho3D
+{
+
+class Terrain;
+
+}
+
+namespace FlexEngine
+{
+
+/// Batch sampler of terrain heights and normals. Reads height map directly and may be used from worker threads.
+/// Terrain node is assumed to be unrotated.
+class TerrainSampler
+{
+public:
+    /// Construct empty.
+    TerrainSampler() = default;
+    /// Construct from terrain. Must be called from the main thread.
+    TerrainSampler(const Terrain& terrain);
+
+    /// Sample heights and normals of world-space points given as arrays of X and Z coordinates.
+    /// Height map texels and normals are fetched once for the bounding rectangle of points.
+    void Sample(unsigned count, const float* x, const float* z,
+        float* height, float* normalX, float* normalY, float* normalZ) const;
+    /// Sample heights of sparse world-space points given as arrays of X and Z coordinates. Height map is read directly without cache.
+    void SampleHeight(unsigned count, const float* x, const float* z, float* height) const;
+
+private:
+    /// Heights cache for rectangle of height map.
+    struct Cache;
+    /// Fill cache for height map texels in range [begin, end].
+    void FillCache(Cache& cache, const IntVector2& begin, const IntVector2& end) const;
+    /// Return height map texel. Coordinates are clamped.
+    float GetRawHeight(int x, int z) const;
+
+    /// Height data.
+    SharedArrayPtr<float> heightData_;
+    /// Number of height map vertices.
+    IntVector2 numVertices_;
+    /// Vertex spacing.
+    Vector3 spacing_;
+    /// Terrain node world position.
+    Vector3 position_;
+    /// Terrain node world scale.
+    Vector3 scale_ = Vector3::ONE;
+};
+
+}
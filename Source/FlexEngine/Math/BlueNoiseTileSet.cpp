@@ -0,0 +1,378 @@
+#include <FlexEngine/Math/BlueNoiseTileSet.h>
+
+#include <FlexEngine/Math/MathDefs.h>
+#include <FlexEngine/Math/StandardRandom.h>
+
+#include <Urho3D/Core/Context.h>
+#include <Urho3D/IO/Deserializer.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/Serializer.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+namespace FlexEngine
+{
+
+namespace
+{
+
+/// Name of default tile set in resource cache.
+static const String defaultTileSetName = "BlueNoiseTileSet/Default.bnts";
+/// Number of corner colors of default tile set.
+static const unsigned defaultNumColors = 2;
+/// Min distance of default tile set.
+static const float defaultMinDistance = 0.02f;
+/// Max number of corner colors.
+static const unsigned maxNumColors = 4;
+/// Number of dart throws per area of min distance square.
+static const float dartThrowsPerArea = 30.0f;
+/// Scale of quantized point coordinates.
+static const float quantizationScale = 65536.0f;
+/// Beginning of dart thrower domain around the tile.
+static const float dartDomainBegin = -0.5f;
+/// Size of dart thrower domain around the tile.
+static const float dartDomainSize = 2.0f;
+
+/// Return well-mixed hash of corner coordinates.
+unsigned HashCorner(int x, int y, unsigned seed)
+{
+    unsigned hash = seed ^ (static_cast<unsigned>(x) * 0x8da6b343u) ^ (static_cast<unsigned>(y) * 0xd8163841u);
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+/// Dart thrower that keeps min distance between all points in rectangle [-0.5, 1.5] around the tile.
+class DartThrower
+{
+public:
+    /// Construct.
+    DartThrower(float minDistance, StandardRandom& random)
+        : random_(random)
+        , minDistanceSquared_(minDistance * minDistance)
+        , gridSize_(CeilToInt(dartDomainSize * Sqrt(2.0f) / minDistance))
+        , radius_(CeilToInt(minDistance * gridSize_ / dartDomainSize))
+    {
+        grid_.Resize(static_cast<unsigned>(gridSize_ * gridSize_));
+        for (int& index : grid_)
+            index = -1;
+    }
+
+    /// Add point with offset without test.
+    void AddPoints(const PointCloud2DNorm& points, const Vector2& offset)
+    {
+        for (const Vector2& point : points)
+            AddPoint(point + offset);
+    }
+
+    /// Throw darts into rectangle and return accepted points that pass region test.
+    template <class T>
+    PointCloud2DNorm Throw(const Vector2& begin, const Vector2& end, T isInRegion)
+    {
+        const Vector2 size = end - begin;
+        const unsigned numThrows = static_cast<unsigned>(dartThrowsPerArea * size.x_ * size.y_ / minDistanceSquared_);
+        PointCloud2DNorm result;
+        for (unsigned i = 0; i < numThrows; ++i)
+        {
+            const Vector2 point = begin + size * Vector2(random_.FloatFrom01(), random_.FloatFrom01());
+            if (!isInRegion(point) || HasNeighbour(point))
+                continue;
+
+            AddPoint(point);
+            result.Push(point);
+        }
+        return result;
+    }
+
+    /// Return all points.
+    const PointCloud2DNorm& GetPoints() const { return points_; }
+
+private:
+    /// Return grid cell of point.
+    IntVector2 GetCell(const Vector2& point) const
+    {
+        return IntVector2(
+            Clamp(FloorToInt((point.x_ - dartDomainBegin) / dartDomainSize * gridSize_), 0, gridSize_ - 1),
+            Clamp(FloorToInt((point.y_ - dartDomainBegin) / dartDomainSize * gridSize_), 0, gridSize_ - 1));
+    }
+    /// Add point.
+    void AddPoint(const Vector2& point)
+    {
+        const IntVector2 cell = GetCell(point);
+        grid_[cell.y_ * gridSize_ + cell.x_] = static_cast<int>(points_.Size());
+        points_.Push(point);
+    }
+    /// Return whether the point has neighbour closer than min distance.
+    bool HasNeighbour(const Vector2& point) const
+    {
+        const IntVector2 cell = GetCell(point);
+        for (int y = Max(0, cell.y_ - radius_); y <= Min(gridSize_ - 1, cell.y_ + radius_); ++y)
+        {
+            for (int x = Max(0, cell.x_ - radius_); x <= Min(gridSize_ - 1, cell.x_ + radius_); ++x)
+            {
+                const int index = grid_[y * gridSize_ + x];
+                if (index >= 0 && (points_[index] - point).LengthSquared() < minDistanceSquared_)
+                    return true;
+            }
+        }
+        return false;
+    }
+
+    /// Random generator.
+    StandardRandom& random_;
+    /// Squared min distance.
+    float minDistanceSquared_;
+    /// Number of grid cells along side.
+    int gridSize_;
+    /// Radius of scanned neighbourhood in cells.
+    int radius_;
+    /// Grid of point indices.
+    PODVector<int> grid_;
+    /// Points.
+    PointCloud2DNorm points_;
+};
+
+}
+
+BlueNoiseTileSet::BlueNoiseTileSet(Context* context)
+    : Resource(context)
+{
+}
+
+BlueNoiseTileSet::~BlueNoiseTileSet()
+{
+}
+
+void BlueNoiseTileSet::RegisterObject(Context* context)
+{
+    context->RegisterFactory<BlueNoiseTileSet>(FLEXENGINE_CATEGORY);
+}
+
+SharedPtr<BlueNoiseTileSet> BlueNoiseTileSet::GetDefault(Context* context)
+{
+    ResourceCache* cache = context->GetSubsystem<ResourceCache>();
+    SharedPtr<BlueNoiseTileSet> tileSet(cache->GetResource<BlueNoiseTileSet>(defaultTileSetName, false));
+    if (!tileSet)
+    {
+        // Dart throwing takes a while, so the tile set shall be baked
+        URHO3D_LOGWARNING("Baked tile set " + defaultTileSetName + " is not found and is generated at runtime");
+        tileSet = MakeShared<BlueNoiseTileSet>(context);
+        tileSet->SetName(defaultTileSetName);
+        tileSet->Generate(defaultNumColors, defaultMinDistance);
+        cache->AddManualResource(tileSet);
+    }
+    return tileSet;
+}
+
+bool BlueNoiseTileSet::BakeDefault(Context* context, const String& fileName)
+{
+    SharedPtr<BlueNoiseTileSet> tileSet = MakeShared<BlueNoiseTileSet>(context);
+    tileSet->Generate(defaultNumColors, defaultMinDistance);
+
+    File file(context, fileName, FILE_WRITE);
+    if (!file.IsOpen() || !tileSet->Save(file))
+    {
+        URHO3D_LOGERROR("Cannot save tile set " + fileName);
+        return false;
+    }
+    return true;
+}
+
+bool BlueNoiseTileSet::BeginLoad(Deserializer& source)
+{
+    if (source.ReadFileID() != "BNTS")
+    {
+        URHO3D_LOGERROR(source.GetName() + " is not a valid blue noise tile set file");
+        return false;
+    }
+
+    numColors_ = source.ReadUInt();
+    minDistance_ = source.ReadFloat();
+    seed_ = source.ReadUInt();
+    if (numColors_ == 0 || numColors_ > maxNumColors)
+    {
+        URHO3D_LOGERROR(source.GetName() + " has invalid number of colors");
+        return false;
+    }
+
+    const unsigned numTiles = numColors_ * numColors_ * numColors_ * numColors_;
+    tiles_.Resize(numTiles);
+    PointCloud2DNorm points;
+    for (PointCloud2DIndex& tile : tiles_)
+    {
+        points.Resize(source.ReadVLE());
+        for (Vector2& point : points)
+        {
+            point.x_ = source.ReadUShort() / quantizationScale;
+            point.y_ = source.ReadUShort() / quantizationScale;
+        }
+        tile.build(points);
+    }
+
+    UpdateMemoryUse();
+    return true;
+}
+
+bool BlueNoiseTileSet::Save(Serializer& dest) const
+{
+    dest.WriteFileID("BNTS");
+    dest.WriteUInt(numColors_);
+    dest.WriteFloat(minDistance_);
+    dest.WriteUInt(seed_);
+    for (const PointCloud2DIndex& tile : tiles_)
+    {
+        const PointCloud2DNorm points = tile.sourcePoints();
+        dest.WriteVLE(points.Size());
+        for (const Vector2& point : points)
+        {
+            dest.WriteUShort(static_cast<unsigned short>(Min(65535, FloorToInt(point.x_ * quantizationScale))));
+            dest.WriteUShort(static_cast<unsigned short>(Min(65535, FloorToInt(point.y_ * quantizationScale))));
+        }
+    }
+    return true;
+}
+
+void BlueNoiseTileSet::Generate(unsigned numColors, float minDistance, unsigned seed)
+{
+    numColors_ = Clamp(numColors, 1u, maxNumColors);
+    minDistance_ = Clamp(minDistance, 0.005f, 0.1f);
+    seed_ = seed;
+
+    // Tile consists of corner squares, edge strips and interior.
+    // Points of corners and edges are shared by adjacent tiles. Interior is at least half strip away from tile border.
+    const float halfStrip = minDistance_;
+    const float halfCorner = 2 * minDistance_;
+    StandardRandom random(seed);
+
+    // Generate corner squares
+    Vector<PointCloud2DNorm> corners(numColors_);
+    for (unsigned color = 0; color < numColors_; ++color)
+    {
+        DartThrower thrower(minDistance_, random);
+        corners[color] = thrower.Throw(Vector2(-halfCorner, -halfCorner), Vector2(halfCorner, halfCorner),
+            [](const Vector2&) { return true; });
+    }
+
+    // Generate horizontal and vertical edge strips for each pair of corners
+    Vector<PointCloud2DNorm> horizontalEdges(numColors_ * numColors_);
+    Vector<PointCloud2DNorm> verticalEdges(numColors_ * numColors_);
+    for (unsigned first = 0; first < numColors_; ++first)
+    {
+        for (unsigned second = 0; second < numColors_; ++second)
+        {
+            const auto isInStrip = [](const Vector2&) { return true; };
+
+            DartThrower horizontalThrower(minDistance_, random);
+            horizontalThrower.AddPoints(corners[first], Vector2(0.0f, 0.0f));
+            horizontalThrower.AddPoints(corners[second], Vector2(1.0f, 0.0f));
+            horizontalEdges[first * numColors_ + second] = horizontalThrower.Throw(
+                Vector2(halfCorner, -halfStrip), Vector2(1.0f - halfCorner, halfStrip), isInStrip);
+
+            DartThrower verticalThrower(minDistance_, random);
+            verticalThrower.AddPoints(corners[first], Vector2(0.0f, 0.0f));
+            verticalThrower.AddPoints(corners[second], Vector2(0.0f, 1.0f));
+            verticalEdges[first * numColors_ + second] = verticalThrower.Throw(
+                Vector2(-halfStrip, halfCorner), Vector2(halfStrip, 1.0f - halfCorner), isInStrip);
+        }
+    }
+
+    // Generate tile interiors
+    const unsigned numTiles = numColors_ * numColors_ * numColors_ * numColors_;
+    tiles_.Resize(numTiles);
+    for (unsigned tileIndex = 0; tileIndex < numTiles; ++tileIndex)
+    {
+        const unsigned color00 = tileIndex % numColors_;
+        const unsigned color10 = tileIndex / numColors_ % numColors_;
+        const unsigned color01 = tileIndex / (numColors_ * numColors_) % numColors_;
+        const unsigned color11 = tileIndex / (numColors_ * numColors_ * numColors_);
+
+        DartThrower thrower(minDistance_, random);
+        thrower.AddPoints(corners[color00], Vector2(0.0f, 0.0f));
+        thrower.AddPoints(corners[color10], Vector2(1.0f, 0.0f));
+        thrower.AddPoints(corners[color01], Vector2(0.0f, 1.0f));
+        thrower.AddPoints(corners[color11], Vector2(1.0f, 1.0f));
+        thrower.AddPoints(horizontalEdges[color00 * numColors_ + color10], Vector2(0.0f, 0.0f));
+        thrower.AddPoints(horizontalEdges[color01 * numColors_ + color11], Vector2(0.0f, 1.0f));
+        thrower.AddPoints(verticalEdges[color00 * numColors_ + color01], Vector2(0.0f, 0.0f));
+        thrower.AddPoints(verticalEdges[color10 * numColors_ + color11], Vector2(1.0f, 0.0f));
+        thrower.Throw(Vector2::ZERO, Vector2::ONE, [=](const Vector2& point)
+        {
+            const Vector2 distanceToBorder = VectorMin(point, Vector2::ONE - point);
+            return distanceToBorder.x_ >= halfStrip && distanceToBorder.y_ >= halfStrip
+                && (distanceToBorder.x_ >= halfCorner || distanceToBorder.y_ >= halfCorner);
+        });
+
+        // Take points inside of the tile and shuffle them, so point index is random rank
+        PointCloud2DNorm points;
+        for (const Vector2& point : thrower.GetPoints())
+        {
+            if (point.x_ >= 0.0f && point.y_ >= 0.0f && point.x_ < 1.0f && point.y_ < 1.0f)
+                points.Push(point);
+        }
+        for (unsigned i = points.Size(); i > 1; --i)
+            Swap(points[i - 1], points[random.IntegerFromRange(0, i - 1)]);
+
+        tiles_[tileIndex].build(points);
+    }
+
+    UpdateMemoryUse();
+}
+
+unsigned BlueNoiseTileSet::GetTileIndex(int x, int y) const
+{
+    const unsigned color00 = GetCornerColor(x, y);
+    const unsigned color10 = GetCornerColor(x + 1, y);
+    const unsigned color01 = GetCornerColor(x, y + 1);
+    const unsigned color11 = GetCornerColor(x + 1, y + 1);
+    return color00 + numColors_ * (color10 + numColors_ * (color01 + numColors_ * color11));
+}
+
+PointCloud2D BlueNoiseTileSet::Sample(const Vector2& begin, const Vector2& end, float scale, PODVector<unsigned>* sourceIndices) const
+{
+    PointCloud2D dest;
+    if (sourceIndices)
+        sourceIndices->Clear();
+    if (tiles_.Empty())
+        return dest;
+
+    // Reserve expected number of points
+    const Vector2 size = VectorMax(Vector2::ZERO, end - begin) / scale;
+    const unsigned expectedSize = static_cast<unsigned>(size.x_ * size.y_ * numPoints_ / tiles_.Size() * 1.1f) + 16;
+    dest.Reserve(expectedSize);
+    if (sourceIndices)
+        sourceIndices->Reserve(expectedSize);
+
+    const Vector2 from = VectorFloor(begin / scale);
+    const Vector2 to = VectorCeil(end / scale);
+    for (float nx = from.x_; nx <= to.x_; ++nx)
+    {
+        for (float ny = from.y_; ny <= to.y_; ++ny)
+        {
+            const Vector2 tileBegin = Vector2(nx, ny);
+            const Vector2 tileEnd = Vector2(nx + 1, ny + 1);
+            const Vector2 clipBegin = VectorMax(begin / scale, VectorMin(end / scale, tileBegin));
+            const Vector2 clipEnd = VectorMax(begin / scale, VectorMin(end / scale, tileEnd));
+            const PointCloud2DIndex& tile = tiles_[GetTileIndex(static_cast<int>(nx), static_cast<int>(ny))];
+            tile.query(clipBegin - tileBegin, clipEnd - tileBegin, tileBegin, scale, dest, sourceIndices);
+        }
+    }
+    return dest;
+}
+
+unsigned BlueNoiseTileSet::GetCornerColor(int x, int y) const
+{
+    return HashCorner(x, y, seed_) % numColors_;
+}
+
+void BlueNoiseTileSet::UpdateMemoryUse()
+{
+    numPoints_ = 0;
+    for (const PointCloud2DIndex& tile : tiles_)
+        numPoints_ += tile.size();
+    SetMemoryUse(sizeof(BlueNoiseTileSet) + numPoints_ * (sizeof(Vector2) + sizeof(unsigned)));
+}
+
+}
@@ -0,0 +1,70 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+#include <FlexEngine/Math/PoissonRandom.h>
+
+#include <Urho3D/Resource/Resource.h>
+
+namespace FlexEngine
+{
+
+/// Set of corner-compatible blue noise tiles.
+/// Each tile corner has one of several colors. Tiles with equal corner colors share points along the border, so any combination
+/// of tiles keeps min distance between points. Tiling is chosen by hash of corner coordinates and is deterministic and aperiodic.
+class BlueNoiseTileSet : public Resource
+{
+    URHO3D_OBJECT(BlueNoiseTileSet, Resource);
+
+public:
+    /// Construct.
+    BlueNoiseTileSet(Context* context);
+    /// Destruct.
+    virtual ~BlueNoiseTileSet();
+    /// Register object factory.
+    static void RegisterObject(Context* context);
+    /// Return default tile set. Baked tile set is loaded from resource cache, it's generated at runtime only if missing.
+    static SharedPtr<BlueNoiseTileSet> GetDefault(Context* context);
+    /// Generate default tile set and save it to file. Return true if successful.
+    static bool BakeDefault(Context* context, const String& fileName);
+
+    /// Load resource from stream. May be called from a worker thread. Return true if successful.
+    virtual bool BeginLoad(Deserializer& source) override;
+    /// Save resource. Return true if successful.
+    virtual bool Save(Serializer& dest) const override;
+
+    /// Generate tiles. Min distance is relative to tile size.
+    void Generate(unsigned numColors, float minDistance, unsigned seed = 0);
+    /// Return number of corner colors.
+    unsigned GetNumColors() const { return numColors_; }
+    /// Return min distance between points relative to tile size.
+    float GetMinDistance() const { return minDistance_; }
+    /// Return number of tiles.
+    unsigned GetNumTiles() const { return tiles_.Size(); }
+    /// Return points of tile normalized to [0, 1]. Index of point is random rank of its importance.
+    const PointCloud2DIndex& GetTile(unsigned index) const { return tiles_[index]; }
+    /// Return index of tile at integer tile coordinates.
+    unsigned GetTileIndex(int x, int y) const;
+
+    /// Sample points in range [begin, end], tile size is equal to scale.
+    /// @param sourceIndices Optional output of point index in tile for each sampled point
+    PointCloud2D Sample(const Vector2& begin, const Vector2& end, float scale, PODVector<unsigned>* sourceIndices = nullptr) const;
+
+private:
+    /// Return color of corner at integer coordinates.
+    unsigned GetCornerColor(int x, int y) const;
+    /// Update memory use.
+    void UpdateMemoryUse();
+
+    /// Number of corner colors.
+    unsigned numColors_ = 0;
+    /// Min distance between points relative to tile size.
+    float minDistance_ = 1.0f;
+    /// Seed of tiling.
+    unsigned seed_ = 0;
+    /// Tiles indexed by corner colors.
+    Vector<PointCloud2DIndex> tiles_;
+    /// Total number of points in tiles.
+    unsigned numPoints_ = 0;
+};
+
+}
@@ -2,9 +2,120 @@
 
 #include <Urho3D/Math/BoundingBox.h>
 
+#include <cstring>
+
 namespace FlexEngine
 {
 
+namespace
+{
+
+static const unsigned long long prime64_1 = 11400714785074694791ull;
+static const unsigned long long prime64_2 = 14029467366897019727ull;
+static const unsigned long long prime64_3 = 1609587929392839161ull;
+static const unsigned long long prime64_4 = 9650029242287828579ull;
+static const unsigned long long prime64_5 = 2870177450012600261ull;
+
+/// Rotate 64-bit integer left.
+inline unsigned long long RotateLeft64(unsigned long long value, unsigned count)
+{
+    return (value << count) | (value >> (64 - count));
+}
+
+/// Read unaligned 64-bit integer.
+inline unsigned long long Read64(const unsigned char* data)
+{
+    unsigned long long value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/// Read unaligned 32-bit integer.
+inline unsigned Read32(const unsigned char* data)
+{
+    unsigned value;
+    memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+/// Process one lane of stripe.
+inline unsigned long long Round64(unsigned long long accumulator, unsigned long long input)
+{
+    accumulator += input * prime64_2;
+    accumulator = RotateLeft64(accumulator, 31);
+    return accumulator * prime64_1;
+}
+
+/// Merge lane accumulator into hash.
+inline unsigned long long MergeRound64(unsigned long long hash, unsigned long long accumulator)
+{
+    hash ^= Round64(0, accumulator);
+    return hash * prime64_1 + prime64_4;
+}
+
+}
+
+unsigned long long HashMemory64(const void* data, unsigned size, unsigned long long seed)
+{
+    const unsigned char* ptr = static_cast<const unsigned char*>(data);
+    const unsigned char* end = ptr + size;
+    unsigned long long hash = 0;
+
+    // Four independent lanes over 32-byte stripes
+    if (size >= 32)
+    {
+        unsigned long long v1 = seed + prime64_1 + prime64_2;
+        unsigned long long v2 = seed + prime64_2;
+        unsigned long long v3 = seed;
+        unsigned long long v4 = seed - prime64_1;
+        const unsigned char* limit = end - 32;
+        do
+        {
+            v1 = Round64(v1, Read64(ptr));
+            v2 = Round64(v2, Read64(ptr + 8));
+            v3 = Round64(v3, Read64(ptr + 16));
+            v4 = Round64(v4, Read64(ptr + 24));
+            ptr += 32;
+        } while (ptr <= limit);
+
+        hash = RotateLeft64(v1, 1) + RotateLeft64(v2, 7) + RotateLeft64(v3, 12) + RotateLeft64(v4, 18);
+        hash = MergeRound64(hash, v1);
+        hash = MergeRound64(hash, v2);
+        hash = MergeRound64(hash, v3);
+        hash = MergeRound64(hash, v4);
+    }
+    else
+        hash = seed + prime64_5;
+
+    hash += size;
+
+    // Tail
+    for (; ptr + 8 <= end; ptr += 8)
+    {
+        hash ^= Round64(0, Read64(ptr));
+        hash = RotateLeft64(hash, 27) * prime64_1 + prime64_4;
+    }
+    if (ptr + 4 <= end)
+    {
+        hash ^= Read32(ptr) * prime64_1;
+        hash = RotateLeft64(hash, 23) * prime64_2 + prime64_3;
+        ptr += 4;
+    }
+    for (; ptr < end; ++ptr)
+    {
+        hash ^= *ptr * prime64_5;
+        hash = RotateLeft64(hash, 11) * prime64_1;
+    }
+
+    // Avalanche
+    hash ^= hash >> 33;
+    hash *= prime64_2;
+    hash ^= hash >> 29;
+    hash *= prime64_3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
 Hash::Hash(unsigned long long hash /*= 0*/)
     : hash_(hash)
 {
@@ -138,15 +249,13 @@ void Hash::HashString(const String& value)
 
 void Hash::HashBuffer(const PODVector<unsigned char>& buffer)
 {
-    const unsigned* blocks = reinterpret_cast<const unsigned*>(buffer.Buffer());
-    for (unsigned i = 0; i < buffer.Size() / 4; ++i)
-        HashUInt(blocks[i]);
+    HashData(buffer.Buffer(), buffer.Size());
+}
 
-    const unsigned tailStart = buffer.Size() / 4 * 4;
-    unsigned tail = 0;
-    for (unsigned i = tailStart; i < buffer.Size(); ++i)
-        tail |= buffer[i] << (8 * (i - tailStart));
-    HashUInt(tail);
+void Hash::HashData(const void* data, unsigned size)
+{
+    HashUInt(size);
+    HashUInt64(HashMemory64(data, size));
 }
 
 void Hash::HashResourceRef(const ResourceRef& value)
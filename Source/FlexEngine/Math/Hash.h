@@ -14,6 +14,9 @@ class BoundingBox;
 namespace FlexEngine
 {
 
+/// Compute 64-bit hash of raw memory range. Uses XXH64 algorithm.
+unsigned long long HashMemory64(const void* data, unsigned size, unsigned long long seed = 0);
+
 /// Hash generator.
 class Hash
 {
@@ -67,8 +70,10 @@ public:
     void HashBoundingBox(const BoundingBox& value);
     /// Hash a null-terminated string.
     void HashString(const String& value);
-    /// Hash a buffer, with size encoded as VLE.
+    /// Hash a buffer.
     void HashBuffer(const PODVector<unsigned char>& buffer);
+    /// Hash raw memory range. Fast for large ranges.
+    void HashData(const void* data, unsigned size);
     /// Hash a resource reference.
     void HashResourceRef(const ResourceRef& value);
     /// Hash a resource reference list.
@@ -9,17 +9,19 @@ namespace FlexEngine
 
 struct PoissonRandom::Core
 {
-    Core(unsigned seed) : m_generator(seed), m_distr(0.0, 1.0) {}
+    Core(unsigned seed) : m_generator(seed), m_distr(0.0f, 1.0f) {}
     std::mt19937 m_generator;
-    std::uniform_real_distribution<> m_distr;
+    std::uniform_real_distribution<float> m_distr;
 };
 
 // Point Cloud
 PointCloud2D samplePointCloud(const PointCloud2DNorm& cloud,
     const Vector2& begin, const Vector2& end,
-    float scale)
+    float scale, PODVector<unsigned>* sourceIndices)
 {
     PointCloud2D dest;
+    if (sourceIndices)
+        sourceIndices->Clear();
     const Vector2 from = VectorFloor(begin / scale);
     const Vector2 to = VectorCeil(end / scale);
     for (float nx = from.x_; nx <= to.x_; ++nx)
@@ -30,13 +32,16 @@ PointCloud2D samplePointCloud(const PointCloud2DNorm& cloud,
             const Vector2 tileEnd = Vector2(nx + 1, ny + 1);
             const Vector2 clipBegin = VectorMax(begin / scale, VectorMin(end / scale, tileBegin));
             const Vector2 clipEnd = VectorMax(begin / scale, VectorMin(end / scale, tileEnd));
-            for (const Vector2& sourcePoint : cloud)
+            for (unsigned i = 0; i < cloud.Size(); ++i)
             {
+                const Vector2& sourcePoint = cloud[i];
                 const Vector2 point = VectorLerp(tileBegin, tileEnd, static_cast<Vector2>(sourcePoint));
                 if (point.x_ < clipBegin.x_ || point.y_ < clipBegin.y_ || point.x_ > clipEnd.x_ || point.y_ > clipEnd.y_)
                     continue;
 
                 dest.Push(point * scale);
+                if (sourceIndices)
+                    sourceIndices->Push(i);
             }
         }
     }
@@ -44,6 +49,107 @@ PointCloud2D samplePointCloud(const PointCloud2DNorm& cloud,
 }
 
 
+// Point Cloud Index
+PointCloud2DIndex::PointCloud2DIndex(const PointCloud2DNorm& cloud, unsigned pointsPerBin)
+{
+    build(cloud, pointsPerBin);
+}
+void PointCloud2DIndex::build(const PointCloud2DNorm& cloud, unsigned pointsPerBin)
+{
+    gridSize_ = Max(1, static_cast<int>(sqrt(static_cast<float>(cloud.Size()) / Max(1u, pointsPerBin))));
+    const unsigned numBins = static_cast<unsigned>(gridSize_ * gridSize_);
+
+    // Count points per bin
+    PODVector<unsigned> bins(cloud.Size());
+    binOffsets_.Resize(numBins + 1);
+    for (unsigned& offset : binOffsets_)
+        offset = 0;
+    for (unsigned i = 0; i < cloud.Size(); ++i)
+    {
+        bins[i] = static_cast<unsigned>(binOf(cloud[i].y_) * gridSize_ + binOf(cloud[i].x_));
+        ++binOffsets_[bins[i] + 1];
+    }
+    for (unsigned i = 0; i < numBins; ++i)
+        binOffsets_[i + 1] += binOffsets_[i];
+
+    // Scatter points, source order is kept within bin
+    PODVector<unsigned> cursors(binOffsets_.Buffer(), numBins);
+    points_.Resize(cloud.Size());
+    sourceIndices_.Resize(cloud.Size());
+    for (unsigned i = 0; i < cloud.Size(); ++i)
+    {
+        const unsigned dest = cursors[bins[i]]++;
+        points_[dest] = cloud[i];
+        sourceIndices_[dest] = i;
+    }
+}
+PointCloud2DNorm PointCloud2DIndex::sourcePoints() const
+{
+    PointCloud2DNorm result(points_.Size());
+    for (unsigned i = 0; i < points_.Size(); ++i)
+        result[sourceIndices_[i]] = points_[i];
+    return result;
+}
+void PointCloud2DIndex::query(const Vector2& begin, const Vector2& end, const Vector2& offset, float scale,
+    PointCloud2D& dest, PODVector<unsigned>* sourceIndices) const
+{
+    if (points_.Empty() || begin.x_ > end.x_ || begin.y_ > end.y_)
+        return;
+
+    const int fromX = binOf(begin.x_);
+    const int fromY = binOf(begin.y_);
+    const int toX = binOf(end.x_);
+    const int toY = binOf(end.y_);
+    for (int by = fromY; by <= toY; ++by)
+    {
+        for (int bx = fromX; bx <= toX; ++bx)
+        {
+            // Inner bins are covered entirely, but the test is cheaper than branching
+            const unsigned bin = static_cast<unsigned>(by * gridSize_ + bx);
+            for (unsigned i = binOffsets_[bin]; i < binOffsets_[bin + 1]; ++i)
+            {
+                const Vector2& point = points_[i];
+                if (point.x_ < begin.x_ || point.y_ < begin.y_ || point.x_ > end.x_ || point.y_ > end.y_)
+                    continue;
+
+                dest.Push((offset + point) * scale);
+                if (sourceIndices)
+                    sourceIndices->Push(sourceIndices_[i]);
+            }
+        }
+    }
+}
+PointCloud2D samplePointCloud(const PointCloud2DIndex& index,
+    const Vector2& begin, const Vector2& end,
+    float scale, PODVector<unsigned>* sourceIndices)
+{
+    PointCloud2D dest;
+    if (sourceIndices)
+        sourceIndices->Clear();
+
+    // Reserve expected number of points
+    const Vector2 size = VectorMax(Vector2::ZERO, end - begin) / scale;
+    const unsigned expectedSize = static_cast<unsigned>(size.x_ * size.y_ * index.size() * 1.1f) + 16;
+    dest.Reserve(expectedSize);
+    if (sourceIndices)
+        sourceIndices->Reserve(expectedSize);
+
+    const Vector2 from = VectorFloor(begin / scale);
+    const Vector2 to = VectorCeil(end / scale);
+    for (float nx = from.x_; nx <= to.x_; ++nx)
+    {
+        for (float ny = from.y_; ny <= to.y_; ++ny)
+        {
+            const Vector2 tileBegin = Vector2(nx, ny);
+            const Vector2 tileEnd = Vector2(nx + 1, ny + 1);
+            const Vector2 clipBegin = VectorMax(begin / scale, VectorMin(end / scale, tileBegin));
+            const Vector2 clipEnd = VectorMax(begin / scale, VectorMin(end / scale, tileEnd));
+            index.query(clipBegin - tileBegin, clipEnd - tileBegin, tileBegin, scale, dest, sourceIndices);
+        }
+    }
+    return dest;
+}
+
 // Ctor
 PoissonRandom::PoissonRandom(unsigned seed)
     : impl_(MakeUnique<Core>(seed))
@@ -52,74 +158,65 @@ PoissonRandom::PoissonRandom(unsigned seed)
 PoissonRandom::~PoissonRandom()
 {
 }
+void PoissonRandom::reset(unsigned seed)
+{
+    impl_->m_generator.seed(seed);
+    impl_->m_distr.reset();
+}
 
 
 // Generator
-struct PoissonRandom::Cell
-    : public Vector2
-{
-    bool isValid = false;
-};
 float PoissonRandom::randomFloat()
 {
-    return static_cast<float>(impl_->m_distr(impl_->m_generator));
-}
-IntVector2 PoissonRandom::imageToGrid(const Vector2& p, float cellSize)
-{
-    return IntVector2(static_cast<int>(p.x_ / cellSize), static_cast<int>(p.y_ / cellSize));
-
+    return impl_->m_distr(impl_->m_generator);
 }
 struct PoissonRandom::Grid
 {
-    Grid(const int w, const int h, const float cellSize)
-        : m_width(w)
-        , m_height(h)
-        , m_cellSize(cellSize)
+    Grid(const float minDist)
+        : m_size(Max(1, static_cast<int>(ceil(sqrt(2.0f) / minDist))))
+        , m_radius(Max(1, static_cast<int>(ceil(minDist * m_size))))
+        , m_minDistSquared(minDist * minDist)
     {
-        m_grid.Resize(m_height);
-
-        for (auto i = m_grid.Begin(); i != m_grid.End(); i++)
-        {
-            i->Resize(m_width);
-        }
+        // Cells tile [0, 1] exactly and are small enough to hold one point at most
+        m_grid.Resize(m_size * m_size);
+        for (int& index : m_grid)
+            index = -1;
     }
-    void insert(const Vector2& p)
+    int cellIndex(int x, int y) const
     {
-        IntVector2 g = imageToGrid(p, m_cellSize);
-        Cell& c = m_grid[g.x_][g.y_];
-
-        c.x_ = p.x_;
-        c.y_ = p.y_;
-        c.isValid = true;
+        x %= m_size;
+        y %= m_size;
+        return (y < 0 ? y + m_size : y) * m_size + (x < 0 ? x + m_size : x);
     }
-    bool isInNeighbourhood(const Vector2& point, const float minDist, const float cellSize)
+    IntVector2 imageToGrid(const Vector2& p) const
     {
-        IntVector2 g = imageToGrid(point, cellSize);
-
-        // Number of adjucent cells to look for neighbour points
-        const int d = 5;
+        return IntVector2(Min(static_cast<int>(p.x_ * m_size), m_size - 1), Min(static_cast<int>(p.y_ * m_size), m_size - 1));
+    }
+    void insert(const Vector2& p, int index)
+    {
+        const IntVector2 g = imageToGrid(p);
+        m_grid[cellIndex(g.x_, g.y_)] = index;
+    }
+    bool isInNeighbourhood(const Vector2& point, const PointCloud2DNorm& points) const
+    {
+        const IntVector2 g = imageToGrid(point);
 
-        // Scan the neighbourhood of the point in the grid
-        for (int i = g.x_ - d; i < g.x_ + d; i++)
+        // Scan the neighbourhood of the point in the grid, 5x5 cells for small distances
+        for (int j = g.y_ - m_radius; j <= g.y_ + m_radius; ++j)
         {
-            for (int j = g.y_ - d; j < g.y_ + d; j++)
+            for (int i = g.x_ - m_radius; i <= g.x_ + m_radius; ++i)
             {
-                // Wrap cells
-                int wi = i;
-                int wj = j;
-                while (wi < 0) wi += m_width;
-                while (wj < 0) wj += m_height;
-                wi %= m_width;
-                wj %= m_height;
-
-                // Test wrapped distances
-                Cell p = m_grid[wi][wj];
-                const float dist = Min(Min((p - point).Length(),
-                                           (p + Vector2(1, 0) - point).Length()),
-                                       Min((p + Vector2(0, 1) - point).Length(),
-                                           (p + Vector2(1, 1) - point).Length()));
-
-                if (p.isValid && dist < minDist)
+                const int index = m_grid[cellIndex(i, j)];
+                if (index < 0)
+                    continue;
+
+                // Test wrapped distance
+                const Vector2& p = points[index];
+                float dx = Abs(p.x_ - point.x_);
+                float dy = Abs(p.y_ - point.y_);
+                dx = Min(dx, 1.0f - dx);
+                dy = Min(dy, 1.0f - dy);
+                if (dx * dx + dy * dy < m_minDistSquared)
                     return true;
             }
         }
@@ -127,18 +224,19 @@ struct PoissonRandom::Grid
     }
 
 private:
-    int m_width;
-    int m_height;
-    float m_cellSize;
+    int m_size;
+    int m_radius;
+    float m_minDistSquared;
 
-    Vector<Vector<Cell>> m_grid;
+    PODVector<int> m_grid;
 };
 Vector2 PoissonRandom::popRandom(PointCloud2DNorm& points)
 {
-    std::uniform_int_distribution<> dis(0, points.Size() - 1);
-    const int idx = dis(impl_->m_generator);
+    std::uniform_int_distribution<unsigned> dis(0, points.Size() - 1);
+    const unsigned idx = dis(impl_->m_generator);
     const Vector2 p = points[idx];
-    points.Erase(points.Begin() + idx);
+    points[idx] = points.Back();
+    points.Pop();
     return p;
 }
 Vector2 PoissonRandom::generateRandomPointAround(const Vector2& p, float minDist)
@@ -153,11 +251,11 @@ Vector2 PoissonRandom::generateRandomPointAround(const Vector2& p, float minDist
     // Random angle
     const float angle = 2 * 3.141592653589f * r2;
 
-    // The new point is generated around the point (x, y)
+    // The new point is generated around the point (x, y) and wrapped to [0, 1)
     const float x = p.x_ + radius * cos(angle);
     const float y = p.y_ + radius * sin(angle);
 
-    return Vector2(x, y);
+    return Vector2(x - floor(x), y - floor(y));
 }
 
 
@@ -166,14 +264,10 @@ PointCloud2DNorm PoissonRandom::generate(const float minDist, const unsigned new
 {
     PointCloud2DNorm samplePoints;
     PointCloud2DNorm processList;
+    samplePoints.Reserve(numPoints);
 
     // Create the grid
-    const float cellSize = minDist / sqrt(2.0f);
-
-    const int gridW = static_cast<int>(ceil(1.0f / cellSize));
-    const int gridH = static_cast<int>(ceil(1.0f / cellSize));
-
-    Grid grid(gridW, gridH, cellSize);
+    Grid grid(minDist);
 
     Vector2 firstPoint;
     firstPoint.x_ = randomFloat();
@@ -182,26 +276,21 @@ PointCloud2DNorm PoissonRandom::generate(const float minDist, const unsigned new
     // Update containers
     processList.Push(firstPoint);
     samplePoints.Push(firstPoint);
-    grid.insert(firstPoint);
+    grid.insert(firstPoint, 0);
 
     // Generate new points for each point in the queue
     while (!processList.Empty() && samplePoints.Size() < numPoints)
     {
         const Vector2 point = popRandom(processList);
 
-        for (unsigned i = 0; i < newPointsCount; i++)
+        for (unsigned i = 0; i < newPointsCount && samplePoints.Size() < numPoints; i++)
         {
             const Vector2 newPoint = generateRandomPointAround(point, minDist);
-
-            // Test
-            const bool fits = newPoint.x_ >= 0 && newPoint.y_ >= 0 && newPoint.x_ <= 1 && newPoint.y_ <= 1;
-
-            if (fits && !grid.isInNeighbourhood(newPoint, minDist, cellSize))
+            if (!grid.isInNeighbourhood(newPoint, samplePoints))
             {
+                grid.insert(newPoint, static_cast<int>(samplePoints.Size()));
                 processList.Push(newPoint);
                 samplePoints.Push(newPoint);
-                grid.insert(newPoint);
-                continue;
             }
         }
     }
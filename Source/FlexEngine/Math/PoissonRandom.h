@@ -15,10 +15,50 @@ using PointCloud2D = PODVector<Vector2>;
 using PointCloud2DNorm = PODVector<Vector2>;
 /// @brief Sample Point Cloud
 /// @pre @a cloud should be normalized to [0, 1] range
+/// @param sourceIndices Optional output of source point index for each sampled point
 PointCloud2D samplePointCloud(const PointCloud2DNorm& cloud,
     const Vector2& begin, const Vector2& end,
-    float scale);
+    float scale, PODVector<unsigned>* sourceIndices = nullptr);
+/// @brief Point Cloud 2D spatial index
+/// @note Points of normalized cloud are sorted into uniform grid of bins, so range query visits overlapped bins only
+class PointCloud2DIndex
+{
+public:
+    /// @brief Ctor
+    PointCloud2DIndex() = default;
+    /// @brief Ctor from normalized cloud
+    explicit PointCloud2DIndex(const PointCloud2DNorm& cloud, unsigned pointsPerBin = 8);
+    /// @brief Build index for normalized cloud
+    void build(const PointCloud2DNorm& cloud, unsigned pointsPerBin = 8);
+    /// @brief Get number of points
+    unsigned size() const { return points_.Size(); }
+    /// @brief Get number of bins along side
+    int gridSize() const { return gridSize_; }
+    /// @brief Get points in source order
+    PointCloud2DNorm sourcePoints() const;
+    /// @brief Append points in normalized range [begin, end] with offset and scale
+    /// @param sourceIndices Optional output of source point index for each point
+    void query(const Vector2& begin, const Vector2& end, const Vector2& offset, float scale,
+        PointCloud2D& dest, PODVector<unsigned>* sourceIndices) const;
+private:
+    /// @brief Get bin of coordinate
+    int binOf(float coord) const { return Clamp(static_cast<int>(coord * gridSize_), 0, gridSize_ - 1); }
+    /// @brief Number of bins along side
+    int gridSize_ = 0;
+    /// @brief Points sorted by bin
+    PointCloud2DNorm points_;
+    /// @brief Source point index of each point
+    PODVector<unsigned> sourceIndices_;
+    /// @brief First point of each bin, with extra end offset
+    PODVector<unsigned> binOffsets_;
+};
+/// @brief Sample Point Cloud with spatial index
+/// @param sourceIndices Optional output of source point index for each sampled point
+PointCloud2D samplePointCloud(const PointCloud2DIndex& index,
+    const Vector2& begin, const Vector2& end,
+    float scale, PODVector<unsigned>* sourceIndices = nullptr);
 /// @brief Poisson random generator
+/// @note Generated point set is tileable: minimal distance is kept across [0, 1] borders
 class PoissonRandom
 {
 public:
@@ -26,13 +66,13 @@ public:
     PoissonRandom(unsigned seed);
     /// @brief Dtor
     ~PoissonRandom();
+    /// @brief Restart random stream from fixed seed, so the next generation repeats the first one
+    void reset(unsigned seed);
     /// @brief Generate
     PointCloud2DNorm generate(float minDist, unsigned newPointsCount, unsigned numPoints);
 private:
-    struct Cell;
     struct Grid;
     float randomFloat();
-    static IntVector2 imageToGrid(const Vector2& p, float cellSize);
     Vector2 popRandom(PointCloud2DNorm& points);
     Vector2 generateRandomPointAround(const Vector2& p, float minDist);
 private:
@@ -2,16 +2,151 @@
 
 #include <FlexEngine/Factory/TextureFactory.h>
 
+#include <Urho3D/Graphics/Geometry.h>
+#include <Urho3D/Graphics/IndexBuffer.h>
+#include <Urho3D/Graphics/Model.h>
+#include <Urho3D/Graphics/Texture2D.h>
+#include <Urho3D/Graphics/VertexBuffer.h>
 #include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
 #include <Urho3D/IO/Log.h>
+#include <Urho3D/IO/MemoryBuffer.h>
+#include <Urho3D/IO/VectorBuffer.h>
 #include <Urho3D/Resource/Image.h>
 #include <Urho3D/Resource/Resource.h>
 #include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Resource/ResourceEvents.h>
 
 namespace FlexEngine
 {
 
+namespace
+{
+
+/// Return index of buffer in vector or M_MAX_UNSIGNED if not found.
+template <class T>
+unsigned GetBufferIndex(const Vector<SharedPtr<T>>& buffers, T* buffer)
+{
+    const unsigned index = buffers.IndexOf(SharedPtr<T>(buffer));
+    return index < buffers.Size() ? index : M_MAX_UNSIGNED;
+}
+
+/// Return whether two models have the same layout of buffers and geometries.
+bool IsSameModelLayout(const Model& lhs, const Model& rhs)
+{
+    const Vector<SharedPtr<VertexBuffer>>& lhsVertexBuffers = lhs.GetVertexBuffers();
+    const Vector<SharedPtr<VertexBuffer>>& rhsVertexBuffers = rhs.GetVertexBuffers();
+    const Vector<SharedPtr<IndexBuffer>>& lhsIndexBuffers = lhs.GetIndexBuffers();
+    const Vector<SharedPtr<IndexBuffer>>& rhsIndexBuffers = rhs.GetIndexBuffers();
+    if (lhsVertexBuffers.Size() != rhsVertexBuffers.Size() || lhsIndexBuffers.Size() != rhsIndexBuffers.Size())
+        return false;
+
+    for (unsigned i = 0; i < lhsVertexBuffers.Size(); ++i)
+    {
+        const VertexBuffer& lhsBuffer = *lhsVertexBuffers[i];
+        const VertexBuffer& rhsBuffer = *rhsVertexBuffers[i];
+        if (lhsBuffer.GetVertexCount() != rhsBuffer.GetVertexCount() || lhsBuffer.GetElements() != rhsBuffer.GetElements()
+            || !lhsBuffer.IsShadowed() || !rhsBuffer.GetShadowData())
+            return false;
+    }
+
+    for (unsigned i = 0; i < lhsIndexBuffers.Size(); ++i)
+    {
+        const IndexBuffer& lhsBuffer = *lhsIndexBuffers[i];
+        const IndexBuffer& rhsBuffer = *rhsIndexBuffers[i];
+        if (lhsBuffer.GetIndexCount() != rhsBuffer.GetIndexCount() || lhsBuffer.GetIndexSize() != rhsBuffer.GetIndexSize()
+            || !lhsBuffer.IsShadowed() || !rhsBuffer.GetShadowData())
+            return false;
+    }
+
+    if (lhs.GetNumGeometries() != rhs.GetNumGeometries())
+        return false;
+
+    for (unsigned i = 0; i < lhs.GetNumGeometries(); ++i)
+    {
+        if (lhs.GetNumGeometryLodLevels(i) != rhs.GetNumGeometryLodLevels(i))
+            return false;
+
+        for (unsigned j = 0; j < lhs.GetNumGeometryLodLevels(i); ++j)
+        {
+            const Geometry& lhsGeometry = *lhs.GetGeometry(i, j);
+            const Geometry& rhsGeometry = *rhs.GetGeometry(i, j);
+            if (lhsGeometry.GetNumVertexBuffers() != rhsGeometry.GetNumVertexBuffers())
+                return false;
+            for (unsigned k = 0; k < lhsGeometry.GetNumVertexBuffers(); ++k)
+            {
+                if (GetBufferIndex(lhsVertexBuffers, lhsGeometry.GetVertexBuffer(k))
+                    != GetBufferIndex(rhsVertexBuffers, rhsGeometry.GetVertexBuffer(k)))
+                    return false;
+            }
+            if (GetBufferIndex(lhsIndexBuffers, lhsGeometry.GetIndexBuffer())
+                != GetBufferIndex(rhsIndexBuffers, rhsGeometry.GetIndexBuffer()))
+                return false;
+        }
+    }
+    return true;
+}
+
+/// Copy buffer contents and geometry ranges of source model into destination model with the same layout.
+void UpdateModelInPlace(Model& dest, const Model& source)
+{
+    for (unsigned i = 0; i < dest.GetVertexBuffers().Size(); ++i)
+        dest.GetVertexBuffers()[i]->SetData(source.GetVertexBuffers()[i]->GetShadowData());
+    for (unsigned i = 0; i < dest.GetIndexBuffers().Size(); ++i)
+        dest.GetIndexBuffers()[i]->SetData(source.GetIndexBuffers()[i]->GetShadowData());
+
+    for (unsigned i = 0; i < dest.GetNumGeometries(); ++i)
+    {
+        for (unsigned j = 0; j < dest.GetNumGeometryLodLevels(i); ++j)
+        {
+            Geometry& destGeometry = *dest.GetGeometry(i, j);
+            const Geometry& sourceGeometry = *source.GetGeometry(i, j);
+            destGeometry.SetDrawRange(sourceGeometry.GetPrimitiveType(),
+                sourceGeometry.GetIndexStart(), sourceGeometry.GetIndexCount(),
+                sourceGeometry.GetVertexStart(), sourceGeometry.GetVertexCount(), false);
+            destGeometry.SetLodDistance(sourceGeometry.GetLodDistance());
+        }
+        dest.SetGeometryCenter(i, source.GetGeometryCenter(i));
+    }
+    dest.SetBoundingBox(source.GetBoundingBox());
+}
+
+/// Copy pixels of uncompressed image into another image and notify its users.
+void UpdateImageInPlace(Image& dest, const Image& source)
+{
+    dest.SendEvent(E_RELOADSTARTED);
+    if (dest.SetSize(source.GetWidth(), source.GetHeight(), source.GetDepth(), source.GetComponents()))
+    {
+        dest.SetData(source.GetData());
+        dest.SendEvent(E_RELOADFINISHED);
+    }
+    else
+        dest.SendEvent(E_RELOADFAILED);
+}
+
+/// Upload uncompressed image into texture and notify its users.
+void UpdateTextureInPlace(Texture2D& dest, Image& source)
+{
+    dest.SendEvent(E_RELOADSTARTED);
+    if (dest.SetData(&source))
+        dest.SendEvent(E_RELOADFINISHED);
+    else
+        dest.SendEvent(E_RELOADFAILED);
+}
+
+/// Load resource from memory and notify its users.
+void ReloadResourceFromMemory(Resource& resource, const VectorBuffer& data)
+{
+    resource.SendEvent(E_RELOADSTARTED);
+    MemoryBuffer buffer(data.GetData(), data.GetSize());
+    if (resource.Load(buffer))
+        resource.SendEvent(E_RELOADFINISHED);
+    else
+        resource.SendEvent(E_RELOADFAILED);
+}
+
+}
+
 String GetOutputResourceCacheDir(ResourceCache& resourceCache)
 {
     const StringVector& dirs = resourceCache.GetResourceDirs();
@@ -75,4 +210,63 @@ bool SaveResource(Resource& resource, bool reloadAfter)
     return false;
 }
 
+bool SerializeResource(const Resource& resource, VectorBuffer& dest)
+{
+    // Images are saved in format chosen by file extension, only PNG matches Image::Save
+    if (resource.GetType() == Image::GetTypeStatic() && GetExtension(resource.GetName()) != ".png")
+        return false;
+
+    dest.Clear();
+    return resource.Save(dest);
+}
+
+void ReplaceResource(Resource& resource, const VectorBuffer& data)
+{
+    ResourceCache* cache = resource.GetSubsystem<ResourceCache>();
+    const String& resourceName = resource.GetName();
+    const StringHash nameHash(resourceName);
+
+    // Uncompressed images are copied directly without encoding
+    Image* rawImage = DynamicCast<Image>(&resource);
+    if (rawImage && rawImage->IsCompressed())
+        rawImage = nullptr;
+
+    // Update cached resource of the same type
+    Resource* cachedResource = cache->GetExistingResource(resource.GetType(), resourceName);
+    if (!cachedResource)
+        cache->AddManualResource(&resource);
+    else if (cachedResource != &resource)
+    {
+        Model* cachedModel = DynamicCast<Model>(cachedResource);
+        Model* model = DynamicCast<Model>(&resource);
+        Image* cachedImage = DynamicCast<Image>(cachedResource);
+        if (cachedModel && model && IsSameModelLayout(*cachedModel, *model))
+        {
+            UpdateModelInPlace(*cachedModel, *model);
+            cachedModel->SendEvent(E_RELOADFINISHED);
+        }
+        else if (cachedImage && rawImage)
+            UpdateImageInPlace(*cachedImage, *rawImage);
+        else if (data.GetSize() > 0)
+            ReloadResourceFromMemory(*cachedResource, data);
+    }
+
+    // Update cached resources of other types, e.g. textures loaded from generated image
+    for (const auto& group : cache->GetAllResources())
+    {
+        if (group.first_ == resource.GetType())
+            continue;
+
+        auto iter = group.second_.resources_.Find(nameHash);
+        if (iter == group.second_.resources_.End())
+            continue;
+
+        Texture2D* texture = DynamicCast<Texture2D>(iter->second_.Get());
+        if (texture && rawImage)
+            UpdateTextureInPlace(*texture, *rawImage);
+        else if (data.GetSize() > 0)
+            ReloadResourceFromMemory(*iter->second_, data);
+    }
+}
+
 }
@@ -10,6 +10,7 @@ namespace Urho3D
 class FileSystem;
 class Resource;
 class ResourceCache;
+class VectorBuffer;
 
 }
 
@@ -31,4 +32,14 @@ void CreateDirectoriesToFile(ResourceCache& resourceCache, const String& fileNam
 /// Save resource to file. Name of resource mustn't be empty.
 bool SaveResource(Resource& resource, bool reloadAfter = true);
 
+/// Serialize resource to memory in the same format as SaveResource writes it. Return false if resource can only be saved to file.
+bool SerializeResource(const Resource& resource, VectorBuffer& dest);
+
+/// Replace content of cached resource with the same name without file access.
+/// Cached resource object is kept, so its users are updated. Models with matching layout get their buffers updated in place.
+/// Cached resources of other types with the same name are loaded from serialized data.
+/// Uncompressed images and textures with the same name are updated from pixels, so serialized data of such image may be empty.
+/// If there is no cached resource, the resource is added to cache as manual resource.
+void ReplaceResource(Resource& resource, const VectorBuffer& data);
+
 }
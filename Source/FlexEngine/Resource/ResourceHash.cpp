@@ -7,8 +7,10 @@
 #include <Urho3D/Graphics/Model.h>
 #include <Urho3D/Graphics/Texture2D.h>
 #include <Urho3D/Graphics/VertexBuffer.h>
+#include <Urho3D/IO/File.h>
 #include <Urho3D/Resource/Image.h>
 #include <Urho3D/Resource/Resource.h>
+#include <Urho3D/Resource/ResourceCache.h>
 
 namespace FlexEngine
 {
@@ -41,17 +43,23 @@ Hash HashResource(Resource* resource)
         hash.HashUInt(vertexBuffers.Size());
         for (unsigned i = 0; i < vertexBuffers.Size(); ++i)
         {
-            hash.HashUInt64(vertexBuffers[i]->GetBufferHash(0));
-            hash.HashUInt(vertexBuffers[i]->GetVertexCount());
-            hash.HashUInt(vertexBuffers[i]->GetVertexSize());
+            VertexBuffer* vertexBuffer = vertexBuffers[i];
+            hash.HashUInt64(vertexBuffer->GetBufferHash(0));
+            hash.HashUInt(vertexBuffer->GetVertexCount());
+            hash.HashUInt(vertexBuffer->GetVertexSize());
+            if (const unsigned char* data = vertexBuffer->GetShadowData())
+                hash.HashData(data, vertexBuffer->GetVertexCount() * vertexBuffer->GetVertexSize());
         }
 
         const Vector<SharedPtr<IndexBuffer>>& indexBuffers = model->GetIndexBuffers();
         hash.HashUInt(indexBuffers.Size());
         for (unsigned i = 0; i < indexBuffers.Size(); ++i)
         {
-            hash.HashUInt(indexBuffers[i]->GetIndexCount());
-            hash.HashUInt(indexBuffers[i]->GetIndexSize());
+            IndexBuffer* indexBuffer = indexBuffers[i];
+            hash.HashUInt(indexBuffer->GetIndexCount());
+            hash.HashUInt(indexBuffer->GetIndexSize());
+            if (const unsigned char* data = indexBuffer->GetShadowData())
+                hash.HashData(data, indexBuffer->GetIndexCount() * indexBuffer->GetIndexSize());
         }
     }
     else if (resource->IsInstanceOf<Image>())
@@ -62,6 +70,21 @@ Hash HashResource(Resource* resource)
         hash.HashUInt(Max(1, image->GetHeight()));
         hash.HashUInt(Max(1, image->GetDepth()));
         hash.HashUInt(image->GetComponents());
+        hash.HashUInt(image->GetCompressedFormat());
+        if (!image->IsCompressed() && image->GetData())
+        {
+            const unsigned size = Max(1, image->GetWidth()) * Max(1, image->GetHeight()) * Max(1, image->GetDepth()) * image->GetComponents();
+            hash.HashData(image->GetData(), size);
+        }
+        else if (image->IsCompressed() && image->GetData())
+        {
+            // Compressed levels are stored one after another
+            unsigned size = 0;
+            hash.HashUInt(image->GetNumCompressedLevels());
+            for (unsigned i = 0; i < image->GetNumCompressedLevels(); ++i)
+                size += image->GetCompressedLevel(i).dataSize_;
+            hash.HashData(image->GetData(), size);
+        }
     }
     else if (resource->IsInstanceOf<Texture2D>())
     {
@@ -80,6 +103,26 @@ Hash HashResource(Resource* resource)
     return hash;
 }
 
+bool HashResourceFile(Hash& hash, ResourceCache& cache, const String& name)
+{
+    hash.HashString(name);
+    SharedPtr<File> file = cache.GetFile(name, false);
+    if (!file)
+        return false;
+
+    static const unsigned chunkSize = 16 * 1024;
+    unsigned char buffer[chunkSize];
+    hash.HashUInt(file->GetSize());
+    while (!file->IsEof())
+    {
+        const unsigned size = file->Read(buffer, chunkSize);
+        if (size == 0)
+            break;
+        hash.HashData(buffer, size);
+    }
+    return true;
+}
+
 void InitializeStubResource(Resource* resource)
 {
     Context* context = resource->GetContext();
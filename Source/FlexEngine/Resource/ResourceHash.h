@@ -6,6 +6,7 @@ namespace Urho3D
 {
 
 class Resource;
+class ResourceCache;
 
 }
 
@@ -20,6 +21,9 @@ static const unsigned NUM_DEFAULT_MODEL_GEOMETRIES = 32;
 /// Compute hash of resource.
 Hash HashResource(Resource* resource);
 
+/// Hash name and file content of resource. Only name is hashed if there is no such file. Return false if there is no such file.
+bool HashResourceFile(Hash& hash, ResourceCache& cache, const String& name);
+
 /// Initialize stub resource.
 void InitializeStubResource(Resource* resource);
 
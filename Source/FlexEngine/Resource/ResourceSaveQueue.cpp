@@ -0,0 +1,253 @@
+#include <FlexEngine/Resource/ResourceSaveQueue.h>
+
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Core/WorkQueue.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/Image.h>
+#include <Urho3D/Resource/ResourceCache.h>
+
+namespace FlexEngine
+{
+
+namespace
+{
+
+/// Return name of temporary file of save that is renamed to specified file. Extension is kept because images are encoded by extension.
+String GetTemporaryFileName(const String& fileName, unsigned sequence)
+{
+    return GetPath(fileName) + GetFileName(fileName) + ".tmp" + String(sequence) + GetExtension(fileName, false);
+}
+
+/// Replace destination file with source file. Replacement is atomic if platform supports it.
+bool ReplaceFile(FileSystem& fileSystem, const String& source, const String& dest)
+{
+    if (fileSystem.Rename(source, dest))
+        return true;
+
+    // Rename may fail if destination exists
+    fileSystem.Delete(dest);
+    return fileSystem.Rename(source, dest);
+}
+
+}
+
+ResourceSaveQueue::ResourceSaveQueue(Context* context)
+    : Object(context)
+    , workQueue_(GetSubsystem<WorkQueue>())
+{
+    SubscribeToEvent(E_BEGINFRAME, URHO3D_HANDLER(ResourceSaveQueue, HandleBeginFrame));
+}
+
+ResourceSaveQueue::~ResourceSaveQueue()
+{
+    // Worker threads reference the queue
+    Flush();
+}
+
+void ResourceSaveQueue::SaveData(const String& fileName, VectorBuffer& data, ResourceSavedCallback callback, unsigned userData,
+    const String& resourceName)
+{
+    UniquePtr<SaveTask> task = MakeUnique<SaveTask>();
+    task->fileName_ = fileName;
+    task->data_.Swap(data);
+    task->size_ = task->data_.GetSize();
+    task->callback_ = callback;
+    task->userData_ = userData;
+    task->resourceName_ = resourceName;
+    QueueTask(task);
+}
+
+bool ResourceSaveQueue::SaveImage(const String& fileName, const Image& image, ResourceSavedCallback callback, unsigned userData,
+    const String& resourceName)
+{
+    if (image.IsCompressed())
+        return false;
+
+    UniquePtr<SaveTask> task = MakeUnique<SaveTask>();
+    task->image_ = MakeShared<Image>(context_);
+    if (!task->image_->SetSize(image.GetWidth(), image.GetHeight(), image.GetDepth(), image.GetComponents()))
+        return false;
+    task->image_->SetData(image.GetData());
+
+    task->fileName_ = fileName;
+    task->size_ = image.GetWidth() * image.GetHeight() * image.GetDepth() * image.GetComponents();
+    task->callback_ = callback;
+    task->userData_ = userData;
+    task->resourceName_ = resourceName;
+    QueueTask(task);
+    return true;
+}
+
+void ResourceSaveQueue::Flush()
+{
+    WaitForSpace(M_MAX_UNSIGNED);
+    IgnoreWrittenResourcesReload();
+}
+
+unsigned long long ResourceSaveQueue::GetPendingSize() const
+{
+    MutexLock lock(mutex_);
+    return pendingSize_;
+}
+
+unsigned ResourceSaveQueue::GetNumPendingSaves() const
+{
+    MutexLock lock(mutex_);
+    return numPendingSaves_;
+}
+
+void ResourceSaveQueue::WaitForSpace(unsigned size)
+{
+    while (GetNumPendingSaves() > 0 && GetPendingSize() + size > maxPendingSize_)
+    {
+        // Items are processed on main thread if there are no worker threads
+        if (!workQueue_ || workQueue_->GetNumThreads() == 0)
+        {
+            if (workQueue_)
+                workQueue_->Complete(0);
+            break;
+        }
+        Time::Sleep(1);
+    }
+}
+
+void ResourceSaveQueue::QueueTask(UniquePtr<SaveTask>& task)
+{
+    WaitForSpace(task->size_);
+    {
+        MutexLock lock(mutex_);
+        task->sequence_ = ++lastSequence_;
+        latestSaves_[task->fileName_] = task->sequence_;
+    }
+
+    // Save synchronously if there is no work queue
+    if (!workQueue_)
+    {
+        WriteTask(*task);
+        return;
+    }
+
+    {
+        MutexLock lock(mutex_);
+        pendingSize_ += task->size_;
+        ++numPendingSaves_;
+    }
+
+    SharedPtr<WorkItem> item = workQueue_->GetFreeItem();
+    item->start_ = task.Detach();
+    item->aux_ = this;
+    item->workFunction_ = &SaveAsync;
+    item->priority_ = 0;
+    workQueue_->AddWorkItem(item);
+}
+
+bool ResourceSaveQueue::IsLatestSave(const SaveTask& task) const
+{
+    auto iter = latestSaves_.Find(task.fileName_);
+    return iter != latestSaves_.End() && iter->second_ == task.sequence_;
+}
+
+void ResourceSaveQueue::ForgetLatestSave(const SaveTask& task)
+{
+    MutexLock lock(mutex_);
+    if (IsLatestSave(task))
+        latestSaves_.Erase(task.fileName_);
+}
+
+bool ResourceSaveQueue::WriteTask(SaveTask& task)
+{
+    // Skip outdated saves
+    {
+        MutexLock lock(mutex_);
+        if (!IsLatestSave(task))
+            return false;
+    }
+
+    // Write temporary file
+    FileSystem* fileSystem = context_->GetSubsystem<FileSystem>();
+    const String temporaryFileName = GetTemporaryFileName(task.fileName_, task.sequence_);
+    bool written = false;
+    if (task.image_)
+        written = task.image_->SaveFile(temporaryFileName);
+    else
+    {
+        File file(context_, temporaryFileName, FILE_WRITE);
+        written = file.IsOpen() && file.Write(task.data_.GetData(), task.data_.GetSize()) == task.data_.GetSize();
+    }
+
+    if (!written)
+    {
+        URHO3D_LOGERROR("Cannot save resource file " + task.fileName_);
+        fileSystem->Delete(temporaryFileName);
+        ForgetLatestSave(task);
+        return false;
+    }
+
+    // Replace file unless newer save was queued meanwhile. Check and rename are done under separate lock, so queueing is not blocked by disk
+    {
+        MutexLock renameLock(renameMutex_);
+        bool isLatest = false;
+        {
+            MutexLock lock(mutex_);
+            isLatest = IsLatestSave(task);
+        }
+        if (!isLatest || !ReplaceFile(*fileSystem, temporaryFileName, task.fileName_))
+        {
+            fileSystem->Delete(temporaryFileName);
+            ForgetLatestSave(task);
+            return false;
+        }
+    }
+    ForgetLatestSave(task);
+
+    if (task.callback_)
+        task.callback_(context_, task.fileName_, task.userData_);
+    if (!task.resourceName_.Empty())
+    {
+        MutexLock lock(mutex_);
+        writtenResources_.Push(task.resourceName_);
+    }
+    return true;
+}
+
+void ResourceSaveQueue::HandleBeginFrame(StringHash /*eventType*/, VariantMap& /*eventData*/)
+{
+    IgnoreWrittenResourcesReload();
+}
+
+void ResourceSaveQueue::IgnoreWrittenResourcesReload()
+{
+    Vector<String> writtenResources;
+    {
+        MutexLock lock(mutex_);
+        writtenResources.Swap(writtenResources_);
+    }
+
+    // Ignored names are removed only when file change is detected, so they are not registered if nothing watches files
+    ResourceCache* cache = GetSubsystem<ResourceCache>();
+    if (!cache || !cache->GetAutoReloadResources())
+        return;
+
+    for (const String& resourceName : writtenResources)
+        cache->IgnoreResourceReload(resourceName);
+}
+
+void ResourceSaveQueue::SaveAsync(const WorkItem* workItem, unsigned /*threadIndex*/)
+{
+    ResourceSaveQueue& self = *reinterpret_cast<ResourceSaveQueue*>(workItem->aux_);
+    UniquePtr<SaveTask> task(reinterpret_cast<SaveTask*>(workItem->start_));
+    self.WriteTask(*task);
+
+    // Release task before it's reported as finished
+    const unsigned size = task->size_;
+    task.Reset();
+
+    MutexLock lock(self.mutex_);
+    self.pendingSize_ -= size;
+    --self.numPendingSaves_;
+}
+
+}
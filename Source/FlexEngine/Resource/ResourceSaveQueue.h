@@ -0,0 +1,119 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+
+#include <Urho3D/Container/HashMap.h>
+#include <Urho3D/Container/Ptr.h>
+#include <Urho3D/Core/Mutex.h>
+#include <Urho3D/Core/Object.h>
+#include <Urho3D/IO/VectorBuffer.h>
+
+namespace Urho3D
+{
+
+class Image;
+class WorkQueue;
+struct WorkItem;
+
+}
+
+namespace FlexEngine
+{
+
+/// Function called on worker thread when file is saved.
+using ResourceSavedCallback = void(*)(Context* context, const String& fileName, unsigned userData);
+
+/// Background queue of resource file saves. Files are encoded and written on worker threads to temporary files
+/// and atomically renamed on completion. Only the latest queued save of each file is written.
+/// Main thread waits when total size of pending saves exceeds the limit.
+class ResourceSaveQueue : public Object
+{
+    URHO3D_OBJECT(ResourceSaveQueue, Object);
+
+public:
+    /// Construct.
+    ResourceSaveQueue(Context* context);
+    /// Destruct. Wait for pending saves.
+    virtual ~ResourceSaveQueue();
+
+    /// Queue save of serialized resource. Queue takes ownership of data, source buffer is left empty.
+    /// Automatic reload of resource with specified name is ignored if the file is actually written.
+    void SaveData(const String& fileName, VectorBuffer& data, ResourceSavedCallback callback = nullptr, unsigned userData = 0,
+        const String& resourceName = String::EMPTY);
+    /// Queue save of uncompressed image in format chosen by file extension. Pixels are copied. Return false if image cannot be saved in background.
+    /// Automatic reload of resource with specified name is ignored if the file is actually written.
+    bool SaveImage(const String& fileName, const Image& image, ResourceSavedCallback callback = nullptr, unsigned userData = 0,
+        const String& resourceName = String::EMPTY);
+    /// Wait for all pending saves.
+    void Flush();
+
+    /// Set max total size of pending saves, in bytes.
+    void SetMaxPendingSize(unsigned long long maxPendingSize) { maxPendingSize_ = maxPendingSize; }
+    /// Return max total size of pending saves, in bytes.
+    unsigned long long GetMaxPendingSize() const { return maxPendingSize_; }
+    /// Return total size of pending saves, in bytes.
+    unsigned long long GetPendingSize() const;
+    /// Return number of pending saves.
+    unsigned GetNumPendingSaves() const;
+
+private:
+    /// Save of file on worker thread.
+    struct SaveTask
+    {
+        /// File name.
+        String fileName_;
+        /// Serialized resource.
+        VectorBuffer data_;
+        /// Image to encode if serialized resource is empty.
+        SharedPtr<Image> image_;
+        /// Size of task, in bytes.
+        unsigned size_ = 0;
+        /// Sequence number of save.
+        unsigned sequence_ = 0;
+        /// Function called when file is saved.
+        ResourceSavedCallback callback_ = nullptr;
+        /// User data of callback.
+        unsigned userData_ = 0;
+        /// Name of resource whose automatic reload is ignored when file is written.
+        String resourceName_;
+    };
+
+    /// Handle begin frame event.
+    void HandleBeginFrame(StringHash eventType, VariantMap& eventData);
+    /// Ignore automatic reload of resources whose files were written. Must be called from main thread.
+    void IgnoreWrittenResourcesReload();
+
+    /// Wait until pending saves fit size limit.
+    void WaitForSpace(unsigned size);
+    /// Register and queue task. Task is written synchronously if there is no work queue.
+    void QueueTask(UniquePtr<SaveTask>& task);
+    /// Return whether the task is the latest queued save of its file. Must be called under lock.
+    bool IsLatestSave(const SaveTask& task) const;
+    /// Forget the latest save of file if it's the task.
+    void ForgetLatestSave(const SaveTask& task);
+    /// Write task to file. Return true if successful.
+    bool WriteTask(SaveTask& task);
+    /// Save file on worker thread.
+    static void SaveAsync(const WorkItem* workItem, unsigned threadIndex);
+
+    /// Work queue.
+    WeakPtr<WorkQueue> workQueue_;
+    /// Max total size of pending saves, in bytes.
+    unsigned long long maxPendingSize_ = 256ull * 1024 * 1024;
+    /// Mutex of pending saves.
+    mutable Mutex mutex_;
+    /// Mutex of file replacement. Held while checking the latest save and renaming file.
+    Mutex renameMutex_;
+    /// Total size of pending saves, in bytes.
+    unsigned long long pendingSize_ = 0;
+    /// Number of pending saves.
+    unsigned numPendingSaves_ = 0;
+    /// Sequence number of the last queued save.
+    unsigned lastSequence_ = 0;
+    /// Sequence number of the latest save of each file with pending save.
+    HashMap<String, unsigned> latestSaves_;
+    /// Names of resources whose files were written and whose reload is not ignored yet.
+    Vector<String> writtenResources_;
+};
+
+}
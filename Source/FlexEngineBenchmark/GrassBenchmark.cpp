@@ -0,0 +1,378 @@
+#include "GrassBenchmark.h"
+
+#include <FlexEngine/Graphics/Grass.h>
+#include <FlexEngine/Graphics/TerrainOcclusion.h>
+#include <FlexEngine/Math/BlueNoiseTileSet.h>
+#include <FlexEngine/Math/PoissonRandom.h>
+
+#include <Urho3D/Container/Sort.h>
+#include <Urho3D/Core/CoreEvents.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Engine/Engine.h>
+#include <Urho3D/Graphics/Camera.h>
+#include <Urho3D/Graphics/Drawable.h>
+#include <Urho3D/Graphics/Octree.h>
+#include <Urho3D/Graphics/Terrain.h>
+#include <Urho3D/IO/File.h>
+#include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/Resource/Image.h>
+#include <Urho3D/Resource/JSONFile.h>
+#include <Urho3D/Scene/Scene.h>
+
+#include <Urho3D/DebugNew.h>
+
+URHO3D_DEFINE_APPLICATION_MAIN(GrassBenchmark);
+
+namespace
+{
+
+/// Names of camera paths.
+static const char* grassBenchmarkPathNames[] =
+{
+    "Straight",
+    "Circle",
+    "Teleport",
+    0
+};
+
+/// Height of camera above terrain.
+static const float cameraHeight = 2.0f;
+/// Interval between camera jumps of teleport path, in seconds.
+static const float teleportInterval = 2.0f;
+/// Max number of frames of initial load.
+static const unsigned maxInitialLoadFrames = 100000;
+/// Number of sampled rectangles in point cloud benchmark.
+static const unsigned numSampleIterations = 200;
+/// Number of pattern regenerations in point cloud benchmark.
+static const unsigned numGenerateIterations = 10;
+
+/// Return directory with assets that contains Architect resources, or empty string if not found.
+/// Current and program directories and their parents are searched.
+String FindAssetDirectory(FileSystem& fileSystem)
+{
+    static const char* parentPaths[] = { "", "../", "../../", "../../../" };
+    const String roots[] = { fileSystem.GetCurrentDir(), fileSystem.GetProgramDir() };
+    for (const String& root : roots)
+    {
+        for (const char* parentPath : parentPaths)
+        {
+            const String directory = root + parentPath + "Asset/";
+            if (fileSystem.DirExists(directory + "Architect"))
+                return directory;
+        }
+    }
+    return String::EMPTY;
+}
+
+/// Return value at specified percentile of sorted values.
+float GetPercentile(const PODVector<float>& sortedValues, float percentile)
+{
+    if (sortedValues.Empty())
+        return 0.0f;
+    const unsigned index = Min(sortedValues.Size() - 1, static_cast<unsigned>(percentile * sortedValues.Size()));
+    return sortedValues[index];
+}
+
+/// Return synthetic terrain height in range [0, 1].
+float GetSyntheticHeight(float x, float y)
+{
+    const float hills = Sin(x * 360.0f * 3.0f) * Cos(y * 360.0f * 2.0f) * 0.25f;
+    const float bumps = Sin(x * 360.0f * 17.0f + y * 360.0f * 5.0f) * 0.05f;
+    return Clamp(0.5f + hills + bumps, 0.0f, 1.0f);
+}
+
+}
+
+GrassBenchmark::GrassBenchmark(Context* context)
+    : Application(context)
+{
+}
+
+void GrassBenchmark::Setup()
+{
+    engineParameters_["Headless"] = true;
+    engineParameters_["LogName"] = String::EMPTY;
+    engineParameters_["AutoloadPaths"] = String::EMPTY;
+
+    // Baked default tile set is loaded from Architect assets, otherwise it is generated on every run
+    if (!engineParameters_.Contains("ResourcePaths"))
+    {
+        const String assetDirectory = FindAssetDirectory(*GetSubsystem<FileSystem>());
+        engineParameters_["ResourcePrefixPaths"] = assetDirectory;
+        engineParameters_["ResourcePaths"] = assetDirectory.Empty() ? String::EMPTY : "Architect";
+    }
+
+    const Vector<String>& arguments = GetArguments();
+    for (unsigned i = 0; i + 1 < arguments.Size(); ++i)
+    {
+        const String argument = arguments[i].ToLower();
+        const String& value = arguments[i + 1];
+        if (argument == "-path")
+            path_ = static_cast<GrassBenchmarkPath>(GetStringListIndex(value.CString(), grassBenchmarkPathNames, 0));
+        else if (argument == "-frames")
+            numFrames_ = ToUInt(value);
+        else if (argument == "-speed")
+            speed_ = ToFloat(value);
+        else if (argument == "-heightmap")
+            heightMapSize_ = Max(3, ToInt(value));
+        else if (argument == "-output")
+            outputFileName_ = value;
+        else
+            continue;
+        ++i;
+    }
+
+    // Results printed to stdout must not be mixed with log, errors are still printed to stderr
+    if (outputFileName_.Empty())
+        engineParameters_["LogQuiet"] = true;
+}
+
+void GrassBenchmark::Start()
+{
+    BlueNoiseTileSet::RegisterObject(context_);
+    Grass::RegisterObject(context_);
+    TerrainOcclusion::RegisterObject(context_);
+    CreateScene();
+
+    JSONValue result;
+    result.Set("path", grassBenchmarkPathNames[static_cast<int>(path_)]);
+    result.Set("frames", numFrames_);
+    result.Set("timeStep", timeStep_);
+    result.Set("speed", speed_);
+    result.Set("heightMapSize", heightMapSize_);
+    RunGrassBenchmark(result);
+    RunSampleBenchmark(result);
+
+    JSONFile json(context_);
+    json.GetRoot() = result;
+    if (outputFileName_.Empty())
+        PrintLine(json.ToString("  "));
+    else
+    {
+        File file(context_, outputFileName_, FILE_WRITE);
+        json.Save(file, "  ");
+    }
+
+    scene_.Reset();
+    engine_->Exit();
+}
+
+void GrassBenchmark::CreateScene()
+{
+    scene_ = MakeShared<Scene>(context_);
+    scene_->CreateComponent<Octree>();
+
+    // Generate synthetic height map
+    SharedPtr<Image> heightMap = MakeShared<Image>(context_);
+    heightMap->SetSize(heightMapSize_, heightMapSize_, 1);
+    for (int y = 0; y < heightMapSize_; ++y)
+    {
+        for (int x = 0; x < heightMapSize_; ++x)
+        {
+            const float height = GetSyntheticHeight(static_cast<float>(x) / heightMapSize_, static_cast<float>(y) / heightMapSize_);
+            heightMap->SetPixel(x, y, Color(height, height, height));
+        }
+    }
+
+    Node* terrainNode = scene_->CreateChild("Terrain");
+    terrain_ = terrainNode->CreateComponent<Terrain>();
+    terrain_->SetSpacing(Vector3(1.0f, 0.2f, 1.0f));
+    terrain_->SetHeightMap(heightMap);
+
+    grass_ = terrainNode->CreateComponent<Grass>();
+    grass_->ApplyAttributes();
+
+    Node* cameraNode = scene_->CreateChild("Camera");
+    camera_ = cameraNode->CreateComponent<Camera>();
+    camera_->SetFarClip(1000.0f);
+}
+
+void GrassBenchmark::RunGrassBenchmark(JSONValue& result)
+{
+    Time* time = GetSubsystem<Time>();
+    Node* cameraNode = camera_->GetNode();
+    VariantMap& eventData = GetEventDataMap();
+
+    const auto runFrame = [&](float cameraTime)
+    {
+        time->BeginFrame(timeStep_);
+
+        const Vector3 position = GetCameraPosition(cameraTime);
+        const Vector3 nextPosition = GetCameraPosition(cameraTime + timeStep_);
+        cameraNode->SetPosition(position);
+        if (!nextPosition.Equals(position))
+            cameraNode->LookAt(nextPosition);
+
+        FrameInfo frame;
+        frame.frameNumber_ = time->GetFrameNumber();
+        frame.timeStep_ = timeStep_;
+        frame.viewSize_ = IntVector2(1920, 1080);
+        frame.camera_ = camera_;
+        frame.octree_ = scene_->GetComponent<Octree>();
+        grass_->UpdateBatches(frame);
+
+        eventData[Update::P_TIMESTEP] = timeStep_;
+        SendEvent(E_UPDATE, eventData);
+
+        time->EndFrame();
+    };
+
+    // Initial load is limited by generation throughput only
+    HiresTimer timer;
+    unsigned numInitialFrames = 0;
+    for (; numInitialFrames < maxInitialLoadFrames; ++numInitialFrames)
+    {
+        runFrame(0.0f);
+        const GrassGenerationStats stats = grass_->GetGenerationStats();
+        if (stats.numPatches_ > 0 && stats.numPendingPatches_ == 0)
+            break;
+    }
+    const float initialLoadTime = timer.GetUSec(true) / 1000000.0f;
+    const GrassGenerationStats initialStats = grass_->GetGenerationStats();
+
+    JSONValue initialLoad;
+    initialLoad.Set("seconds", initialLoadTime);
+    initialLoad.Set("frames", numInitialFrames);
+    initialLoad.Set("patches", initialStats.numUploadedPatches_);
+    initialLoad.Set("blades", initialStats.numUploadedBillboards_);
+    initialLoad.Set("patchesPerSecond", initialStats.numUploadedPatches_ / Max(M_EPSILON, initialLoadTime));
+    initialLoad.Set("bladesPerSecond", initialStats.numUploadedBillboards_ / Max(M_EPSILON, initialLoadTime));
+    result.Set("initialLoad", initialLoad);
+
+    // Camera path is played in real time, so generation overlaps with frames like in game
+    PODVector<float> frameTimes;
+    HiresTimer frameTimer;
+    timer.Reset();
+    for (unsigned i = 0; i < numFrames_; ++i)
+    {
+        frameTimer.Reset();
+        runFrame(i * timeStep_);
+        const float frameTime = frameTimer.GetUSec(false) / 1000.0f;
+        frameTimes.Push(frameTime);
+
+        const float remainingTime = timeStep_ * 1000.0f - frameTime;
+        if (remainingTime >= 1.0f)
+            Time::Sleep(static_cast<unsigned>(remainingTime));
+    }
+    const float pathTime = timer.GetUSec(false) / 1000000.0f;
+    const GrassGenerationStats pathStats = grass_->GetGenerationStats();
+    const unsigned numPathPatches = pathStats.numUploadedPatches_ - initialStats.numUploadedPatches_;
+    const unsigned numPathBlades = pathStats.numUploadedBillboards_ - initialStats.numUploadedBillboards_;
+
+    float totalFrameTime = 0.0f;
+    for (float frameTime : frameTimes)
+        totalFrameTime += frameTime;
+    Sort(frameTimes.Begin(), frameTimes.End());
+
+    JSONValue mainThread;
+    mainThread.Set("meanMs", frameTimes.Empty() ? 0.0f : totalFrameTime / frameTimes.Size());
+    mainThread.Set("p50Ms", GetPercentile(frameTimes, 0.5f));
+    mainThread.Set("p99Ms", GetPercentile(frameTimes, 0.99f));
+    mainThread.Set("maxMs", frameTimes.Empty() ? 0.0f : frameTimes.Back());
+
+    JSONValue cameraPath;
+    cameraPath.Set("seconds", pathTime);
+    cameraPath.Set("patches", numPathPatches);
+    cameraPath.Set("blades", numPathBlades);
+    cameraPath.Set("patchesPerSecond", numPathPatches / Max(M_EPSILON, pathTime));
+    cameraPath.Set("bladesPerSecond", numPathBlades / Max(M_EPSILON, pathTime));
+    cameraPath.Set("pendingPatches", pathStats.numPendingPatches_);
+    cameraPath.Set("mainThread", mainThread);
+    result.Set("cameraPath", cameraPath);
+
+    const GrassPatchPoolStats poolStats = grass_->GetPoolStats();
+    JSONValue memory;
+    memory.Set("arenaBytes", pathStats.arenaMemoryUse_);
+    memory.Set("patchDataBytes", pathStats.patchesMemoryUse_);
+    memory.Set("poolBytes", poolStats.memoryUse_);
+    memory.Set("totalBytes", pathStats.arenaMemoryUse_ + pathStats.patchesMemoryUse_ + poolStats.memoryUse_);
+    result.Set("memory", memory);
+}
+
+void GrassBenchmark::RunSampleBenchmark(JSONValue& result)
+{
+    // Pattern is regenerated from the same seed like on density change, so every iteration does the same work
+    PoissonRandom poisson(0);
+    PointCloud2DNorm cloud;
+    HiresTimer timer;
+    bool identical = true;
+    for (unsigned i = 0; i < numGenerateIterations; ++i)
+    {
+        poisson.reset(0);
+        PointCloud2DNorm generatedCloud = poisson.generate(0.01f, 30, 10000);
+        identical = identical && (i == 0 || generatedCloud == cloud);
+        cloud.Swap(generatedCloud);
+    }
+    const float generateTime = timer.GetUSec(true) / 1000000.0f;
+
+    JSONValue generatePoints;
+    generatePoints.Set("iterations", numGenerateIterations);
+    generatePoints.Set("points", cloud.Size());
+    generatePoints.Set("seconds", generateTime);
+    generatePoints.Set("secondsPerPattern", generateTime / numGenerateIterations);
+    generatePoints.Set("identical", identical);
+    result.Set("generatePointCloud", generatePoints);
+
+    unsigned numPoints = 0;
+    for (unsigned i = 0; i < numSampleIterations; ++i)
+    {
+        const Vector2 begin(static_cast<float>(i), static_cast<float>(i % 7));
+        numPoints += samplePointCloud(cloud, begin, begin + Vector2(32.0f, 32.0f), 13.0f).Size();
+    }
+    const float sampleTime = timer.GetUSec(false) / 1000000.0f;
+
+    const PointCloud2DIndex index(cloud);
+    timer.Reset();
+    unsigned numIndexedPoints = 0;
+    for (unsigned i = 0; i < numSampleIterations; ++i)
+    {
+        const Vector2 begin(static_cast<float>(i), static_cast<float>(i % 7));
+        numIndexedPoints += samplePointCloud(index, begin, begin + Vector2(32.0f, 32.0f), 13.0f).Size();
+    }
+    const float indexedSampleTime = timer.GetUSec(false) / 1000000.0f;
+
+    JSONValue samplePoints;
+    samplePoints.Set("cloudSize", cloud.Size());
+    samplePoints.Set("seconds", sampleTime);
+    samplePoints.Set("points", numPoints);
+    samplePoints.Set("pointsPerSecond", numPoints / Max(M_EPSILON, sampleTime));
+    samplePoints.Set("indexedSeconds", indexedSampleTime);
+    samplePoints.Set("indexedPoints", numIndexedPoints);
+    samplePoints.Set("indexedPointsPerSecond", numIndexedPoints / Max(M_EPSILON, indexedSampleTime));
+    result.Set("samplePointCloud", samplePoints);
+}
+
+Vector3 GrassBenchmark::GetCameraPosition(float time) const
+{
+    const float terrainSize = (heightMapSize_ - 1) * terrain_->GetSpacing().x_;
+    const float pathSize = terrainSize * 0.8f;
+
+    Vector3 position;
+    switch (path_)
+    {
+    case GrassBenchmarkPath::Straight:
+        position = Vector3(-pathSize * 0.5f + Fract(time * speed_ / pathSize) * pathSize, 0.0f, 0.0f);
+        break;
+    case GrassBenchmarkPath::Circle:
+    {
+        const float radius = pathSize * 0.35f;
+        const float angle = time * speed_ / radius * M_RADTODEG;
+        position = Vector3(Cos(angle) * radius, 0.0f, Sin(angle) * radius);
+        break;
+    }
+    case GrassBenchmarkPath::Teleport:
+    {
+        const unsigned jump = static_cast<unsigned>(time / teleportInterval);
+        const float x = (SDBMHash(jump, 0x5a) % 1000) / 1000.0f - 0.5f;
+        const float z = (SDBMHash(jump, 0xa5) % 1000) / 1000.0f - 0.5f;
+        position = Vector3(x * pathSize, 0.0f, z * pathSize);
+        break;
+    }
+    default:
+        break;
+    }
+
+    position.y_ = terrain_->GetHeight(position) + cameraHeight;
+    return position;
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <FlexEngine/Common.h>
+
+#include <Urho3D/Engine/Application.h>
+
+namespace Urho3D
+{
+
+class Camera;
+class JSONValue;
+class Scene;
+class Terrain;
+
+}
+
+namespace FlexEngine
+{
+
+class Grass;
+
+}
+
+using namespace FlexEngine;
+
+/// Camera path of grass benchmark.
+enum class GrassBenchmarkPath
+{
+    /// Straight line across the terrain.
+    Straight,
+    /// Circle around terrain center.
+    Circle,
+    /// Jump to random position every few seconds.
+    Teleport
+};
+
+/// GrassBenchmark application generates grass along scripted camera paths without window and GPU and prints results as JSON.
+class GrassBenchmark : public Application
+{
+    URHO3D_OBJECT(GrassBenchmark, Application);
+
+public:
+    /// Construct.
+    GrassBenchmark(Context* context);
+
+    /// Setup before engine initialization. Parse benchmark options.
+    virtual void Setup() override;
+    /// Setup after engine initialization. Run benchmark and exit.
+    virtual void Start() override;
+
+private:
+    /// Create scene with synthetic terrain and grass.
+    void CreateScene();
+    /// Run frames along camera path and write results.
+    void RunGrassBenchmark(JSONValue& result);
+    /// Run point cloud sampling benchmark and write results.
+    void RunSampleBenchmark(JSONValue& result);
+    /// Return camera position on path at specified time.
+    Vector3 GetCameraPosition(float time) const;
+
+    /// Camera path.
+    GrassBenchmarkPath path_ = GrassBenchmarkPath::Straight;
+    /// Number of frames.
+    unsigned numFrames_ = 1000;
+    /// Time step of frame, in seconds.
+    float timeStep_ = 1.0f / 60.0f;
+    /// Camera speed, in meters per second.
+    float speed_ = 30.0f;
+    /// Size of synthetic heightmap.
+    int heightMapSize_ = 1025;
+    /// Output file name. Results are printed to stdout if empty.
+    String outputFileName_;
+
+    /// Scene.
+    SharedPtr<Scene> scene_;
+    /// Terrain.
+    Terrain* terrain_ = nullptr;
+    /// Grass.
+    Grass* grass_ = nullptr;
+    /// Camera.
+    Camera* camera_ = nullptr;
+};
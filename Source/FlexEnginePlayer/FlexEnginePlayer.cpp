@@ -5,18 +5,29 @@
 
 #include <FlexEngine/AngelScript/ScriptAPI.h>
 #include <FlexEngine/Animation/FootAnimation.h>
+#include <FlexEngine/Factory/ProceduralCache.h>
 #include <FlexEngine/Factory/ProceduralComponent.h>
 #include <FlexEngine/Factory/ScriptedResource.h>
 #include <FlexEngine/Factory/TreeHost.h>
 #include <FlexEngine/Graphics/Grass.h>
 #include <FlexEngine/Graphics/StaticModelEx.h>
+#include <FlexEngine/Graphics/TerrainOcclusion.h>
 #include <FlexEngine/Graphics/Wind.h>
+#include <FlexEngine/Math/BlueNoiseTileSet.h>
+#include <FlexEngine/Resource/ResourceSaveQueue.h>
 #include <FlexEngine/Scene/DynamicComponent.h>
 
 #include <Urho3D/AngelScript/Script.h>
+#include <Urho3D/Core/ProcessUtils.h>
+#include <Urho3D/Core/Timer.h>
+#include <Urho3D/Engine/Engine.h>
 #include <Urho3D/Graphics/Renderer.h>
+#include <Urho3D/IO/File.h>
 #include <Urho3D/IO/FileSystem.h>
+#include <Urho3D/IO/Log.h>
+#include <Urho3D/Resource/JSONFile.h>
 #include <Urho3D/Resource/ResourceCache.h>
+#include <Urho3D/Scene/Scene.h>
 
 #include <Urho3D/DebugNew.h>
 
@@ -27,12 +38,52 @@ FlexEnginePlayer::FlexEnginePlayer(Context* context) :
 {
 }
 
+void FlexEnginePlayer::Setup()
+{
+    bakeMode_ = ParseBakeOptions();
+    if (!bakeMode_)
+    {
+        Urho3DPlayer::Setup();
+        return;
+    }
+
+    // Bake doesn't need window, GPU is used only if requested
+    if (!bakeWithGraphics_)
+        engineParameters_["Headless"] = true;
+    engineParameters_["LogName"] = GetSubsystem<FileSystem>()->GetAppPreferencesDir("urho3d", "logs") + "FlexEngineBake.log";
+    if (!engineParameters_.Contains("ResourcePrefixPaths"))
+        engineParameters_["ResourcePrefixPaths"] = ";../share/Resources;../share/Urho3D/Resources";
+
+    // Report printed to stdout must not be mixed with log
+    if (bakeReportFileName_.Empty())
+        engineParameters_["LogQuiet"] = true;
+}
+
 void FlexEnginePlayer::Start()
 {
-    ResourceCache* resourceCache = GetSubsystem<ResourceCache>();
+    RegisterFlexEngineObjects();
+
+    if (bakeMode_)
+    {
+        // Scripted resources need script subsystem and FlexEngine script API
+        context_->RegisterSubsystem(new Script(context_));
+        RegisterAPI(GetSubsystem<Script>()->GetScriptEngine());
+        Bake();
+        return;
+    }
+
     GetSubsystem<Renderer>()->SetMinInstances(1);
     GetSubsystem<Renderer>()->SetNumExtraInstancingBufferElements(1);
 
+    Urho3DPlayer::Start();
+
+    Script* scriptSubsystem = GetSubsystem<Script>();
+    asIScriptEngine* scriptEngine = scriptSubsystem->GetScriptEngine();
+    RegisterAPI(scriptEngine);
+}
+
+void FlexEnginePlayer::RegisterFlexEngineObjects()
+{
     DynamicComponent::RegisterObject(context_);
     ProceduralSystem::RegisterObject(context_);
     ProceduralComponent::RegisterObject(context_);
@@ -51,14 +102,220 @@ void FlexEnginePlayer::Start()
     CharacterAnimationController::RegisterObject(context_);
 
     StaticModelEx::RegisterObject(context_);
+    BlueNoiseTileSet::RegisterObject(context_);
     Grass::RegisterObject(context_);
-    GrassPatch::RegisterObject(context_);
+    TerrainOcclusion::RegisterObject(context_);
     WindSystem::RegisterObject(context_);
     WindZone::RegisterObject(context_);
+}
 
-    Urho3DPlayer::Start();
+bool FlexEnginePlayer::ParseBakeOptions()
+{
+    bool bakeMode = false;
+    const Vector<String>& arguments = GetArguments();
+    for (unsigned i = 0; i < arguments.Size(); ++i)
+    {
+        const String argument = arguments[i].ToLower();
+        const String& value = i + 1 < arguments.Size() ? arguments[i + 1] : String::EMPTY;
+        if (argument == "-bakeall")
+            bakeAll_ = true;
+        else if (argument == "-bakegpu")
+            bakeWithGraphics_ = true;
+        else if (argument == "-bake" && !value.Empty())
+        {
+            // Scenes are separated by semicolons
+            bakeMode = true;
+            for (const String& sceneName : value.Split(';'))
+                bakeScenes_.Push(sceneName.Trimmed());
+            ++i;
+        }
+        else if (argument == "-bakelist" && !value.Empty())
+        {
+            // Scenes are listed one per line
+            bakeMode = true;
+            File file(context_, value, FILE_READ);
+            if (!file.IsOpen())
+                PrintLine("Cannot open bake list " + value, true);
+            while (file.IsOpen() && !file.IsEof())
+            {
+                const String sceneName = file.ReadLine().Trimmed();
+                if (!sceneName.Empty() && !sceneName.StartsWith("#"))
+                    bakeScenes_.Push(sceneName);
+            }
+            ++i;
+        }
+        else if (argument == "-bakereport" && !value.Empty())
+        {
+            bakeReportFileName_ = value;
+            ++i;
+        }
+        else if (argument == "-bakebluenoise" && !value.Empty())
+        {
+            bakeMode = true;
+            bakeBlueNoiseFileName_ = value;
+            ++i;
+        }
+    }
+    return bakeMode;
+}
 
-    Script* scriptSubsystem = GetSubsystem<Script>();
-    asIScriptEngine* scriptEngine = scriptSubsystem->GetScriptEngine();
-    RegisterAPI(scriptEngine);
+void FlexEnginePlayer::Bake()
+{
+    HiresTimer timer;
+    JSONValue result;
+    JSONArray scenes;
+    unsigned numFailed = 0;
+    if (!bakeBlueNoiseFileName_.Empty())
+    {
+        const bool baked = BlueNoiseTileSet::BakeDefault(context_, bakeBlueNoiseFileName_);
+        result.Set("blueNoiseTileSet", baked);
+        if (!baked)
+            ++numFailed;
+    }
+
+    for (const String& sceneName : bakeScenes_)
+    {
+        JSONValue sceneResult;
+        if (!BakeScene(sceneName, sceneResult))
+            ++numFailed;
+        scenes.Push(sceneResult);
+    }
+
+    result.Set("scenes", scenes);
+    result.Set("failed", numFailed);
+    result.Set("totalTime", timer.GetUSec(false) / 1000.0f);
+
+    JSONFile json(context_);
+    json.GetRoot() = result;
+    if (bakeReportFileName_.Empty())
+        PrintLine(json.ToString("  "));
+    else
+    {
+        File file(context_, bakeReportFileName_, FILE_WRITE);
+        json.Save(file, "  ");
+    }
+
+    exitCode_ = numFailed > 0 ? EXIT_FAILURE : EXIT_SUCCESS;
+    engine_->Exit();
+}
+
+bool FlexEnginePlayer::BakeScene(const String& sceneName, JSONValue& result)
+{
+    ResourceCache* resourceCache = GetSubsystem<ResourceCache>();
+    FileSystem* fileSystem = GetSubsystem<FileSystem>();
+    result.Set("scene", sceneName);
+
+    // Scene may be specified either by file name or by resource name
+    const String fileName = fileSystem->FileExists(sceneName) ? sceneName : resourceCache->GetResourceFileName(sceneName);
+    const String extension = GetExtension(fileName);
+    File sceneFile(context_, fileName, FILE_READ);
+    if (fileName.Empty() || !sceneFile.IsOpen())
+    {
+        URHO3D_LOGERROR("Cannot find scene " + sceneName);
+        result.Set("success", false);
+        return false;
+    }
+
+    // Load scene. Components check their resources on load and become dirty if resources are missing or outdated
+    ProceduralCache* cache = GetSubsystem<ProceduralCache>();
+    const unsigned oldHits = cache ? cache->GetNumHits() : 0;
+    const unsigned oldMisses = cache ? cache->GetNumMisses() : 0;
+    HiresTimer timer;
+    SharedPtr<Scene> scene = MakeShared<Scene>(context_);
+    const bool loaded = extension == ".xml" ? scene->LoadXML(sceneFile)
+        : extension == ".json" ? scene->LoadJSON(sceneFile)
+        : scene->Load(sceneFile);
+    sceneFile.Close();
+    result.Set("loadTime", timer.GetUSec(true) / 1000.0f);
+    if (!loaded)
+    {
+        URHO3D_LOGERROR("Cannot load scene " + sceneName);
+        result.Set("success", false);
+        return false;
+    }
+
+    PODVector<ProceduralComponent*> components;
+    scene->GetDerivedComponents(components, true);
+
+    // Proxies are rendered on GPU
+    PODVector<TreeProxy*> proxies;
+    scene->GetComponents(proxies, true);
+    if (!bakeWithGraphics_ && !proxies.Empty())
+    {
+        URHO3D_LOGERRORF("Scene %s has %u tree proxies that cannot be baked without -bakegpu option",
+            sceneName.CString(), proxies.Size());
+    }
+
+    if (bakeAll_)
+    {
+        for (ProceduralComponent* component : components)
+            component->MarkNeedGeneration();
+    }
+
+    // Generate everything and wait until generated files are written
+    ProceduralSystem* proceduralSystem = scene->GetComponent<ProceduralSystem>();
+    if (proceduralSystem)
+        proceduralSystem->FinishResourceChecks();
+    const unsigned numDirty = proceduralSystem ? proceduralSystem->GetNumDirtyComponents() : 0;
+    if (proceduralSystem)
+        proceduralSystem->Update();
+
+    // Bake exits without rendering a frame, so cache index is saved explicitly
+    cache = GetSubsystem<ProceduralCache>();
+    if (cache)
+        cache->Flush();
+    if (ResourceSaveQueue* saveQueue = GetSubsystem<ResourceSaveQueue>())
+        saveQueue->Flush();
+    result.Set("bakeTime", timer.GetUSec(true) / 1000.0f);
+
+    // Save scene to keep hashes of generated resources
+    bool saved = true;
+    if (numDirty > 0)
+    {
+        File file(context_, fileName, FILE_WRITE);
+        saved = file.IsOpen() && (extension == ".xml" ? scene->SaveXML(file)
+            : extension == ".json" ? scene->SaveJSON(file)
+            : scene->Save(file));
+        if (!saved)
+            URHO3D_LOGERROR("Cannot save scene " + sceneName);
+    }
+    result.Set("saveTime", timer.GetUSec(true) / 1000.0f);
+
+    if (proceduralSystem)
+    {
+        JSONValue stats;
+        proceduralSystem->GetGenerationStatsJSON(stats);
+        result.Set("stats", stats);
+    }
+
+    // Components with skipped outputs or failed generation stay dirty and fail the bake
+    JSONArray incomplete;
+    for (ProceduralComponent* component : components)
+    {
+        const ProceduralGenerationStats& stats = component->GetGenerationStats();
+        if (stats.numSkippedOutputs_ > 0 || stats.numFailures_ > 0)
+        {
+            JSONValue item;
+            item.Set("node", component->GetNode()->GetName());
+            item.Set("nodeId", component->GetNode()->GetID());
+            item.Set("type", component->GetTypeName());
+            item.Set("skippedOutputs", stats.numSkippedOutputs_);
+            item.Set("failed", stats.numFailures_ > 0);
+            incomplete.Push(item);
+        }
+    }
+    if (!incomplete.Empty())
+    {
+        URHO3D_LOGERRORF("Scene %s has %u components that were not generated completely",
+            sceneName.CString(), incomplete.Size());
+    }
+
+    const bool success = saved && incomplete.Empty();
+    result.Set("components", components.Size());
+    result.Set("dirty", numDirty);
+    result.Set("incomplete", incomplete);
+    result.Set("cacheHits", cache ? cache->GetNumHits() - oldHits : 0);
+    result.Set("cacheMisses", cache ? cache->GetNumMisses() - oldMisses : 0);
+    result.Set("success", success);
+    return success;
 }
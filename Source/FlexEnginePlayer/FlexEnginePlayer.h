@@ -3,9 +3,19 @@
 #include <FlexEngine/Common.h>
 #include <Urho3DPlayer/Urho3DPlayer.h>
 
+namespace Urho3D
+{
+
+class JSONValue;
+
+}
+
 using namespace FlexEngine;
 
 /// FlexEnginePlayer application runs a script specified on the command line.
+/// With -bake option it generates procedural resources of specified scenes without window and GPU, prints report as JSON and exits.
+/// Outputs rendered on GPU, e.g. tree proxies, require -bakegpu option, otherwise the bake is reported as failed.
+/// With -bakebluenoise option it also generates default blue noise tile set and saves it to specified file.
 class FlexEnginePlayer : public Urho3DPlayer
 {
     URHO3D_OBJECT(FlexEnginePlayer, Urho3DPlayer);
@@ -14,6 +24,31 @@ public:
     /// Construct.
     FlexEnginePlayer(Context* context);
 
-    /// Setup after engine initialization. Load the script and execute its start function.
-    virtual void Start();
+    /// Setup before engine initialization. Parse bake options or verify that a script file has been specified.
+    virtual void Setup() override;
+    /// Setup after engine initialization. Bake scenes or load the script and execute its start function.
+    virtual void Start() override;
+
+private:
+    /// Register FlexEngine objects.
+    void RegisterFlexEngineObjects();
+    /// Parse bake options. Return true if bake mode is requested.
+    bool ParseBakeOptions();
+    /// Bake all scenes, write report and exit.
+    void Bake();
+    /// Bake scene and write results. Return true if successful.
+    bool BakeScene(const String& sceneName, JSONValue& result);
+
+    /// Whether to bake scenes instead of running script.
+    bool bakeMode_ = false;
+    /// Whether to regenerate all procedural components instead of dirty ones only.
+    bool bakeAll_ = false;
+    /// Whether to keep graphics for GPU baking.
+    bool bakeWithGraphics_ = false;
+    /// Scenes to bake.
+    Vector<String> bakeScenes_;
+    /// Report file name. Report is printed to stdout if empty.
+    String bakeReportFileName_;
+    /// File name of baked default blue noise tile set. Tile set is not baked if empty.
+    String bakeBlueNoiseFileName_;
 };